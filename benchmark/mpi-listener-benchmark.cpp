@@ -0,0 +1,383 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+ ******************************************************************************/
+
+// Measures what the printers cost. The benchmark registers a synthetic
+// test program, then runs it once with no listener at all, as a
+// baseline, and once with each combination of printer and aggregation
+// mode, timing each run on every rank. Printer output is discarded, and
+// rank 0 prints one CSV row per combination, so that runs such as
+//
+//   for n in 2 4 8 16; do
+//     mpirun -np $n mpi-listener-benchmark --tests=1000 --pattern=one
+//   done
+//
+// can be collected into one table to track how the printers scale.
+// Options, with their defaults:
+//
+//   --tests=1000            number of synthetic tests
+//   --tests-per-suite=100   tests per test suite
+//   --failures=1            failures per failing rank per failing test
+//   --message-size=64       characters per failure message
+//   --pattern=one           which ranks fail a test: all, one (one rank,
+//                           a different one for each test), random, or
+//                           none
+//   --fail-fraction=0.1     with --pattern=random, the probability that
+//                           a rank fails a test
+//   --reporting=test        test, suite, or iteration
+//   --printers=minimalist,wrapper
+//   --aggregations=flat,tree,pipelined,shared-memory
+//                           (streaming may be added to the list)
+//   --repetitions=3         runs per combination; the fastest is kept
+//
+// The columns are: ranks, printer, aggregation, reporting, tests,
+// failures, message_size, pattern, rank0_seconds (wall time of
+// RUN_ALL_TESTS on rank 0), max_rank_seconds (the same, on the slowest
+// rank), and overhead_us_per_test (rank 0's time over the baseline's,
+// per test, in microseconds).
+
+#include "gtest/gtest.h"
+#include "gtest-mpi-shared-memory.hpp"
+#include "mpi.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+
+struct BenchmarkOptions
+{
+  BenchmarkOptions() : tests(1000), tests_per_suite(100), failures(1),
+                       message_size(64), pattern("one"), fail_fraction(0.1),
+                       reporting("test"), printers("minimalist,wrapper"),
+                       aggregations("flat,tree,pipelined,shared-memory"),
+                       repetitions(3) {}
+
+  int tests;
+  int tests_per_suite;
+  int failures;
+  int message_size;
+  std::string pattern;
+  double fail_fraction;
+  std::string reporting;
+  std::string printers;
+  std::string aggregations;
+  int repetitions;
+};
+
+std::vector<std::string> splitList(const std::string& list)
+{
+  std::vector<std::string> items;
+  std::stringstream in(list);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    if (!item.empty()) { items.push_back(item); }
+  }
+  return items;
+}
+
+// Whether list names at least one item, and only items of names, both
+// comma-separated
+bool namesOnly(const std::string& list, const std::string& names)
+{
+  const std::vector<std::string> items(splitList(list));
+  const std::vector<std::string> known(splitList(names));
+  for (size_t i = 0; i < items.size(); i++) {
+    if (std::find(known.begin(), known.end(), items[i]) == known.end()) {
+      return false;
+    }
+  }
+  return !items.empty();
+}
+
+// Whether value is one of names, which are comma-separated
+bool isOneOf(const std::string& value, const std::string& names)
+{
+  return value.find(',') == std::string::npos && namesOnly(value, names);
+}
+
+// Parses --name=value arguments into options; returns false on any
+// argument or value it does not know, so that a mistyped name is not
+// benchmarked as some other configuration
+bool parseOptions(int argc, char** argv, BenchmarkOptions& options)
+{
+  for (int i = 1; i < argc; i++) {
+    const std::string arg(argv[i]);
+    const size_t equals = arg.find('=');
+    if (arg.find("--") != 0 || equals == std::string::npos) { return false; }
+    const std::string name(arg.substr(2, equals - 2));
+    const std::string value(arg.substr(equals + 1));
+    if (name == "tests") {
+      options.tests = std::atoi(value.c_str());
+    } else if (name == "tests-per-suite") {
+      options.tests_per_suite = std::atoi(value.c_str());
+    } else if (name == "failures") {
+      options.failures = std::atoi(value.c_str());
+    } else if (name == "message-size") {
+      options.message_size = std::atoi(value.c_str());
+    } else if (name == "pattern") {
+      options.pattern = value;
+    } else if (name == "fail-fraction") {
+      options.fail_fraction = std::atof(value.c_str());
+    } else if (name == "reporting") {
+      options.reporting = value;
+    } else if (name == "printers") {
+      options.printers = value;
+    } else if (name == "aggregations") {
+      options.aggregations = value;
+    } else if (name == "repetitions") {
+      options.repetitions = std::atoi(value.c_str());
+    } else {
+      return false;
+    }
+  }
+  return options.tests_per_suite > 0 && options.repetitions > 0
+      && isOneOf(options.pattern, "all,one,random,none")
+      && isOneOf(options.reporting, "test,suite,iteration")
+      && namesOnly(options.printers, "minimalist,wrapper")
+      && namesOnly(options.aggregations,
+                   "flat,tree,pipelined,streaming,shared-memory");
+}
+
+// Whether rank fails the test with the given index; the same on every
+// run, so that all configurations see the same failures
+bool failsTest(const BenchmarkOptions& options, int index, int rank,
+               int size)
+{
+  if (options.pattern == "all") { return true; }
+  if (options.pattern == "one") { return rank == index % size; }
+  if (options.pattern == "random") {
+    unsigned long hash = 2166136261UL;
+    hash = (hash ^ static_cast<unsigned long>(index)) * 16777619UL;
+    hash = (hash ^ static_cast<unsigned long>(rank)) * 16777619UL;
+    return static_cast<double>(hash % 1000000UL) / 1000000.0
+           < options.fail_fraction;
+  }
+  return false;
+}
+
+class SyntheticTest : public ::testing::Test
+{
+ public:
+  SyntheticTest(const BenchmarkOptions& options_, int index_)
+      : options(options_), index(index_) {}
+
+  virtual void TestBody()
+  {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if (!failsTest(options, index, rank, size)) { return; }
+    const std::string message(options.message_size, 'x');
+    for (int i = 0; i < options.failures; i++) {
+      ADD_FAILURE() << message;
+    }
+  }
+
+ private:
+  const BenchmarkOptions& options;
+  int index;
+};
+
+class SyntheticTestFactory
+{
+ public:
+  SyntheticTestFactory(const BenchmarkOptions& options_, int index_)
+      : options(options_), index(index_) {}
+
+  ::testing::Test* operator()() const
+  {
+    return new SyntheticTest(options, index);
+  }
+
+ private:
+  const BenchmarkOptions& options;
+  int index;
+};
+
+void registerTests(const BenchmarkOptions& options)
+{
+  for (int i = 0; i < options.tests; i++) {
+    std::stringstream suite, name;
+    suite << "Synthetic" << i / options.tests_per_suite;
+    name << "Test" << i;
+    ::testing::RegisterTest(suite.str().c_str(), name.str().c_str(),
+                            NULL, NULL, __FILE__, __LINE__,
+                            SyntheticTestFactory(options, i));
+  }
+}
+
+// Sends stdout to /dev/null while the printers run, and back again
+class StdoutSilencer
+{
+ public:
+  StdoutSilencer() : saved(-1) {}
+
+  void Silence()
+  {
+    std::fflush(stdout);
+    saved = dup(STDOUT_FILENO);
+    const int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    close(devNull);
+  }
+
+  void Restore()
+  {
+    std::fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+  }
+
+ private:
+  int saved;
+};
+
+struct RunTime
+{
+  double rank0_seconds;
+  double max_rank_seconds;
+};
+
+// Runs all tests under the named printer, or under no listener for
+// "none", and returns the fastest of the requested repetitions as seen on rank 0.
+// The printer is created anew for each repetition, since it frees its
+// communicators when the run ends.
+RunTime timeRuns(const BenchmarkOptions& options, const std::string& printer,
+                 const std::string& aggregation,
+                 ::testing::TestEventListener *defaultPrinter)
+{
+  ::testing::TestEventListeners& listeners =
+      ::testing::UnitTest::GetInstance()->listeners();
+  RunTime best = {0.0, 0.0};
+  for (int r = 0; r < options.repetitions; r++) {
+    GTestMPIListener::MPISharedMemoryGatherer gatherer;
+    GTestMPIListener::MPIListenerOptions listenerOptions;
+    if (aggregation == "tree") {
+      listenerOptions.aggregation = GTestMPIListener::kTreeAggregation;
+    } else if (aggregation == "pipelined") {
+      listenerOptions.aggregation = GTestMPIListener::kPipelinedAggregation;
+    } else if (aggregation == "streaming") {
+      listenerOptions.aggregation = GTestMPIListener::kStreamingAggregation;
+    } else if (aggregation == "shared-memory") {
+      listenerOptions.gatherer = &gatherer;
+    }
+    if (options.reporting == "suite") {
+      listenerOptions.reporting = GTestMPIListener::kReportPerTestSuite;
+    } else if (options.reporting == "iteration") {
+      listenerOptions.reporting = GTestMPIListener::kReportPerIteration;
+    }
+
+    ::testing::TestEventListener *listener = NULL;
+    if (printer == "minimalist") {
+      listener = new GTestMPIListener::MPIMinimalistPrinter(MPI_COMM_WORLD,
+                                                            listenerOptions);
+    } else if (printer == "wrapper") {
+      listener = new GTestMPIListener::MPIWrapperPrinter(defaultPrinter,
+                                                         MPI_COMM_WORLD,
+                                                         listenerOptions);
+    }
+    if (listener) { listeners.Append(listener); }
+
+    StdoutSilencer silencer;
+    silencer.Silence();
+    MPI_Barrier(MPI_COMM_WORLD);
+    const double start = MPI_Wtime();
+    int result = RUN_ALL_TESTS();
+    double seconds = MPI_Wtime() - start;
+    silencer.Restore();
+    (void) result;
+
+    if (listener) { delete listeners.Release(listener); }
+
+    double maxSeconds;
+    MPI_Reduce(&seconds, &maxSeconds, 1, MPI_DOUBLE,
+               MPI_MAX, 0, MPI_COMM_WORLD);
+    if (r == 0 || seconds < best.rank0_seconds) {
+      best.rank0_seconds = seconds;
+      best.max_rank_seconds = maxSeconds;
+    }
+  }
+  return best;
+}
+
+} // end anonymous namespace
+
+int main(int argc, char** argv) {
+  // Filter out Google Test arguments
+  ::testing::InitGoogleTest(&argc, argv);
+
+  // Initialize MPI
+  MPI_Init(&argc, &argv);
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  BenchmarkOptions options;
+  if (!parseOptions(argc, argv, options)) {
+    if (rank == 0) {
+      printf("Unknown or invalid option; see the top of "
+             "benchmark/mpi-listener-benchmark.cpp for usage.\n");
+    }
+    MPI_Finalize();
+    return 1;
+  }
+  registerTests(options);
+
+  // Remove default listener: the default printer and the default XML
+  // printer. The default printer is kept to be wrapped by
+  // MPIWrapperPrinter, which does not take ownership of it.
+  ::testing::TestEventListeners& listeners =
+      ::testing::UnitTest::GetInstance()->listeners();
+  ::testing::TestEventListener *defaultPrinter =
+      listeners.Release(listeners.default_result_printer());
+  delete listeners.Release(listeners.default_xml_generator());
+
+  const RunTime baseline = timeRuns(options, "none", "none", defaultPrinter);
+  if (rank == 0) {
+    printf("ranks,printer,aggregation,reporting,tests,failures,"
+           "message_size,pattern,rank0_seconds,max_rank_seconds,"
+           "overhead_us_per_test\n");
+    printf("%d,none,none,%s,%d,%d,%d,%s,%.6f,%.6f,0.000\n", size,
+           options.reporting.c_str(), options.tests, options.failures,
+           options.message_size, options.pattern.c_str(),
+           baseline.rank0_seconds, baseline.max_rank_seconds);
+  }
+
+  const std::vector<std::string> printers(splitList(options.printers));
+  const std::vector<std::string> aggregations(
+      splitList(options.aggregations));
+  for (size_t p = 0; p < printers.size(); p++) {
+    for (size_t a = 0; a < aggregations.size(); a++) {
+      const RunTime run = timeRuns(options, printers[p], aggregations[a],
+                                   defaultPrinter);
+      if (rank == 0) {
+        const double overhead = (options.tests > 0)
+            ? 1e6 * (run.rank0_seconds - baseline.rank0_seconds)
+              / options.tests
+            : 0.0;
+        printf("%d,%s,%s,%s,%d,%d,%d,%s,%.6f,%.6f,%.3f\n", size,
+               printers[p].c_str(), aggregations[a].c_str(),
+               options.reporting.c_str(), options.tests, options.failures,
+               options.message_size, options.pattern.c_str(),
+               run.rank0_seconds, run.max_rank_seconds, overhead);
+        std::fflush(stdout);
+      }
+    }
+  }
+
+  delete defaultPrinter;
+  MPI_Finalize();
+  return 0;
+}
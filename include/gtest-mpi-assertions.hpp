@@ -0,0 +1,497 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+*******************************************************************************/
+
+// This header holds collective assertions, which check a condition on
+// every rank running a test with a single MPI_Allreduce, and report a
+// failure once, from one offending rank, instead of once from every
+// rank, and performance assertions, which time a region of code on
+// every rank and check statistics of the times across ranks. It only
+// depends on MPI-1, but is kept apart from gtest-mpi-listener.hpp
+// because it is opt-in.
+
+#ifndef GTEST_MPI_ASSERTIONS_H
+#define GTEST_MPI_ASSERTIONS_H
+
+#include "gtest-mpi-listener.hpp"
+#include "gtest-mpi-scheduler.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+namespace GTestMPIListener
+{
+
+// How performance assertions time a region: it is run warmups times
+// untimed, then repetitions times, each time starting all ranks
+// together with a barrier, and each rank keeps its fastest run. Change
+// the defaults through RegionTimingOptions(), e.g. in main or in a
+// fixture's SetUp.
+struct MPITimingOptions
+{
+  MPITimingOptions() : warmups(1), repetitions(5) {}
+
+  int warmups;
+  int repetitions;
+};
+
+inline MPITimingOptions& RegionTimingOptions()
+{
+  static MPITimingOptions options;
+  return options;
+}
+
+namespace internal
+{
+
+// Outcome of a collective check on this rank. Every rank agrees on
+// whether the check passed; of the ranks where it failed, only the one
+// chosen to report the failure carries a message.
+class CollectiveResult
+{
+ public:
+  static CollectiveResult Passed() { return CollectiveResult(true, false, ""); }
+
+  // Failed elsewhere, or here but reported by another rank
+  static CollectiveResult Silent() { return CollectiveResult(false, false, ""); }
+
+  static CollectiveResult Failed(const std::string& message)
+  {
+    return CollectiveResult(false, true, message);
+  }
+
+  operator bool() const { return passed; }
+
+  bool Reports() const { return reports; }
+
+  const char *Message() const { return message.c_str(); }
+
+ private:
+  CollectiveResult(bool passed_, bool reports_, const std::string& message_)
+      : passed(passed_), reports(reports_), message(message_) {}
+
+  bool passed;
+  bool reports;
+  std::string message;
+};
+
+// Layout of MPI_2INT and MPI_DOUBLE_INT, for MPI_MINLOC and MPI_MAXLOC
+struct IntRank
+{
+  int value;
+  int rank;
+};
+
+struct DoubleRank
+{
+  double value;
+  int rank;
+};
+
+// The failing ranks of a collective check: the lowest and highest of
+// them, and how many there are, laid out as three doubles so that they
+// can be reduced as a block
+struct FailingRanks
+{
+  double first;
+  double last;
+  double count;
+};
+
+inline void CombineFailingRanks(void *in, void *inout, int *len,
+                                MPI_Datatype * /* datatype */)
+{
+  FailingRanks *a = static_cast<FailingRanks*>(in);
+  FailingRanks *b = static_cast<FailingRanks*>(inout);
+  for (int i = 0; i < *len; i++) {
+    b[i].first = std::min(a[i].first, b[i].first);
+    b[i].last = std::max(a[i].last, b[i].last);
+    b[i].count += a[i].count;
+  }
+}
+
+inline DoubleBlockOp& FailingRanksOp()
+{
+  static DoubleBlockOp failingOp(3, &CombineFailingRanks);
+  return failingOp;
+}
+
+// Fails unless local passed on every rank of TestComm(). The lowest
+// failing rank reports, with the highest one and the number of failing
+// ranks, all found in the same reduction.
+inline CollectiveResult CheckOnAllRanks(const ::testing::AssertionResult& local)
+{
+  MPI_Comm comm = TestComm();
+  int rank, size;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+  FailingRanks in = {static_cast<double>(size), -1.0, 0.0};
+  if (!local) { in.first = in.last = rank; in.count = 1.0; }
+  FailingRanks out;
+  DoubleBlockOp& failingOp = FailingRanksOp();
+  MPI_Allreduce(&in, &out, 1, failingOp.Type(), failingOp.Op(), comm);
+  if (out.count == 0.0) { return CollectiveResult::Passed(); }
+  if (rank != static_cast<int>(out.first)) {
+    return CollectiveResult::Silent();
+  }
+
+  const int last = static_cast<int>(out.last);
+  const int count = static_cast<int>(out.count);
+  ::testing::Message message;
+  if (count == 1) {
+    message << "Failed on rank " << rank << " only, of " << size << " ranks:";
+  } else if (count == last - rank + 1) {
+    message << "Failed on ranks " << rank << " (shown) through " << last
+            << ", of " << size << " ranks:";
+  } else {
+    message << "Failed on " << count << " of " << size << " ranks, from rank "
+            << rank << " (shown) to rank " << last << ":";
+  }
+  message << "\n" << local.message();
+  return CollectiveResult::Failed(message.GetString());
+}
+
+// Fails if local failed on every rank of TestComm(); rank 0 reports
+inline CollectiveResult CheckOnAnyRank(const ::testing::AssertionResult& local)
+{
+  MPI_Comm comm = TestComm();
+  int rank, size;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+  IntRank in = {local ? 1 : 0, rank};
+  IntRank out;
+  MPI_Allreduce(&in, &out, 1, MPI_2INT, MPI_MAXLOC, comm);
+  if (out.value == 1) { return CollectiveResult::Passed(); }
+  if (rank != out.rank) { return CollectiveResult::Silent(); }
+
+  ::testing::Message message;
+  message << "Failed on all " << size << " ranks; on rank " << rank << ":\n"
+          << local.message();
+  return CollectiveResult::Failed(message.GetString());
+}
+
+// Compares the largest value over the ranks of TestComm() (or, with
+// minimum, the smallest) with the tightest bound over the ranks, so
+// that all ranks agree even if their bounds differ. Both extremes come
+// from one MPI_MAXLOC reduction; the rank holding the offending value
+// reports.
+inline CollectiveResult CheckExtreme(const char *value_text,
+                                     const char *bound_text,
+                                     double value, double bound,
+                                     bool minimum, bool strict)
+{
+  MPI_Comm comm = TestComm();
+  int rank, size;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+  const double sign = minimum ? -1.0 : 1.0;
+  DoubleRank in[2] = {{sign * value, rank}, {-sign * bound, rank}};
+  DoubleRank out[2];
+  MPI_Allreduce(in, out, 2, MPI_DOUBLE_INT, MPI_MAXLOC, comm);
+  const double extreme = sign * out[0].value;
+  const double tightest = -sign * out[1].value;
+  const bool passed = minimum
+      ? (strict ? extreme > tightest : extreme >= tightest)
+      : (strict ? extreme < tightest : extreme <= tightest);
+  if (passed) { return CollectiveResult::Passed(); }
+  if (rank != out[0].rank) { return CollectiveResult::Silent(); }
+
+  ::testing::Message message;
+  message << "Expected: the " << (minimum ? "minimum" : "maximum")
+          << " over " << size << " ranks of " << value_text << " "
+          << (minimum ? (strict ? ">" : ">=") : (strict ? "<" : "<="))
+          << " " << bound_text << "\n"
+          << "  Actual: " << extreme << " on rank " << rank << "; "
+          << bound_text << " is " << tightest << " (tightest on rank "
+          << out[1].rank << ")";
+  return CollectiveResult::Failed(message.GetString());
+}
+
+// Timing of a region, with the work it did, laid out as five doubles so
+// that it can be reduced as a block
+struct RegionTiming
+{
+  TestTiming timing;
+  double work;
+};
+
+inline void CombineRegionTimings(void *in, void *inout, int *len,
+                                 MPI_Datatype *datatype)
+{
+  RegionTiming *a = static_cast<RegionTiming*>(in);
+  RegionTiming *b = static_cast<RegionTiming*>(inout);
+  for (int i = 0; i < *len; i++) {
+    int one = 1;
+    CombineTestTimings(&a[i].timing, &b[i].timing, &one, datatype);
+    b[i].work += a[i].work;
+  }
+}
+
+inline DoubleBlockOp& RegionTimingOp()
+{
+  static DoubleBlockOp regionOp(5, &CombineRegionTimings);
+  return regionOp;
+}
+
+// Runs a region as RegionTimingOptions() says, through a loop of the
+// form while (timer.Next()) { region; }, then checks the statistics of
+// the fastest runs across the ranks of TestComm(). Rank 0 reports a
+// failure, and records the statistics as properties of the test, with
+// keys like region_mpi_time_max.
+class RegionTimer
+{
+ public:
+  RegionTimer()
+      : warmups(std::max(RegionTimingOptions().warmups, 0)),
+        repetitions(std::max(RegionTimingOptions().repetitions, 1)),
+        run(0), start(0.0), best(0.0), rank_zero(false) {}
+
+  // The timer goes into an if condition in the macros below
+  operator bool() const { return true; }
+
+  bool Next()
+  {
+    if (run > warmups) {
+      const double seconds = MPI_Wtime() - start;
+      if (run == warmups + 1 || seconds < best) { best = seconds; }
+    }
+    if (run == warmups + repetitions) { return false; }
+    run++;
+    MPI_Barrier(TestComm());
+    start = MPI_Wtime();
+    return true;
+  }
+
+  // Fails if the slowest rank took longer than seconds
+  CollectiveResult CheckMaxTime(const char *region_text,
+                                const char *seconds_text, double seconds)
+  {
+    int size;
+    const RegionTiming reduced = Reduce(0.0, size);
+    if (reduced.timing.max <= seconds) { return CollectiveResult::Passed(); }
+    if (!rank_zero) { return CollectiveResult::Silent(); }
+
+    ::testing::Message message;
+    message << "Expected: " << region_text << " to take at most "
+            << seconds_text << " (" << FormatNumber(seconds)
+            << " s) on every rank\n"
+            << "  Actual: " << reduced.timing.ToString(size) << RunsText();
+    return CollectiveResult::Failed(message.GetString());
+  }
+
+  // Fails if the work done over all ranks, divided by the slowest
+  // rank's time, is less than rate per second
+  CollectiveResult CheckThroughput(const char *region_text,
+                                   const char *rate_text, double work,
+                                   double rate)
+  {
+    int size;
+    const RegionTiming reduced = Reduce(work, size);
+    const double throughput = (reduced.timing.max > 0.0)
+        ? reduced.work / reduced.timing.max : 0.0;
+    if (throughput >= rate) { return CollectiveResult::Passed(); }
+    if (!rank_zero) { return CollectiveResult::Silent(); }
+
+    ::testing::Message message;
+    message << "Expected: " << region_text << " to process at least "
+            << rate_text << " (" << FormatNumber(rate) << ") per second over "
+            << size << " ranks\n"
+            << "  Actual: " << FormatNumber(throughput) << " per second ("
+            << FormatNumber(reduced.work) << " in "
+            << FormatNumber(reduced.timing.max) << " s); "
+            << reduced.timing.ToString(size) << RunsText();
+    return CollectiveResult::Failed(message.GetString());
+  }
+
+ private:
+  int warmups;
+  int repetitions;
+  int run;
+  double start;
+  double best;
+  bool rank_zero;
+
+  RegionTiming Reduce(double work, int& size)
+  {
+    MPI_Comm comm = TestComm();
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    rank_zero = (rank == 0);
+    RegionTiming local, reduced;
+    local.timing.min = local.timing.max = local.timing.sum = best;
+    local.timing.max_rank = rank;
+    local.work = work;
+
+    DoubleBlockOp& regionOp = RegionTimingOp();
+    MPI_Allreduce(&local, &reduced, 1, regionOp.Type(), regionOp.Op(), comm);
+
+    if (rank_zero) { RecordTimingProperties("region_", reduced.timing, size); }
+    return reduced;
+  }
+
+  static std::string FormatNumber(double value)
+  {
+    char text[32];
+    snprintf(text, sizeof(text), "%.6g", value);
+    return text;
+  }
+
+  std::string RunsText() const
+  {
+    ::testing::Message text;
+    text << " (fastest of " << repetitions << " runs after " << warmups
+         << " warm-up" << (warmups == 1 ? "" : "s") << ")";
+    return text.GetString();
+  }
+};
+
+} // namespace internal
+
+} // namespace GTestMPIListener
+
+// Reports check's failure on the rank chosen for it, the last branch
+// so that messages can be streamed to it, and otherwise does nothing;
+// the other ranks take silent_failure when the check fails.
+#define GTEST_MPI_COLLECTIVE_(check, on_failure, silent_failure) \
+  GTEST_AMBIGUOUS_ELSE_BLOCKER_ \
+  if (const ::GTestMPIListener::internal::CollectiveResult \
+          gtest_mpi_result = (check)) \
+    ; \
+  else if (!gtest_mpi_result.Reports()) \
+    silent_failure; \
+  else \
+    on_failure(gtest_mpi_result.Message())
+
+#define GTEST_MPI_NONFATAL_(check) \
+  GTEST_MPI_COLLECTIVE_(check, GTEST_NONFATAL_FAILURE_, (void)0)
+#define GTEST_MPI_FATAL_(check) \
+  GTEST_MPI_COLLECTIVE_(check, GTEST_FATAL_FAILURE_, return)
+
+#define GTEST_MPI_ALL_CMP_(cmp, val1, val2) \
+  ::GTestMPIListener::internal::CheckOnAllRanks( \
+      ::testing::internal::CmpHelper##cmp(#val1, #val2, val1, val2))
+#define GTEST_MPI_BOOL_(condition, text, actual, expected) \
+  ((condition) ? ::testing::AssertionSuccess() \
+               : ::testing::AssertionFailure() \
+                     << "Value of: " << text << "\n  Actual: " << actual \
+                     << "\nExpected: " << expected)
+#define GTEST_MPI_ALL_BOOL_(condition, text, actual, expected) \
+  ::GTestMPIListener::internal::CheckOnAllRanks( \
+      GTEST_MPI_BOOL_(condition, text, actual, expected))
+#define GTEST_MPI_EXTREME_(value, bound, minimum, strict) \
+  ::GTestMPIListener::internal::CheckExtreme( \
+      #value, #bound, static_cast<double>(value), \
+      static_cast<double>(bound), minimum, strict)
+
+// Collective assertions. Every rank running the test must reach them,
+// in the same order, since each is an MPI_Allreduce over TestComm().
+//
+// MPI_EXPECT_ALL_* hold if the comparison holds on every rank.
+// MPI_EXPECT_ANY_TRUE holds if the condition holds on some rank.
+// MPI_EXPECT_MAX_LE(value, bound) holds if the largest value over the
+// ranks is at most the smallest bound, and so on. A failure is reported
+// once, by the lowest offending rank (or the rank with the offending
+// extreme), with the highest one and how many ranks failed. The ASSERT_
+// variants
+// return from the test on every rank.
+#define MPI_EXPECT_ALL_TRUE(condition) \
+  GTEST_MPI_NONFATAL_(GTEST_MPI_ALL_BOOL_(condition, #condition, \
+                                          "false", "true"))
+#define MPI_EXPECT_ALL_FALSE(condition) \
+  GTEST_MPI_NONFATAL_(GTEST_MPI_ALL_BOOL_(!(condition), #condition, \
+                                          "true", "false"))
+#define MPI_EXPECT_ANY_TRUE(condition) \
+  GTEST_MPI_NONFATAL_(::GTestMPIListener::internal::CheckOnAnyRank( \
+      GTEST_MPI_BOOL_(condition, #condition, "false", "true")))
+#define MPI_EXPECT_ALL_EQ(val1, val2) \
+  GTEST_MPI_NONFATAL_(GTEST_MPI_ALL_CMP_(EQ, val1, val2))
+#define MPI_EXPECT_ALL_NE(val1, val2) \
+  GTEST_MPI_NONFATAL_(GTEST_MPI_ALL_CMP_(NE, val1, val2))
+#define MPI_EXPECT_ALL_LE(val1, val2) \
+  GTEST_MPI_NONFATAL_(GTEST_MPI_ALL_CMP_(LE, val1, val2))
+#define MPI_EXPECT_ALL_LT(val1, val2) \
+  GTEST_MPI_NONFATAL_(GTEST_MPI_ALL_CMP_(LT, val1, val2))
+#define MPI_EXPECT_ALL_GE(val1, val2) \
+  GTEST_MPI_NONFATAL_(GTEST_MPI_ALL_CMP_(GE, val1, val2))
+#define MPI_EXPECT_ALL_GT(val1, val2) \
+  GTEST_MPI_NONFATAL_(GTEST_MPI_ALL_CMP_(GT, val1, val2))
+#define MPI_EXPECT_MAX_LE(value, bound) \
+  GTEST_MPI_NONFATAL_(GTEST_MPI_EXTREME_(value, bound, false, false))
+#define MPI_EXPECT_MAX_LT(value, bound) \
+  GTEST_MPI_NONFATAL_(GTEST_MPI_EXTREME_(value, bound, false, true))
+#define MPI_EXPECT_MIN_GE(value, bound) \
+  GTEST_MPI_NONFATAL_(GTEST_MPI_EXTREME_(value, bound, true, false))
+#define MPI_EXPECT_MIN_GT(value, bound) \
+  GTEST_MPI_NONFATAL_(GTEST_MPI_EXTREME_(value, bound, true, true))
+
+#define MPI_ASSERT_ALL_TRUE(condition) \
+  GTEST_MPI_FATAL_(GTEST_MPI_ALL_BOOL_(condition, #condition, \
+                                       "false", "true"))
+#define MPI_ASSERT_ALL_FALSE(condition) \
+  GTEST_MPI_FATAL_(GTEST_MPI_ALL_BOOL_(!(condition), #condition, \
+                                       "true", "false"))
+#define MPI_ASSERT_ANY_TRUE(condition) \
+  GTEST_MPI_FATAL_(::GTestMPIListener::internal::CheckOnAnyRank( \
+      GTEST_MPI_BOOL_(condition, #condition, "false", "true")))
+#define MPI_ASSERT_ALL_EQ(val1, val2) \
+  GTEST_MPI_FATAL_(GTEST_MPI_ALL_CMP_(EQ, val1, val2))
+#define MPI_ASSERT_ALL_NE(val1, val2) \
+  GTEST_MPI_FATAL_(GTEST_MPI_ALL_CMP_(NE, val1, val2))
+#define MPI_ASSERT_ALL_LE(val1, val2) \
+  GTEST_MPI_FATAL_(GTEST_MPI_ALL_CMP_(LE, val1, val2))
+#define MPI_ASSERT_ALL_LT(val1, val2) \
+  GTEST_MPI_FATAL_(GTEST_MPI_ALL_CMP_(LT, val1, val2))
+#define MPI_ASSERT_ALL_GE(val1, val2) \
+  GTEST_MPI_FATAL_(GTEST_MPI_ALL_CMP_(GE, val1, val2))
+#define MPI_ASSERT_ALL_GT(val1, val2) \
+  GTEST_MPI_FATAL_(GTEST_MPI_ALL_CMP_(GT, val1, val2))
+#define MPI_ASSERT_MAX_LE(value, bound) \
+  GTEST_MPI_FATAL_(GTEST_MPI_EXTREME_(value, bound, false, false))
+#define MPI_ASSERT_MAX_LT(value, bound) \
+  GTEST_MPI_FATAL_(GTEST_MPI_EXTREME_(value, bound, false, true))
+#define MPI_ASSERT_MIN_GE(value, bound) \
+  GTEST_MPI_FATAL_(GTEST_MPI_EXTREME_(value, bound, true, false))
+#define MPI_ASSERT_MIN_GT(value, bound) \
+  GTEST_MPI_FATAL_(GTEST_MPI_EXTREME_(value, bound, true, true))
+
+// Runs region as RegionTimer describes, then takes check on the timer
+#define GTEST_MPI_TIMED_(region, check, on_failure, silent_failure) \
+  GTEST_AMBIGUOUS_ELSE_BLOCKER_ \
+  if (::GTestMPIListener::internal::RegionTimer gtest_mpi_timer = \
+          ::GTestMPIListener::internal::RegionTimer()) { \
+    while (gtest_mpi_timer.Next()) { region; } \
+    goto GTEST_CONCAT_TOKEN_(gtest_mpi_label_timed_, __LINE__); \
+  } else \
+    GTEST_CONCAT_TOKEN_(gtest_mpi_label_timed_, __LINE__): \
+      GTEST_MPI_COLLECTIVE_(gtest_mpi_timer.check, on_failure, silent_failure)
+
+// Performance assertions, collective like the assertions above.
+// MPI_EXPECT_TIME_MAX_LE(region, seconds) holds if the slowest rank's
+// fastest run of region takes at most seconds.
+// MPI_EXPECT_THROUGHPUT_GE(region, work, rate) holds if the work done by
+// one run of region, summed over the ranks, divided by the slowest
+// rank's time, is at least rate per second.
+#define MPI_EXPECT_TIME_MAX_LE(region, seconds) \
+  GTEST_MPI_TIMED_(region, CheckMaxTime(#region, #seconds, \
+                       static_cast<double>(seconds)), \
+                   GTEST_NONFATAL_FAILURE_, (void)0)
+#define MPI_EXPECT_THROUGHPUT_GE(region, work, rate) \
+  GTEST_MPI_TIMED_(region, CheckThroughput(#region, #rate, \
+                       static_cast<double>(work), static_cast<double>(rate)), \
+                   GTEST_NONFATAL_FAILURE_, (void)0)
+#define MPI_ASSERT_TIME_MAX_LE(region, seconds) \
+  GTEST_MPI_TIMED_(region, CheckMaxTime(#region, #seconds, \
+                       static_cast<double>(seconds)), \
+                   GTEST_FATAL_FAILURE_, return)
+#define MPI_ASSERT_THROUGHPUT_GE(region, work, rate) \
+  GTEST_MPI_TIMED_(region, CheckThroughput(#region, #rate, \
+                       static_cast<double>(work), static_cast<double>(rate)), \
+                   GTEST_FATAL_FAILURE_, return)
+
+#endif /* GTEST_MPI_ASSERTIONS_H */
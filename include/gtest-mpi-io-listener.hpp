@@ -0,0 +1,212 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+*******************************************************************************/
+
+// This header holds listeners that require MPI-2 (namely, MPI I/O), kept
+// apart from gtest-mpi-listener.hpp so that the latter only depends on
+// MPI-1.
+
+#ifndef GTEST_MPI_IO_LISTENER_H
+#define GTEST_MPI_IO_LISTENER_H
+
+#include "gtest-mpi-listener.hpp"
+#include <cassert>
+#include <cstdio>
+#include <vector>
+#include <string>
+#include <sstream>
+
+namespace GTestMPIListener
+{
+
+// This class writes rank-ordered results in the same format as
+// MPIMinimalistPrinter, but instead of funneling every result through
+// rank 0 to standard out, each rank writes its own results into one
+// shared log file with the collective MPI_File_write_ordered. Rank 0
+// only writes the line announcing each test and the final summary, so
+// output bandwidth scales with the file system rather than with one
+// process's standard out.
+//
+// Under a schedule (see gtest-mpi-scheduler.hpp), ranks run different
+// tests, so each rank keeps its output until the end of the iteration,
+// when every rank takes part in one ordered write per scheduled test,
+// in schedule order.
+class MPIIOPrinter : public ::testing::EmptyTestEventListener
+{
+ public:
+  MPIIOPrinter(const std::string& file_name_, MPI_Comm comm_ = MPI_COMM_WORLD)
+      : ::testing::EmptyTestEventListener(), file_name(file_name_),
+        local_output(), failed_tests(), test_count(0), scheduled_output(),
+        scheduled_failed(), tear_down_count(0)
+  {
+    int is_mpi_initialized;
+    assert(MPI_Initialized(&is_mpi_initialized) == MPI_SUCCESS);
+    if (!is_mpi_initialized) {
+      printf("MPI must be initialized before RUN_ALL_TESTS!\n");
+      printf("Add '::testing::InitGoogleTest(&argc, argv);\n");
+      printf("     MPI_Init(&argc, &argv);' to your 'main' function!\n");
+      assert(0);
+    }
+
+    internal::DupListenerComm(comm_, &comm);
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    int flag = MPI_File_open(comm, const_cast<char*>(file_name.c_str()),
+                             MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                             MPI_INFO_NULL, &file);
+    if (flag != MPI_SUCCESS) {
+      if (rank == 0) {
+        printf("Could not open '%s' for test output!\n", file_name.c_str());
+      }
+      assert(0);
+    }
+    // Discard output from any previous run
+    MPI_File_set_size(file, 0);
+  }
+
+  // Called after an assertion failure or an explicit SUCCESS() macro.
+  // As in the other printers, there must be no communication here.
+  virtual void OnTestPartResult
+    (const ::testing::TestPartResult& test_part_result) {
+    local_output << "      "
+                 << (test_part_result.failed() ? "*** Failure" : "Success")
+                 << " on rank " << rank << ", "
+                 << (test_part_result.file_name() ?
+                     test_part_result.file_name() : "unknown file")
+                 << ":" << test_part_result.line_number() << "\n"
+                 << test_part_result.summary() << "\n";
+  }
+
+  // Called after a test ends. Every rank contributes its results, in
+  // rank order, to a single collective write; rank 0 leads with the
+  // test's name and the last rank closes the block. Under a schedule,
+  // the results are kept for the end of the iteration instead.
+  virtual void OnTestEnd(const ::testing::TestInfo& test_info) {
+    const std::string name(internal::FullTestName(test_info));
+    const internal::TestSchedule& schedule = internal::CurrentSchedule();
+    if (schedule.IsActive()) {
+      if (scheduled_output.empty()) {
+        scheduled_output.resize(schedule.test_names.size());
+        scheduled_failed.resize(schedule.test_names.size(), 0);
+      }
+      const int index = schedule.IndexOf(name);
+      scheduled_output[index] = local_output.str();
+      scheduled_failed[index] = test_info.result()->Failed() ? 1 : 0;
+      local_output.str("");
+      return;
+    }
+
+    WriteTest(name, local_output.str());
+    local_output.str("");
+
+    // Rank 0 only needs to know whether the test failed anywhere
+    int localFailed = test_info.result()->Failed() ? 1 : 0;
+    int anyRankFailed = 0;
+    MPI_Reduce(&localFailed, &anyRankFailed, 1, MPI_INT, MPI_MAX, 0, comm);
+    test_count++;
+    if (rank == 0 && anyRankFailed) { failed_tests.push_back(name); }
+  }
+
+  // Called before the Environment is torn down, which is the last point
+  // at which MPI is guaranteed to still be usable, because
+  // MPIEnvironment finalizes MPI during tear down.
+  virtual void OnEnvironmentsTearDownStart
+    (const ::testing::UnitTest& /* unit_test */) {
+    int is_mpi_finalized;
+    assert(MPI_Finalized(&is_mpi_finalized) == MPI_SUCCESS);
+    if (is_mpi_finalized) { return; }
+    WriteSchedule();
+    if (!internal::TearingDownLastTime(tear_down_count)) { return; }
+
+    if (rank == 0) {
+      std::stringstream summary;
+      summary << "*** " << test_count << " tests ran on " << size
+              << " ranks; " << failed_tests.size() << " failed.\n";
+      for (size_t i = 0; i < failed_tests.size(); i++) {
+        summary << "***   " << failed_tests[i] << "\n";
+      }
+      std::string text(summary.str());
+      MPI_File_write_shared(file, &text[0], static_cast<int>(text.size()),
+                            MPI_CHAR, MPI_STATUS_IGNORE);
+      printf("%sFull results written to %s\n",
+             text.c_str(), file_name.c_str());
+    }
+    MPI_File_close(&file);
+    internal::FreeListenerComm(&comm);
+  }
+
+ private:
+  std::string file_name;
+  MPI_File file;
+  MPI_Comm comm;
+  int rank;
+  int size;
+  std::stringstream local_output;
+  std::vector<std::string> failed_tests;
+  int test_count;
+
+  // Under a schedule, this rank's output from, and whether it failed,
+  // each scheduled test of the current iteration, by position in the
+  // schedule; empty for the tests it did not run
+  std::vector<std::string> scheduled_output;
+  std::vector<int> scheduled_failed;
+
+  // Number of times environments were torn down before
+  int tear_down_count;
+
+  // Disallow copying; the file handle cannot be shared
+  MPIIOPrinter(const MPIIOPrinter& printer);
+
+  // Writes the block of the test named name, with output as this rank's
+  // part. Collective over comm.
+  void WriteTest(const std::string& name, const std::string& output)
+  {
+    std::string text;
+    if (rank == 0) { text += "*** Test " + name + " starting.\n"; }
+    text += output;
+    if (rank == size - 1) { text += "*** Test " + name + " ending.\n"; }
+    MPI_File_write_ordered(file, text.empty() ? NULL : &text[0],
+                           static_cast<int>(text.size()), MPI_CHAR,
+                           MPI_STATUS_IGNORE);
+  }
+
+  // Under a schedule, writes the blocks of every scheduled test of the
+  // iteration and reduces whether each failed. Collective over comm,
+  // whichever tests this rank ran.
+  void WriteSchedule()
+  {
+    const internal::TestSchedule& schedule = internal::CurrentSchedule();
+    if (!schedule.IsActive()) { return; }
+    const size_t testCount = schedule.test_names.size();
+    scheduled_output.resize(testCount);
+    scheduled_failed.resize(testCount, 0);
+    for (size_t t = 0; t < testCount; t++) {
+      WriteTest(schedule.test_names[t], scheduled_output[t]);
+    }
+
+    std::vector<int> anyRankFailed(testCount, 0);
+    MPI_Reduce(&scheduled_failed[0], &anyRankFailed[0],
+               static_cast<int>(testCount), MPI_INT, MPI_MAX, 0, comm);
+    test_count += static_cast<int>(testCount);
+    if (rank == 0) {
+      for (size_t t = 0; t < testCount; t++) {
+        if (anyRankFailed[t]) {
+          failed_tests.push_back(schedule.test_names[t]);
+        }
+      }
+    }
+    scheduled_output.clear();
+    scheduled_failed.clear();
+  }
+
+}; // class MPIIOPrinter
+
+} // namespace GTestMPIListener
+
+#endif /* GTEST_MPI_IO_LISTENER_H */
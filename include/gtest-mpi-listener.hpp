@@ -48,475 +48,2941 @@
 
 #include "mpi.h"
 #include "gtest/gtest.h"
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <set>
 #include <vector>
 #include <string>
 #include <sstream>
+#include <utility>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
 
 namespace GTestMPIListener
 {
 
-// This class sets up the global test environment, which is needed
-// to finalize MPI.
-class MPIEnvironment : public ::testing::Environment {
+// How the printers move per-test results to rank 0.
+enum AggregationMode
+{
+  // Rank 0 collects all results with one MPI_Gatherv; cheapest at
+  // small scale, but rank 0 handles one buffer per rank per test
+  kFlatAggregation,
+  // Results are merged up a tree rooted at rank 0, so that per-test
+  // reporting latency grows with log P instead of P
+  kTreeAggregation,
+  // Each rank with results hands them to rank 0 with a nonblocking send
+  // and moves on to the next test without waiting; rank 0 receives and
+  // reports them at the next reporting point. Since results are then
+  // reported after their test has ended, they are attributed as in
+  // batched reporting (see MPIListenerOptions::reporting)
+  kPipelinedAggregation,
+  // Rank 0 asks each rank with results for them in turn, in chunks of
+  // at most MPIListenerOptions::stream_chunk_bytes, and stops taking
+  // results once it holds stream_budget_bytes of them, summarizing the
+  // rest per test. Ranks only send when asked, so rank 0's memory and
+  // its queue of unexpected messages stay bounded however many ranks
+  // fail, at the cost of one round trip per rank with results
+  kStreamingAggregation
+};
+
+// How often the printers move results to rank 0 and report them.
+enum ReportingGranularity
+{
+  // Collect and report the results of each test as soon as it ends
+  kReportPerTest,
+  // Buffer results on each rank, then collect and report them, in the
+  // order the tests ran, when a test suite (test case) ends
+  kReportPerTestSuite,
+  // Buffer results on each rank, then collect and report them, in the
+  // order the tests ran, when the test iteration ends
+  kReportPerIteration
+};
+
+// Moves every rank's packed result buffer to rank 0 in place of the
+// built-in aggregation modes, so that headers needing MPI features
+// newer than MPI-1 (e.g., gtest-mpi-shared-memory.hpp) can supply
+// their own. Gather is collective over comm, which is the printer's
+// private communicator; on rank 0, gathered must end up holding every
+// rank's results in rank order, and with duplicates merged if
+// deduplicate is set. Free releases any MPI resources while MPI is
+// still usable.
+class ResultGatherer
+{
  public:
- MPIEnvironment() : ::testing::Environment() {}
+  virtual ~ResultGatherer() {}
 
-  virtual ~MPIEnvironment() {}
+  virtual void Gather(MPI_Comm comm, int rank, int size, bool deduplicate,
+                      const std::vector<char>& local,
+                      std::vector<char>& gathered) = 0;
 
-  virtual void SetUp() {
-    int is_mpi_initialized;
-    ASSERT_EQ(MPI_Initialized(&is_mpi_initialized), MPI_SUCCESS);
-    if (!is_mpi_initialized) {
-      printf("MPI must be initialized before RUN_ALL_TESTS!\n");
-      printf("Add '::testing::InitGoogleTest(&argc, argv);\n");
-      printf("     MPI_Init(&argc, &argv);' to your 'main' function!\n");
-      FAIL();
-    }
+  virtual void Free() {}
+};
+
+namespace internal
+{
+struct RankResult;
+} // namespace internal
+
+// Receives each test's results on rank 0, merged across ranks, as the
+// printers report them, so that a report (e.g., the streaming XML and
+// JSON writer in gtest-mpi-report-writer.hpp) can be written without
+// going through Google Test's own result bookkeeping. WriteTest is
+// called in test order with the test's failures, each tagged with the
+// ranks it occurred on, in rank order; seconds is the test's time on
+// the slowest rank when timing is reported, and on rank 0 otherwise.
+// Close is called once all results have been written.
+class ResultWriter
+{
+ public:
+  virtual ~ResultWriter() {}
+
+  virtual void WriteTest(const std::string& test_name, double seconds,
+                         bool skipped,
+                         const std::vector<internal::RankResult>& failures,
+                         int size) = 0;
+
+  virtual void Close() {}
+};
+
+// Tuning knobs shared by the printers; the defaults reproduce the
+// behavior of earlier versions of this header.
+struct MPIListenerOptions
+{
+  MPIListenerOptions() : aggregation(kFlatAggregation), tree_fan_in(1),
+                         deduplicate_failures(false),
+                         reporting(kReportPerTest), report_timing(false),
+                         imbalance_threshold(2.0),
+                         imbalance_min_seconds(1e-3), report_memory(false),
+                         memory_budget_kb(0), gatherer(NULL),
+                         result_writer(NULL), result_writer_only(false),
+                         max_results_per_rank(0),
+                         stream_budget_bytes(1024 * 1024),
+                         stream_chunk_bytes(64 * 1024), fail_fast(false),
+                         report_flaky_tests(false) {}
+
+  AggregationMode aggregation;
+
+  // Number of children a rank receives from in each round of tree
+  // aggregation; a fan-in of 1 yields a binomial tree. Larger values
+  // make the tree shallower at the cost of more work per round.
+  int tree_fan_in;
+
+  // Report each distinct failure once, tagged with the set of ranks on
+  // which it occurred, instead of once per rank. Under tree aggregation,
+  // duplicates are merged at every level of the tree, which also cuts
+  // the volume of result traffic.
+  bool deduplicate_failures;
+
+  // Batching the results of many tests into one collection saves one
+  // collective per test, which dominates the run time of suites of
+  // many small tests. MPIWrapperPrinter can only report a batched
+  // failure from another rank after its test has ended, so Google Test
+  // records such failures against the enclosing test suite (or, when
+  // reporting per iteration, the whole program) rather than the test;
+  // the message names the test that failed, and rank 0 lists such tests
+  // after Google Test's summary.
+  ReportingGranularity reporting;
+
+  // Time each test on every rank with MPI_Wtime and report the minimum,
+  // mean, and maximum across ranks, along with the slowest rank, both
+  // in the printed output and as XML/JSON properties. This costs one
+  // reduction per reporting point.
+  bool report_timing;
+
+  // With report_timing set, flag tests whose slowest rank took at least
+  // imbalance_threshold times the mean time across ranks and at least
+  // imbalance_min_seconds, so that noise in very short tests is not
+  // flagged; a threshold of 0 disables the check.
+  double imbalance_threshold;
+  double imbalance_min_seconds;
+
+  // Sample each rank's resident memory around every test and report the
+  // largest growth in peak memory on any one rank, and the largest total
+  // growth over the ranks sharing any one node, which is what runs a
+  // node out of memory. This costs two reductions per reporting point,
+  // plus one MPI_Allgather of processor names when the printer is
+  // created. Peak memory is read from /proc/self/status where available
+  // (and reset before each test through /proc/self/clear_refs), and from
+  // getrusage otherwise, in which case a test only registers growth if it
+  // sets a new peak for the process.
+  bool report_memory;
+
+  // Fail a test on each rank whose peak memory grew by more than
+  // memory_budget_kb kilobytes during the test; 0 disables the budget.
+  long memory_budget_kb;
+
+  // If set, collects results in place of kFlatAggregation,
+  // kTreeAggregation and kStreamingAggregation alike, so that
+  // stream_budget_bytes no longer bounds rank 0's memory; pipelined
+  // aggregation does not use it. The printer does not own the gatherer,
+  // which must outlive the printer and serve no other printer.
+  ResultGatherer *gatherer;
+
+  // If set, rank 0 also hands every test's merged results to
+  // result_writer as it reports them; the printer does not own it.
+  ResultWriter *result_writer;
+
+  // With result_writer set, MPIWrapperPrinter leaves the failures of
+  // other ranks to the writer, instead of also adding them to Google
+  // Test's results on rank 0, whose printer and reports then only show
+  // rank 0's own failures.
+  bool result_writer_only;
+
+  // Keep at most this many results per test on each rank, replacing the
+  // rest with one result saying how many were left out; 0 keeps all.
+  // This bounds what a rank sends, whatever the aggregation mode.
+  int max_results_per_rank;
+
+  // Under kStreamingAggregation, the most bytes of packed results rank
+  // 0 holds for one reporting point, and the most it takes from a rank
+  // in one message (a larger single result is taken whole, as long as
+  // it fits in what remains of the budget).
+  long stream_budget_bytes;
+  long stream_chunk_bytes;
+
+  // Once any rank fails a test, skip every remaining test on all ranks.
+  // Ranks agree after each test with one MPI_Allreduce of an int, on top
+  // of what reporting costs. Skipped tests still run their fixture's
+  // SetUp and TearDown, but not their body. Needs Google Test 1.10 or
+  // later, and has no effect under a schedule (see
+  // gtest-mpi-scheduler.hpp), where ranks run different tests.
+  bool fail_fast;
+
+  // Over the iterations of --gtest_repeat, track which tests failed in
+  // some iterations and passed in others, and list them on rank 0, with
+  // the ranks that failed them, when the last iteration ends. This costs
+  // one MPI_Allreduce of two bits per test at the end of each iteration.
+  bool report_flaky_tests;
+
+  // Whether the printers need to sample memory around each test
+  bool SamplesMemory() const
+  {
+    return report_memory || memory_budget_kb > 0;
   }
 
-  virtual void TearDown() {
-    int is_mpi_finalized;
-    ASSERT_EQ(MPI_Finalized(&is_mpi_finalized), MPI_SUCCESS);
-    if (!is_mpi_finalized) {
-      int rank;
-      ASSERT_EQ(MPI_Comm_rank(MPI_COMM_WORLD, &rank), MPI_SUCCESS);
-      if (rank == 0) { printf("Finalizing MPI...\n"); }
-      ASSERT_EQ(MPI_Finalize(), MPI_SUCCESS);
-    }
-    ASSERT_EQ(MPI_Finalized(&is_mpi_finalized), MPI_SUCCESS);
-    ASSERT_TRUE(is_mpi_finalized);
+  // Whether rank 0 reports results only after their tests have ended
+  bool DefersReporting() const
+  {
+    return reporting != kReportPerTest
+        || aggregation == kPipelinedAggregation;
   }
+};
 
- private:
-  // Disallow copying
-  MPIEnvironment(const MPIEnvironment& env) {}
+namespace internal
+{
 
-}; // class MPIEnvironment
+// Tag for result traffic; results move on the printer's private
+// duplicate communicator, so no user message can match it.
+const int kResultTag = 0;
+
+// Tag for rank 0's requests for results under kStreamingAggregation
+const int kRequestTag = 1;
+
+// Tag for the results of a dealt serial test (see CurrentDealtTest),
+// sent straight to rank 0 by the rank that ran it
+const int kDealtResultTag = 2;
+
+// The communicators that listeners use for their own traffic, so that
+// tools such as the MPI traffic profiler can tell that traffic apart
+// from the traffic of the tests themselves.
+inline std::vector<MPI_Comm>& ListenerComms()
+{
+  static std::vector<MPI_Comm> comms;
+  return comms;
+}
+
+inline bool IsListenerComm(MPI_Comm comm)
+{
+  const std::vector<MPI_Comm>& comms = ListenerComms();
+  return std::find(comms.begin(), comms.end(), comm) != comms.end();
+}
+
+// Duplicates comm for a listener's own use.
+inline int DupListenerComm(MPI_Comm comm, MPI_Comm *listener_comm)
+{
+  const int flag = MPI_Comm_dup(comm, listener_comm);
+  if (flag == MPI_SUCCESS) { ListenerComms().push_back(*listener_comm); }
+  return flag;
+}
+
+// Frees a communicator from DupListenerComm, or from splitting one.
+inline void FreeListenerComm(MPI_Comm *listener_comm)
+{
+  if (*listener_comm == MPI_COMM_NULL) { return; }
+  std::vector<MPI_Comm>& comms = ListenerComms();
+  comms.erase(std::remove(comms.begin(), comms.end(), *listener_comm),
+              comms.end());
+  MPI_Comm_free(listener_comm);
+}
 
-// This class more or less takes the code in Google Test's
-// MinimalistPrinter example and wraps certain parts of it in MPI calls,
-// gathering all results onto rank zero.
-class MPIMinimalistPrinter : public ::testing::EmptyTestEventListener
+// A set of ranks, stored as sorted, disjoint, inclusive ranges so that
+// a failure shared by thousands of ranks stays small on the wire and in
+// the output.
+class RankSet
 {
  public:
- MPIMinimalistPrinter() : ::testing::EmptyTestEventListener(),
-    result_vector()
- {
-    int is_mpi_initialized;
-    assert(MPI_Initialized(&is_mpi_initialized) == MPI_SUCCESS);
-    if (!is_mpi_initialized) {
-      printf("MPI must be initialized before RUN_ALL_TESTS!\n");
-      printf("Add '::testing::InitGoogleTest(&argc, argv);\n");
-      printf("     MPI_Init(&argc, &argv);' to your 'main' function!\n");
-      assert(0);
-    }
-    MPI_Comm_dup(MPI_COMM_WORLD, &comm);
-    UpdateCommState();
- }
-
- MPIMinimalistPrinter(MPI_Comm comm_) : ::testing::EmptyTestEventListener(),
-    result_vector()
- {
-   int is_mpi_initialized;
-   assert(MPI_Initialized(&is_mpi_initialized) == MPI_SUCCESS);
-   if (!is_mpi_initialized) {
-     printf("MPI must be initialized before RUN_ALL_TESTS!\n");
-     printf("Add '::testing::InitGoogleTest(&argc, argv);\n");
-     printf("     MPI_Init(&argc, &argv);' to your 'main' function!\n");
-     assert(0);
-   }
-
-   MPI_Comm_dup(comm_, &comm);
-   UpdateCommState();
- }
-
-  MPIMinimalistPrinter
-    (const MPIMinimalistPrinter& printer) {
+  RankSet() : ranges() {}
 
-    int is_mpi_initialized;
-    assert(MPI_Initialized(&is_mpi_initialized) == MPI_SUCCESS);
-    if (!is_mpi_initialized) {
-      printf("MPI must be initialized before RUN_ALL_TESTS!\n");
-      printf("Add '::testing::InitGoogleTest(&argc, argv);\n");
-      printf("     MPI_Init(&argc, &argv);' to your 'main' function!\n");
-      assert(0);
-    }
+  explicit RankSet(int rank) : ranges(1, std::make_pair(rank, rank)) {}
 
-    MPI_Comm_dup(printer.comm, &comm);
-    UpdateCommState();
-    result_vector = printer.result_vector;
+  void AddRange(int first, int last)
+  {
+    ranges.push_back(std::make_pair(first, last));
   }
 
-  // Called before the Environment is torn down.
-  void OnEnvironmentTearDownStart()
+  // Adds every rank in other to this set.
+  void Merge(const RankSet& other)
   {
-    int is_mpi_finalized;
-    assert(MPI_Finalized(&is_mpi_finalized) == MPI_SUCCESS);
-    if (!is_mpi_finalized) {
-      MPI_Comm_free(&comm);
+    ranges.insert(ranges.end(), other.ranges.begin(), other.ranges.end());
+    std::sort(ranges.begin(), ranges.end());
+    size_t merged = 0;
+    for (size_t i = 1; i < ranges.size(); i++) {
+      if (ranges[i].first <= ranges[merged].second + 1) {
+        ranges[merged].second = std::max(ranges[merged].second,
+                                         ranges[i].second);
+      } else {
+        ranges[++merged] = ranges[i];
+      }
     }
+    ranges.resize(merged + 1);
   }
 
-  // Called before a test starts.
-  virtual void OnTestStart(const ::testing::TestInfo& test_info) {
-    // Only need to report test start info on rank 0
-    if (rank == 0) {
-      printf("*** Test %s.%s starting.\n",
-             test_info.test_case_name(), test_info.name());
+  bool HasSingleRank() const
+  {
+    return ranges.size() == 1 && ranges[0].first == ranges[0].second;
+  }
+
+  // Formats the set as, e.g., "0-1023,2047"
+  std::string ToString() const
+  {
+    std::stringstream out;
+    for (size_t i = 0; i < ranges.size(); i++) {
+      if (i > 0) { out << ","; }
+      out << ranges[i].first;
+      if (ranges[i].second != ranges[i].first) {
+        out << "-" << ranges[i].second;
+      }
     }
+    return out.str();
   }
 
-  // Called after an assertion failure or an explicit SUCCESS() macro.
-  // In an MPI program, this means that certain ranks may not call this
-  // function if a test part does not fail on all ranks. Consequently, it
-  // is difficult to have explicit synchronization points here.
-  virtual void OnTestPartResult
-    (const ::testing::TestPartResult& test_part_result) {
-    result_vector.push_back(test_part_result);
+  std::vector< std::pair<int, int> > ranges;
+};
+
+// A test part result received from some set of ranks. The test index
+// identifies which test, of those in a reporting batch, it belongs to.
+struct RankResult
+{
+  RankResult(const RankSet& ranks_, int test_index_,
+             const ::testing::TestPartResult& result_) :
+      ranks(ranks_), test_index(test_index_), result(result_) {}
+
+  // Formats the ranks as "[Rank r/size]" or "[Ranks r0-r1,r2/size]"
+  std::string RankPrefix(int size) const
+  {
+    std::stringstream out;
+    out << (ranks.HasSingleRank() ? "[Rank " : "[Ranks ")
+        << ranks.ToString() << "/" << size << "]";
+    return out.str();
   }
 
-  // Called after a test ends.
-  virtual void OnTestEnd(const ::testing::TestInfo& test_info) {
-    int localResultCount = result_vector.size();
-    std::vector<int> resultCountOnRank(size, 0);
-    MPI_Gather(&localResultCount, 1, MPI_INT,
-               &resultCountOnRank[0], 1, MPI_INT,
-               0, comm);
-
-    if (rank != 0) {
-      // Nonzero ranks send constituent parts of each result to rank 0
-      for (int i = 0; i < localResultCount; i++) {
-        const ::testing::TestPartResult test_part_result = result_vector.at(i);
-        int resultStatus(test_part_result.failed());
-        std::string resultFileName(test_part_result.file_name());
-        int resultLineNumber(test_part_result.line_number());
-        std::string resultSummary(test_part_result.summary());
-
-        // Must add one for null termination
-        int resultFileNameSize(resultFileName.size()+1);
-        int resultSummarySize(resultSummary.size()+1);
-
-        MPI_Send(&resultStatus, 1, MPI_INT, 0, rank, comm);
-        MPI_Send(&resultFileNameSize, 1, MPI_INT, 0, rank, comm);
-        MPI_Send(&resultLineNumber, 1, MPI_INT, 0, rank, comm);
-        MPI_Send(&resultSummarySize, 1, MPI_INT, 0, rank, comm);
-        MPI_Send(resultFileName.c_str(), resultFileNameSize, MPI_CHAR,
-                 0, rank, comm);
-        MPI_Send(resultSummary.c_str(), resultSummarySize, MPI_CHAR,
-                 0, rank, comm);
-      }
-    } else {
-      // Rank 0 first prints its local result data
-      for (int i = 0; i < localResultCount; i++) {
-        const ::testing::TestPartResult test_part_result = result_vector.at(i);
-        printf("      %s on rank %d, %s:%d\n%s\n",
-             test_part_result.failed() ? "*** Failure" : "Success",
-             rank,
-             test_part_result.file_name(),
-             test_part_result.line_number(),
-             test_part_result.summary());
-      }
+  // Orders results by test, for stable sorting
+  bool operator<(const RankResult& other) const
+  {
+    return test_index < other.test_index;
+  }
 
-      for (int r = 1; r < size; r++) {
-        for (int i = 0; i < resultCountOnRank[r]; i++) {
-          int resultStatus, resultFileNameSize, resultLineNumber;
-          int resultSummarySize;
-          MPI_Recv(&resultStatus, 1, MPI_INT, r, r, comm, MPI_STATUS_IGNORE);
-          MPI_Recv(&resultFileNameSize, 1, MPI_INT, r, r, comm,
-                   MPI_STATUS_IGNORE);
-          MPI_Recv(&resultLineNumber, 1, MPI_INT, r, r, comm,
-                   MPI_STATUS_IGNORE);
-          MPI_Recv(&resultSummarySize, 1, MPI_INT, r, r, comm,
-                   MPI_STATUS_IGNORE);
-
-          std::string resultFileName;
-          std::string resultSummary;
-          resultFileName.resize(resultFileNameSize);
-          resultSummary.resize(resultSummarySize);
-          MPI_Recv(&resultFileName[0], resultFileNameSize,
-                   MPI_CHAR, r, r, comm, MPI_STATUS_IGNORE);
-          MPI_Recv(&resultSummary[0], resultSummarySize,
-                   MPI_CHAR, r, r, comm, MPI_STATUS_IGNORE);
-
-          printf("      %s on rank %d, %s:%d\n%s\n",
-                 resultStatus ? "*** Failure" : "Success",
-                 r,
-                 resultFileName.c_str(),
-                 resultLineNumber,
-                 resultSummary.c_str());
-        }
-      }
+  RankSet ranks;
+  int test_index;
+  ::testing::TestPartResult result;
+};
 
-      printf("*** Test %s.%s ending.\n",
-             test_info.test_case_name(), test_info.name());
-    }
+// Wall-clock statistics for one test across all ranks, in seconds. The
+// slowest rank is stored as a double so that the whole struct can be
+// reduced as a block of four doubles.
+struct TestTiming
+{
+  double min;
+  double max;
+  double sum;
+  double max_rank;
 
-    result_vector.clear();
-}
+  double Mean(int size) const { return sum / size; }
 
- private:
-  MPI_Comm comm;
-  int rank;
-  int size;
-  std::vector< ::testing::TestPartResult > result_vector;
+  // Ratio of the slowest rank's time to the mean time
+  double Imbalance(int size) const
+  {
+    return (Mean(size) > 0.0) ? max / Mean(size) : 1.0;
+  }
 
-  int UpdateCommState()
+  // Formats the statistics as, e.g., "min 1.000 ms, mean 1.500 ms,
+  // max 2.000 ms on rank 3"
+  std::string ToString(int size) const
   {
-    int flag = MPI_Comm_rank(comm, &rank);
-    if (flag != MPI_SUCCESS) { return flag; }
-    flag = MPI_Comm_size(comm, &size);
-    return flag;
+    char text[128];
+    snprintf(text, sizeof(text),
+             "min %.3f ms, mean %.3f ms, max %.3f ms on rank %d",
+             1000.0 * min, 1000.0 * Mean(size), 1000.0 * max,
+             static_cast<int>(max_rank));
+    return text;
   }
+};
 
-}; // class MPIMinimalistPrinter
+// A value paired with the rank it came from, laid out as MPI_DOUBLE_INT
+// so that MPI_MAXLOC can find both the largest value and its rank.
+struct RankValue
+{
+  double value;
+  int rank;
+};
 
-// This class more or less takes the code in Google Test's
-// MinimalistPrinter example and wraps certain parts of it in MPI calls,
-// gathering all results onto rank zero.
-class MPIWrapperPrinter : public ::testing::TestEventListener
+// Growth in peak resident memory during one test, in kilobytes: the
+// largest on any one rank, and the largest total over the ranks on any
+// one node, where a node is named by the lowest rank on it.
+struct TestMemory
 {
- public:
-MPIWrapperPrinter(::testing::TestEventListener *l, MPI_Comm comm_) :
-    ::testing::TestEventListener(), listener(l), result_vector()
- {
-   int is_mpi_initialized;
-   assert(MPI_Initialized(&is_mpi_initialized) == MPI_SUCCESS);
-   if (!is_mpi_initialized) {
-     printf("MPI must be initialized before RUN_ALL_TESTS!\n");
-     printf("Add '::testing::InitGoogleTest(&argc, argv);\n");
-     printf("     MPI_Init(&argc, &argv);' to your 'main' function!\n");
-     assert(0);
-   }
-
-   MPI_Comm_dup(comm_, &comm);
-   UpdateCommState();
- }
-
-MPIWrapperPrinter
-(const MPIWrapperPrinter& printer) :
-    listener(printer.listener), result_vector(printer.result_vector) {
+  RankValue rank_max;
+  RankValue node_max;
 
-    int is_mpi_initialized;
-    assert(MPI_Initialized(&is_mpi_initialized) == MPI_SUCCESS);
-    if (!is_mpi_initialized) {
-      printf("MPI must be initialized before RUN_ALL_TESTS!\n");
-      printf("Add '::testing::InitGoogleTest(&argc, argv);\n");
-      printf("     MPI_Init(&argc, &argv);' to your 'main' function!\n");
-      assert(0);
-    }
+  // Formats the statistics as, e.g., "max 1024 kB on rank 3, max
+  // 4096 kB on node of rank 0"
+  std::string ToString() const
+  {
+    char text[128];
+    snprintf(text, sizeof(text),
+             "max %.0f kB on rank %d, max %.0f kB on node of rank %d",
+             rank_max.value, rank_max.rank, node_max.value, node_max.rank);
+    return text;
+  }
+};
 
-    MPI_Comm_dup(printer.comm, &comm);
-    UpdateCommState();
+// Resident memory of this process, in kilobytes
+struct MemorySample
+{
+  long rss_kb;
+  long peak_kb;
+};
+
+// Samples current and peak resident memory from /proc/self/status,
+// falling back on getrusage for the peak, and on the peak for current
+// memory, where that file does not exist. Values are -1 when unknown.
+inline MemorySample SampleMemory()
+{
+  MemorySample sample;
+  sample.rss_kb = -1;
+  sample.peak_kb = -1;
+  FILE *status = fopen("/proc/self/status", "r");
+  if (status) {
+    char line[256];
+    while (fgets(line, sizeof(line), status)) {
+      sscanf(line, "VmRSS: %ld", &sample.rss_kb);
+      sscanf(line, "VmHWM: %ld", &sample.peak_kb);
+    }
+    fclose(status);
+  }
+#if defined(__unix__) || defined(__APPLE__)
+  if (sample.peak_kb < 0) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(__APPLE__)
+      sample.peak_kb = usage.ru_maxrss / 1024;
+#else
+      sample.peak_kb = usage.ru_maxrss;
+#endif
+    }
+  }
+#endif
+  if (sample.rss_kb < 0) { sample.rss_kb = sample.peak_kb; }
+  return sample;
 }
 
-// Called before test activity starts
-virtual void OnTestProgramStart(const ::testing::UnitTest &unit_test)
+// Resets this process's peak resident memory to its current resident
+// memory, which Linux supports since 4.0. Returns whether it succeeded.
+inline bool ResetPeakMemory()
 {
-    if (rank == 0) { listener->OnTestProgramStart(unit_test); }
+  FILE *clear_refs = fopen("/proc/self/clear_refs", "w");
+  if (!clear_refs) { return false; }
+  const bool reset = fputs("5", clear_refs) >= 0;
+  return (fclose(clear_refs) == 0) && reset;
 }
 
+// Measures how much a test grows this process's peak resident memory.
+class MemoryTracker
+{
+ public:
+  MemoryTracker() : peak_reset(false)
+  {
+    start.rss_kb = -1;
+    start.peak_kb = -1;
+  }
+
+  void Start()
+  {
+    peak_reset = ResetPeakMemory();
+    start = SampleMemory();
+  }
+
+  // Returns the growth, in kilobytes, of peak resident memory since
+  // Start was called, or 0 if memory cannot be sampled.
+  long Stop() const
+  {
+    const MemorySample end = SampleMemory();
+    if (start.rss_kb < 0 || end.peak_kb < 0) { return 0; }
+    // Without a reset, the peak only tells about this test if the test
+    // set a new peak for the process
+    const long peak = (peak_reset || end.peak_kb > start.peak_kb)
+                      ? end.peak_kb : end.rss_kb;
+    return std::max(0L, peak - start.rss_kb);
+  }
+
+ private:
+  MemorySample start;
+  bool peak_reset;
+};
+
+// Results packed on one rank for the tests in the current reporting
+// batch, along with (on rank 0) the names of those tests, in the order
+// in which they ran. When timing tests or sampling memory, each rank
+// records how long each test took and how much it grew peak memory,
+// which the reductions replace with per-test statistics on rank 0.
+// With a result writer, rank 0 also records which tests the printer
+// skipped itself under fail_fast.
+struct ResultBatch
+{
+  ResultBatch() : buffer(), test_names(), test_count(0), test_times(),
+                  test_skipped(), timings(), test_memory(), memory() {}
 
-// Called before each test iteration starts, where iteration is
-// the iterate index. There could be more than one iteration if
-// GTEST_FLAG(repeat) is used.
- virtual void OnTestIterationStart(const ::testing::UnitTest &unit_test,
-                                   int iteration)
- {
-     if (rank == 0) { listener->OnTestIterationStart(unit_test, iteration); }
- }
+  void Clear()
+  {
+    buffer.clear();
+    test_names.clear();
+    test_count = 0;
+    test_times.clear();
+    test_skipped.clear();
+    timings.clear();
+    test_memory.clear();
+    memory.clear();
+  }
+
+  void Swap(ResultBatch& other)
+  {
+    buffer.swap(other.buffer);
+    test_names.swap(other.test_names);
+    std::swap(test_count, other.test_count);
+    test_times.swap(other.test_times);
+    test_skipped.swap(other.test_skipped);
+    timings.swap(other.timings);
+    test_memory.swap(other.test_memory);
+    memory.swap(other.memory);
+  }
 
+  std::vector<char> buffer;
+  std::vector<std::string> test_names;
+  int test_count;
+  std::vector<double> test_times;
+  std::vector<int> test_skipped;
+  std::vector<TestTiming> timings;
+  std::vector<double> test_memory;
+  std::vector<TestMemory> memory;
+};
 
+// Results are shipped to rank 0 in a simple wire format: each rank
+// packs all of its results for a test into one contiguous buffer, so
+// that a test costs one MPI_Gather of buffer sizes and one MPI_Gatherv
+// of buffers, instead of several messages per result per rank. Each
+// record in a buffer is a header of six ints (test index, result type,
+// line number, file name size, message size, rank range count), followed by
+// two ints (first, last) per rank range, then the file name and message
+// characters, neither of which is null-terminated. Buffers are sent as
+// MPI_BYTE, so all ranks must share the same int representation, as is
+// the case on homogeneous clusters.
+const int kRecordHeaderInts = 6;
+
+inline void PackInt(std::vector<char>& buffer, int value)
+{
+  const size_t offset = buffer.size();
+  buffer.resize(offset + sizeof(int));
+  std::memcpy(&buffer[offset], &value, sizeof(int));
+}
 
-// Called before environment setup before start of each test iteration
-virtual void OnEnvironmentsSetUpStart(const ::testing::UnitTest &unit_test)
+inline int UnpackInt(const char *&cursor)
 {
-    if (rank == 0) { listener->OnEnvironmentsSetUpStart(unit_test); }
+  int value;
+  std::memcpy(&value, cursor, sizeof(int));
+  cursor += sizeof(int);
+  return value;
 }
 
-virtual void OnEnvironmentsSetUpEnd(const ::testing::UnitTest &unit_test)
+// Appends one record describing test_part_result on the range_count
+// rank ranges in ranges to buffer, copying the file name and message
+// straight from test_part_result.
+inline void PackResult(std::vector<char>& buffer,
+                       const std::pair<int, int> *ranges, int range_count,
+                       int test_index,
+                       const ::testing::TestPartResult& test_part_result)
 {
-    if (rank == 0) { listener->OnEnvironmentsSetUpEnd(unit_test); }
+  const char *fileName = test_part_result.file_name();
+  const char *message = test_part_result.message();
+  const size_t fileNameSize = fileName ? std::strlen(fileName) : 0;
+  const size_t messageSize = std::strlen(message);
+
+  buffer.reserve(buffer.size()
+                 + (kRecordHeaderInts + 2 * range_count) * sizeof(int)
+                 + fileNameSize + messageSize);
+  PackInt(buffer, test_index);
+  PackInt(buffer, static_cast<int>(test_part_result.type()));
+  PackInt(buffer, test_part_result.line_number());
+  PackInt(buffer, static_cast<int>(fileNameSize));
+  PackInt(buffer, static_cast<int>(messageSize));
+  PackInt(buffer, range_count);
+  for (int i = 0; i < range_count; i++) {
+    PackInt(buffer, ranges[i].first);
+    PackInt(buffer, ranges[i].second);
+  }
+  buffer.insert(buffer.end(), fileName, fileName + fileNameSize);
+  buffer.insert(buffer.end(), message, message + messageSize);
 }
 
-#ifndef GTEST_REMOVE_LEGACY_TEST_CASEAPI_
-virtual void OnTestCaseStart(const ::testing::TestCase &test_case)
+inline void PackResult(std::vector<char>& buffer, const RankSet& ranks,
+                       int test_index,
+                       const ::testing::TestPartResult& test_part_result)
 {
-    if (rank == 0) { listener->OnTestCaseStart(test_case); }
+  PackResult(buffer, ranks.ranges.empty() ? NULL : &ranks.ranges[0],
+             static_cast<int>(ranks.ranges.size()), test_index,
+             test_part_result);
 }
-#endif // GTEST_REMOVE_LEGACY_TEST_CASEAPI_
 
-// Called before a test starts.
-virtual void OnTestStart(const ::testing::TestInfo& test_info) {
-    // Only need to report test start info on rank 0
-    if (rank == 0) { listener->OnTestStart(test_info); }
+inline void PackResult(std::vector<char>& buffer, int rank, int test_index,
+                       const ::testing::TestPartResult& test_part_result)
+{
+  const std::pair<int, int> range(rank, rank);
+  PackResult(buffer, &range, 1, test_index, test_part_result);
 }
 
-// Called after an assertion failure or an explicit SUCCESS() macro.
-// In an MPI program, this means that certain ranks may not call this
-// function if a test part does not fail on all ranks. Consequently, it
-// is difficult to have explicit synchronization points here.
-virtual void OnTestPartResult
-(const ::testing::TestPartResult& test_part_result) {
-    result_vector.push_back(test_part_result);
-    if (rank == 0) { listener->OnTestPartResult(test_part_result); }
+// Size in bytes of the record that starts at record
+inline size_t RecordSize(const char *record)
+{
+  int header[kRecordHeaderInts];
+  std::memcpy(header, record, sizeof(header));
+  return (kRecordHeaderInts + 2 * header[5]) * sizeof(int)
+         + header[3] + header[4];
 }
 
-  // Called after a test ends.
-  virtual void OnTestEnd(const ::testing::TestInfo& test_info) {
-    int localResultCount = result_vector.size();
-    std::vector<int> resultCountOnRank(size, 0);
-    MPI_Gather(&localResultCount, 1, MPI_INT,
-               &resultCountOnRank[0], 1, MPI_INT,
-               0, comm);
-
-    if (rank != 0) {
-      // Nonzero ranks send constituent parts of each result to rank 0
-      for (int i = 0; i < localResultCount; i++) {
-        const ::testing::TestPartResult test_part_result = result_vector.at(i);
-        int resultStatus(test_part_result.failed());
-        std::string resultFileName(test_part_result.file_name());
-        int resultLineNumber(test_part_result.line_number());
-        std::string resultMessage(test_part_result.message());
-
-        int resultFileNameSize(resultFileName.size());
-        int resultMessageSize(resultMessage.size());
-
-        MPI_Send(&resultStatus, 1, MPI_INT, 0, rank, comm);
-        MPI_Send(&resultFileNameSize, 1, MPI_INT, 0, rank, comm);
-        MPI_Send(&resultLineNumber, 1, MPI_INT, 0, rank, comm);
-        MPI_Send(&resultMessageSize, 1, MPI_INT, 0, rank, comm);
-        MPI_Send(resultFileName.c_str(), resultFileNameSize, MPI_CHAR,
-                 0, rank, comm);
-        MPI_Send(resultMessage.c_str(), resultMessageSize, MPI_CHAR,
-                 0, rank, comm);
-      }
-    } else {
-      // Rank 0 first prints its local result data
-      for (int i = 0; i < localResultCount; i++) {
-        const ::testing::TestPartResult test_part_result = result_vector.at(i);
-        if (test_part_result.failed())
-        {
-            std::string message(test_part_result.message());
-            std::istringstream input_stream(message);
-            std::stringstream to_stream_into_failure;
-            std::string line_as_string;
-            while (std::getline(input_stream, line_as_string))
-            {
-                to_stream_into_failure << "[Rank 0/" << size << "] "
-                                       << line_as_string << std::endl;
-            }
-
-            ADD_FAILURE_AT(test_part_result.file_name(),
-                           test_part_result.line_number()) <<
-                to_stream_into_failure.str();
-        }
+// This rank's results for the running test, packed in the wire format
+// as they arrive, so that OnTestEnd copies them into the send buffer
+// with a single insert per thread instead of copying TestPartResult
+// objects and their strings. Their test index is only known when the
+// test ends, so it is stamped into the records then. Reset keeps the
+// storage, so that tests after the first with as many results allocate
+// nothing.
+//
+// Tests may report results from several threads at once, so each
+// thread packs into a buffer of its own, found through a thread_local
+// slot. The mutex is only taken the first time a thread reports in a
+// test, and when the buffers are merged or reset at the end of a test,
+// by which time the test's threads must have finished. Reset returns
+// every buffer to a pool for the threads of the next test, so the
+// records hold as many buffers as the most threads that reported in
+// one test, whatever the number of threads over the whole run. Results
+// keep their order within each thread; the buffers are merged in the
+// order in which their threads first reported in the test.
+class ResultRecords
+{
+ public:
+  ResultRecords() : mutex(), buffers(), spare_buffers(),
+                    generation(NextGeneration()) {}
+
+  // Copies the records; the copy's threads get buffers of their own
+  ResultRecords(const ResultRecords& records)
+      : mutex(), buffers(), spare_buffers(), generation(NextGeneration())
+  {
+    std::lock_guard<std::mutex> lock(records.mutex);
+    for (size_t i = 0; i < records.buffers.size(); i++) {
+      buffers.push_back(new std::vector<char>(*records.buffers[i]));
+    }
+  }
+
+  ~ResultRecords()
+  {
+    for (size_t i = 0; i < buffers.size(); i++) { delete buffers[i]; }
+    for (size_t i = 0; i < spare_buffers.size(); i++) {
+      delete spare_buffers[i];
+    }
+  }
+
+  void Add(int rank, const ::testing::TestPartResult& test_part_result)
+  {
+    ThreadSlot& slot = CurrentThreadSlot();
+    if (slot.generation != generation) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (spare_buffers.empty()) {
+        slot.bytes = new std::vector<char>();
+      } else {
+        slot.bytes = spare_buffers.back();
+        spare_buffers.pop_back();
       }
+      buffers.push_back(slot.bytes);
+      slot.generation = generation;
+    }
+    PackResult(*slot.bytes, rank, 0, test_part_result);
+  }
 
-      for (int r = 1; r < size; r++) {
-        for (int i = 0; i < resultCountOnRank[r]; i++) {
-          int resultStatus, resultFileNameSize, resultLineNumber;
-          int resultMessageSize;
-          MPI_Recv(&resultStatus, 1, MPI_INT, r, r, comm, MPI_STATUS_IGNORE);
-          MPI_Recv(&resultFileNameSize, 1, MPI_INT, r, r, comm,
-                   MPI_STATUS_IGNORE);
-          MPI_Recv(&resultLineNumber, 1, MPI_INT, r, r, comm,
-                   MPI_STATUS_IGNORE);
-          MPI_Recv(&resultMessageSize, 1, MPI_INT, r, r, comm,
-                   MPI_STATUS_IGNORE);
-
-          std::vector<char> fileNameBuffer(resultFileNameSize);
-          std::vector<char> messageBuffer(resultMessageSize);
-          MPI_Recv(&fileNameBuffer[0], resultFileNameSize,
-                   MPI_CHAR, r, r, comm, MPI_STATUS_IGNORE);
-          MPI_Recv(&messageBuffer[0], resultMessageSize,
-                   MPI_CHAR, r, r, comm, MPI_STATUS_IGNORE);
-
-          std::string resultFileName(fileNameBuffer.begin(),
-                                     fileNameBuffer.end());
-          std::string resultMessage(messageBuffer.begin(),
-                                    messageBuffer.end());
-
-          bool testPartHasFailed = (resultStatus == 1);
-          if (testPartHasFailed)
-          {
-              std::string message(resultMessage);
-              std::istringstream input_stream(message);
-              std::stringstream to_stream_into_failure;
-              std::string line_as_string;
-
-              while (std::getline(input_stream, line_as_string))
-              {
-                  to_stream_into_failure << "[Rank " << r << "/"  << size << "] "
-                                         << line_as_string << std::endl;
-              }
-
-              ADD_FAILURE_AT(resultFileName.c_str(),
-                             resultLineNumber) << to_stream_into_failure.str();
-          }
-        }
+  // Appends every record to buffer as a result of test test_index
+  void AppendTo(std::vector<char>& buffer, int test_index) const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < buffers.size(); i++) {
+      const std::vector<char>& bytes = *buffers[i];
+      if (bytes.empty()) { continue; }
+      size_t offset = buffer.size();
+      buffer.insert(buffer.end(), bytes.begin(), bytes.end());
+      while (offset < buffer.size()) {
+        std::memcpy(&buffer[offset], &test_index, sizeof(int));
+        offset += RecordSize(&buffer[offset]);
       }
     }
+  }
+
+  // Empties the records, keeping their storage, and detaches every
+  // thread from its buffer
+  void Reset()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < buffers.size(); i++) {
+      buffers[i]->clear();
+      spare_buffers.push_back(buffers[i]);
+    }
+    buffers.clear();
+    generation = NextGeneration();
+  }
 
-    result_vector.clear();
-    if (rank == 0) { listener->OnTestEnd(test_info); }
-}
+ private:
+  // A thread's buffer in the records whose generation it holds. Every
+  // set of records takes a new generation, unique in the process, when
+  // it is created or reset, so a thread never writes to a buffer from
+  // an earlier test, or from other records.
+  struct ThreadSlot
+  {
+    unsigned long generation;
+    std::vector<char> *bytes;
+  };
 
-#ifndef GTEST_REMOVE_LEGACY_TEST_CASEAPI_
-    virtual void OnTestCaseEnd(const ::testing::TestCase &test_case)
-        {
-            if (rank == 0) { listener->OnTestCaseEnd(test_case); }
-        }
+  static ThreadSlot& CurrentThreadSlot()
+  {
+    static thread_local ThreadSlot slot = { 0, NULL };
+    return slot;
+  }
 
-#endif
+  static unsigned long NextGeneration()
+  {
+    static std::atomic<unsigned long> next(1);
+    return next++;
+  }
+
+  mutable std::mutex mutex;
+  // The buffers of the threads that reported in the running test, in
+  // the order in which they first reported, and those free for reuse;
+  // all are owned here, so that they outlive their threads
+  std::vector<std::vector<char>*> buffers;
+  std::vector<std::vector<char>*> spare_buffers;
+  unsigned long generation;
 
-// Called before the Environment is torn down.
-virtual void OnEnvironmentsTearDownStart(const ::testing::UnitTest &unit_test)
+  // Disallow assignment
+  ResultRecords& operator=(const ResultRecords& records);
+};
+
+// Decodes every record in buffer, appending them to results in the
+// order in which they were packed.
+inline void UnpackResults(const std::vector<char>& buffer,
+                          std::vector<RankResult>& results)
 {
-    int is_mpi_finalized;
-    assert(MPI_Finalized(&is_mpi_finalized) == MPI_SUCCESS);
-    if (!is_mpi_finalized) {
-        MPI_Comm_free(&comm);
+  if (buffer.empty()) { return; }
+  const char *cursor = &buffer[0];
+  const char *end = cursor + buffer.size();
+  while (cursor < end) {
+    int resultTestIndex = UnpackInt(cursor);
+    int resultType = UnpackInt(cursor);
+    int resultLineNumber = UnpackInt(cursor);
+    int resultFileNameSize = UnpackInt(cursor);
+    int resultMessageSize = UnpackInt(cursor);
+    int rangeCount = UnpackInt(cursor);
+    RankSet resultRanks;
+    for (int i = 0; i < rangeCount; i++) {
+      int first = UnpackInt(cursor);
+      int last = UnpackInt(cursor);
+      resultRanks.AddRange(first, last);
     }
-    if (rank == 0) { listener->OnEnvironmentsTearDownStart(unit_test);  }
+    std::string resultFileName(cursor, resultFileNameSize);
+    cursor += resultFileNameSize;
+    std::string resultMessage(cursor, resultMessageSize);
+    cursor += resultMessageSize;
+
+    // TestPartResult treats an empty file name as unknown
+    results.push_back(RankResult(resultRanks, resultTestIndex,
+                                 ::testing::TestPartResult(
+        static_cast< ::testing::TestPartResult::Type >(resultType),
+        resultFileName.c_str(), resultLineNumber, resultMessage.c_str())));
+  }
+  assert(cursor == end);
 }
 
-virtual void OnEnvironmentsTearDownEnd(const ::testing::UnitTest &unit_test)
+// FNV-1a, used to bucket results by content before comparing them
+inline size_t HashBytes(size_t hash, const char *bytes, size_t count)
 {
-    if (rank == 0) { listener->OnEnvironmentsTearDownEnd(unit_test); }
+  for (size_t i = 0; i < count; i++) {
+    hash ^= static_cast<unsigned char>(bytes[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
 }
 
-virtual void OnTestIterationEnd(const ::testing::UnitTest &unit_test,
-                                int iteration)
+// Two results are duplicates if they belong to the same test and have
+// the same type, file, line, and summary. The summary is the message
+// without any stack trace, which differs between processes even for
+// identical failures.
+inline size_t HashResult(const RankResult& rank_result)
 {
-    if (rank == 0) { listener->OnTestIterationEnd(unit_test, iteration); }
+  const ::testing::TestPartResult& result = rank_result.result;
+  const int resultType = result.type();
+  const int resultLineNumber = result.line_number();
+  const char *fileName = result.file_name() ? result.file_name() : "";
+  size_t hash = static_cast<size_t>(14695981039346656037ULL);
+  hash = HashBytes(hash, reinterpret_cast<const char*>(&rank_result.test_index),
+                   sizeof(int));
+  hash = HashBytes(hash, reinterpret_cast<const char*>(&resultType),
+                   sizeof(int));
+  hash = HashBytes(hash, reinterpret_cast<const char*>(&resultLineNumber),
+                   sizeof(int));
+  hash = HashBytes(hash, fileName, std::strlen(fileName));
+  return HashBytes(hash, result.summary(), std::strlen(result.summary()));
 }
 
-// Called when test driver program ends
-virtual void OnTestProgramEnd(const ::testing::UnitTest &unit_test)
+inline bool SameResult(const RankResult& a_result, const RankResult& b_result)
 {
-    if (rank == 0) { listener->OnTestProgramEnd(unit_test); }
+  const ::testing::TestPartResult& a = a_result.result;
+  const ::testing::TestPartResult& b = b_result.result;
+  const char *aFileName = a.file_name() ? a.file_name() : "";
+  const char *bFileName = b.file_name() ? b.file_name() : "";
+  return a_result.test_index == b_result.test_index
+      && a.type() == b.type() && a.line_number() == b.line_number()
+      && std::strcmp(aFileName, bFileName) == 0
+      && std::strcmp(a.summary(), b.summary()) == 0;
 }
 
- private:
-    // Use a pointer here instead of a reference because
-    // ::testing::TestEventListeners::Release returns a pointer
-    // (namely, one of type ::testing::TesteEventListener*).
-  ::testing::TestEventListener *listener;
-  MPI_Comm comm;
-  int rank;
-  int size;
-  std::vector< ::testing::TestPartResult > result_vector;
+// Replaces the records in buffer with one record per distinct result,
+// whose rank set is the union of the rank sets of its duplicates.
+// Distinct results keep the order of their first occurrence, so a
+// buffer in rank order stays ordered by lowest reporting rank.
+inline void DeduplicateResults(std::vector<char>& buffer)
+{
+  std::vector<RankResult> results;
+  UnpackResults(buffer, results);
+
+  std::vector<RankResult> distinct;
+  std::multimap<size_t, size_t> distinctByHash;
+  for (size_t i = 0; i < results.size(); i++) {
+    const size_t hash = HashResult(results[i]);
+    typedef std::multimap<size_t, size_t>::iterator Iterator;
+    std::pair<Iterator, Iterator> candidates = distinctByHash.equal_range(hash);
+    Iterator match = candidates.first;
+    while (match != candidates.second
+           && !SameResult(distinct[match->second], results[i])) {
+      ++match;
+    }
 
-  int UpdateCommState()
-  {
-    int flag = MPI_Comm_rank(comm, &rank);
-    if (flag != MPI_SUCCESS) { return flag; }
-    flag = MPI_Comm_size(comm, &size);
-    return flag;
+    if (match != candidates.second) {
+      distinct[match->second].ranks.Merge(results[i].ranks);
+    } else {
+      distinctByHash.insert(std::make_pair(hash, distinct.size()));
+      distinct.push_back(results[i]);
+    }
   }
 
-};
+  buffer.clear();
+  for (size_t i = 0; i < distinct.size(); i++) {
+    PackResult(buffer, distinct[i].ranks, distinct[i].test_index,
+               distinct[i].result);
+  }
+}
+
+// Collects every rank's packed buffer onto rank 0. On rank 0, gathered
+// holds the concatenation of all buffers in rank order; on other ranks
+// it is left empty.
+inline void GatherResults(MPI_Comm comm, int rank, int size,
+                          const std::vector<char>& local,
+                          std::vector<char>& gathered)
+{
+  int localBufferSize = local.size();
+  std::vector<int> bufferSizeOnRank(size, 0);
+  MPI_Gather(&localBufferSize, 1, MPI_INT,
+             &bufferSizeOnRank[0], 1, MPI_INT,
+             0, comm);
+
+  std::vector<int> displacements(size, 0);
+  if (rank == 0) {
+    for (int r = 1; r < size; r++) {
+      displacements[r] = displacements[r-1] + bufferSizeOnRank[r-1];
+    }
+    gathered.resize(displacements[size-1] + bufferSizeOnRank[size-1]);
+  }
+
+  // MPI_Gatherv ignores the buffer addresses when there is nothing to
+  // move, but &v[0] on an empty vector is undefined, so guard it
+  char dummy;
+  MPI_Gatherv(local.empty() ? &dummy : const_cast<char*>(&local[0]),
+              localBufferSize, MPI_BYTE,
+              gathered.empty() ? &dummy : &gathered[0],
+              &bufferSizeOnRank[0], &displacements[0], MPI_BYTE,
+              0, comm);
+}
+
+// Collects every rank's packed buffer onto rank 0 by merging up a
+// k-nomial tree rooted at rank 0, with radix fan_in + 1. In each round,
+// a rank still holding results receives one merged buffer from each of
+// up to fan_in children, then later forwards everything it holds to its
+// parent in a single message. Each subtree spans a contiguous block of
+// ranks, so receiving children in ascending order keeps the merged
+// buffer in rank order, exactly as GatherResults produces it. If
+// deduplicate is set, duplicates are merged after every round, before
+// being forwarded.
+inline void TreeGatherResults(MPI_Comm comm, int rank, int size, int fan_in,
+                              bool deduplicate,
+                              const std::vector<char>& local,
+                              std::vector<char>& gathered)
+{
+  const long radix = (fan_in < 1) ? 2 : static_cast<long>(fan_in) + 1;
+  char dummy;
+  gathered = local;
+  for (long stride = 1; stride < size; stride *= radix) {
+    if (rank % (stride * radix) != 0) {
+      int parent = static_cast<int>(rank - rank % (stride * radix));
+      MPI_Send(gathered.empty() ? &dummy : &gathered[0],
+               static_cast<int>(gathered.size()), MPI_BYTE,
+               parent, kResultTag, comm);
+      gathered.clear();
+      return;
+    }
+
+    for (long j = 1; j < radix && rank + j * stride < size; j++) {
+      int child = static_cast<int>(rank + j * stride);
+      MPI_Status status;
+      int childBufferSize;
+      MPI_Probe(child, kResultTag, comm, &status);
+      MPI_Get_count(&status, MPI_BYTE, &childBufferSize);
+
+      const size_t offset = gathered.size();
+      gathered.resize(offset + childBufferSize);
+      MPI_Recv(childBufferSize ? &gathered[offset] : &dummy,
+               childBufferSize, MPI_BYTE, child, kResultTag, comm,
+               MPI_STATUS_IGNORE);
+    }
+    if (deduplicate) { DeduplicateResults(gathered); }
+  }
+}
+
+// Results left out of a report, per test: how many, whether any of
+// them failed, and on which ranks
+struct DroppedResults
+{
+  DroppedResults() : count(0), failed(false), ranks() {}
+
+  long count;
+  bool failed;
+  RankSet ranks;
+};
+
+typedef std::map<int, DroppedResults> DroppedResultsByTest;
+
+// Counts the record at record as left out on rank
+inline void DropRecord(const char *record, int rank,
+                       DroppedResultsByTest& dropped)
+{
+  int header[kRecordHeaderInts];
+  std::memcpy(header, record, sizeof(header));
+  DroppedResults& test = dropped[header[0]];
+  test.count++;
+  test.failed = test.failed
+      || header[1] == ::testing::TestPartResult::kNonFatalFailure
+      || header[1] == ::testing::TestPartResult::kFatalFailure;
+  test.ranks.Merge(RankSet(rank));
+}
+
+// Appends one result per test in dropped to buffer, saying why results
+// were left out; the result fails if any of those left out did.
+inline void PackDroppedResults(std::vector<char>& buffer,
+                               const DroppedResultsByTest& dropped,
+                               const std::string& reason)
+{
+  for (DroppedResultsByTest::const_iterator test = dropped.begin();
+       test != dropped.end(); ++test) {
+    std::stringstream message;
+    message << test->second.count << " more result"
+            << (test->second.count == 1 ? " was" : "s were")
+            << " not collected, " << reason << ".";
+    const ::testing::TestPartResult result(
+        test->second.failed ? ::testing::TestPartResult::kNonFatalFailure
+                            : ::testing::TestPartResult::kSuccess,
+        NULL, -1, message.str().c_str());
+    PackResult(buffer, test->second.ranks, test->first, result);
+  }
+}
+
+// Keeps the first max_results records of each test in buffer, which
+// holds this rank's records grouped by test, and summarizes the rest.
+inline void TruncateResults(std::vector<char>& buffer, int rank,
+                            int max_results)
+{
+  if (max_results <= 0 || buffer.empty()) { return; }
+  DroppedResultsByTest dropped;
+  size_t kept = 0, offset = 0;
+  int testIndex = -1, testCount = 0;
+  while (offset < buffer.size()) {
+    const size_t recordSize = RecordSize(&buffer[offset]);
+    int recordTestIndex;
+    std::memcpy(&recordTestIndex, &buffer[offset], sizeof(int));
+    if (recordTestIndex != testIndex) {
+      testIndex = recordTestIndex;
+      testCount = 0;
+    }
+    if (++testCount > max_results) {
+      DropRecord(&buffer[offset], rank, dropped);
+    } else {
+      if (kept != offset) {
+        std::memmove(&buffer[kept], &buffer[offset], recordSize);
+      }
+      kept += recordSize;
+    }
+    offset += recordSize;
+  }
+  buffer.resize(kept);
+  std::stringstream reason;
+  reason << "past the " << max_results
+         << " kept per rank (options.max_results_per_rank)";
+  PackDroppedResults(buffer, dropped, reason.str());
+}
+
+// Hands out the records of a packed buffer in chunks of whole records
+class ResultStream
+{
+ public:
+  explicit ResultStream(const std::vector<char>& buffer_)
+      : buffer(buffer_), offset(0) {}
+
+  bool Done() const { return offset == buffer.size(); }
+
+  // Appends records to chunk while they fit in chunk_limit bytes; the
+  // first may exceed chunk_limit if it fits in budget_left. Returns the
+  // number of bytes appended.
+  long TakeChunk(long chunk_limit, long budget_left, std::vector<char>& chunk)
+  {
+    long taken = 0;
+    while (!Done()) {
+      const long recordSize = static_cast<long>(RecordSize(&buffer[offset]));
+      if (taken == 0 ? recordSize > budget_left
+                     : taken + recordSize > chunk_limit) {
+        break;
+      }
+      chunk.insert(chunk.end(), buffer.begin() + offset,
+                   buffer.begin() + offset + recordSize);
+      offset += recordSize;
+      taken += recordSize;
+    }
+    return taken;
+  }
+
+  // Counts every record not yet taken as left out on rank
+  void DropRest(int rank, DroppedResultsByTest& dropped)
+  {
+    for (; !Done(); offset += RecordSize(&buffer[offset])) {
+      DropRecord(&buffer[offset], rank, dropped);
+    }
+  }
+
+ private:
+  const std::vector<char>& buffer;
+  size_t offset;
+};
+
+// Moves every rank's packed buffer to rank 0 under kStreamingAggregation.
+// Rank 0 learns which ranks have results with one MPI_Gather, then asks
+// each of them in turn for a chunk, by sending the chunk size and what
+// remains of its budget. A rank answers each request with three ints,
+// the size of the records that follow, whether it has more, and how
+// many tests it left results out of, followed by the records and, in
+// its last answer, a (test index, count, failed) triple per such test;
+// a request for a chunk of 0 bytes tells it to leave out the rest.
+inline void StreamResults(MPI_Comm comm, int rank, int size,
+                          const MPIListenerOptions& options,
+                          const std::vector<char>& local,
+                          std::vector<char>& gathered)
+{
+  int localHasResults = local.empty() ? 0 : 1;
+  std::vector<int> rankHasResults(rank == 0 ? size : 0);
+  MPI_Gather(&localHasResults, 1, MPI_INT,
+             rank == 0 ? &rankHasResults[0] : NULL, 1, MPI_INT, 0, comm);
+
+  const long budget = std::max(options.stream_budget_bytes, 0L);
+  const long chunkSize = std::max(options.stream_chunk_bytes, 1L);
+  ResultStream stream(local);
+  DroppedResultsByTest dropped;
+  std::vector<char> message;
+  char dummy;
+
+  if (rank != 0) {
+    while (localHasResults) {
+      long request[2];
+      MPI_Recv(request, 2, MPI_LONG, 0, kRequestTag, comm,
+               MPI_STATUS_IGNORE);
+      message.assign(3 * sizeof(int), 0);
+      const long taken = (request[0] > 0)
+          ? stream.TakeChunk(request[0], request[1], message) : 0;
+      if (taken == 0) { stream.DropRest(rank, dropped); }
+      const int header[3] = {static_cast<int>(taken), stream.Done() ? 0 : 1,
+                             static_cast<int>(dropped.size())};
+      std::memcpy(&message[0], header, sizeof(header));
+      if (stream.Done()) {
+        for (DroppedResultsByTest::const_iterator test = dropped.begin();
+             test != dropped.end(); ++test) {
+          PackInt(message, test->first);
+          PackInt(message, static_cast<int>(test->second.count));
+          PackInt(message, test->second.failed ? 1 : 0);
+        }
+      }
+      MPI_Send(&message[0], static_cast<int>(message.size()), MPI_BYTE, 0,
+               kResultTag, comm);
+      localHasResults = stream.Done() ? 0 : 1;
+    }
+    return;
+  }
+
+  // Rank 0 takes its own results first, then each other rank's
+  gathered.clear();
+  while (!stream.Done()) {
+    const long left = budget - static_cast<long>(gathered.size());
+    if (stream.TakeChunk(std::min(chunkSize, left), left, gathered) == 0) {
+      stream.DropRest(0, dropped);
+    }
+  }
+  for (int r = 1; r < size; r++) {
+    bool more = (rankHasResults[r] != 0);
+    while (more) {
+      const long left = budget - static_cast<long>(gathered.size());
+      long request[2] = {std::min(chunkSize, left), left};
+      MPI_Send(request, 2, MPI_LONG, r, kRequestTag, comm);
+
+      MPI_Status status;
+      int messageSize;
+      MPI_Probe(r, kResultTag, comm, &status);
+      MPI_Get_count(&status, MPI_BYTE, &messageSize);
+      message.resize(messageSize);
+      MPI_Recv(messageSize ? &message[0] : &dummy, messageSize, MPI_BYTE,
+               r, kResultTag, comm, MPI_STATUS_IGNORE);
+
+      const char *cursor = &message[0];
+      const int recordsSize = UnpackInt(cursor);
+      more = (UnpackInt(cursor) != 0);
+      const int droppedTests = UnpackInt(cursor);
+      gathered.insert(gathered.end(), cursor, cursor + recordsSize);
+      cursor += recordsSize;
+      if (more) { continue; }
+      for (int i = 0; i < droppedTests; i++) {
+        DroppedResults& test = dropped[UnpackInt(cursor)];
+        test.count += UnpackInt(cursor);
+        test.failed = test.failed || (UnpackInt(cursor) != 0);
+        test.ranks.Merge(RankSet(r));
+      }
+    }
+  }
+  std::stringstream reason;
+  reason << "to keep rank 0 within its budget of " << budget
+         << " bytes (options.stream_budget_bytes)";
+  PackDroppedResults(gathered, dropped, reason.str());
+}
+
+// Moves every rank's packed buffer to rank 0 as options dictate,
+// deduplicating failures only if the Features policy serves that.
+template <class Features>
+inline void CollectResults(MPI_Comm comm, int rank, int size,
+                           const MPIListenerOptions& options,
+                           const std::vector<char>& local,
+                           std::vector<char>& gathered)
+{
+  const bool deduplicate =
+      Features::kDeduplication && options.deduplicate_failures;
+
+  // Nearly all tests pass on every rank, so first agree with one small
+  // reduction whether any rank has something to report at all; if not,
+  // skip collection entirely.
+  int localHasResults = local.empty() ? 0 : 1;
+  int anyRankHasResults = 0;
+  MPI_Allreduce(&localHasResults, &anyRankHasResults, 1, MPI_INT, MPI_MAX,
+                comm);
+  if (!anyRankHasResults) { return; }
+
+  if (options.gatherer) {
+    options.gatherer->Gather(comm, rank, size, deduplicate, local, gathered);
+    return;
+  }
+  switch (options.aggregation) {
+    case kTreeAggregation:
+      TreeGatherResults(comm, rank, size, options.tree_fan_in, deduplicate,
+                        local, gathered);
+      break;
+    case kStreamingAggregation:
+      StreamResults(comm, rank, size, options, local, gathered);
+      if (rank == 0 && deduplicate) { DeduplicateResults(gathered); }
+      break;
+    case kFlatAggregation:
+    default:
+      GatherResults(comm, rank, size, local, gathered);
+      if (rank == 0 && deduplicate) { DeduplicateResults(gathered); }
+      break;
+  }
+}
+
+// The name under which Google Test reports a test
+inline std::string FullTestName(const ::testing::TestInfo& test_info)
+{
+  return std::string(test_info.test_case_name()) + "." + test_info.name();
+}
+
+// Placement of tests on ranks when tests run concurrently on groups of
+// ranks (see gtest-mpi-scheduler.hpp). Every rank holds the same
+// schedule, so results can be keyed by a test's position in it, even
+// though each rank only runs some of the tests.
+struct TestSchedule
+{
+  TestSchedule() : test_names(), test_ranks(), test_indices() {}
+
+  bool IsActive() const { return !test_names.empty(); }
+
+  void AddTest(const std::string& name, const RankSet& ranks)
+  {
+    test_indices[name] = static_cast<int>(test_names.size());
+    test_names.push_back(name);
+    test_ranks.push_back(ranks);
+  }
+
+  int IndexOf(const std::string& name) const
+  {
+    std::map<std::string, int>::const_iterator found =
+        test_indices.find(name);
+    assert(found != test_indices.end());
+    return found->second;
+  }
+
+  std::vector<std::string> test_names;
+  std::vector<RankSet> test_ranks;
+  std::map<std::string, int> test_indices;
+};
+
+inline TestSchedule& CurrentSchedule()
+{
+  static TestSchedule schedule;
+  return schedule;
+}
+
+// Whether test_part_result skips its test; Google Test only has skips
+// from 1.10 on
+inline bool IsSkip(const ::testing::TestPartResult& test_part_result)
+{
+#ifdef GTEST_SKIP
+  return test_part_result.skipped();
+#else
+  return false;
+#endif // GTEST_SKIP
+}
+
+// Whether the running test was skipped on this rank only because another
+// rank runs it, as with the serial tests dealt out by
+// gtest-mpi-serial-tests.hpp. Such a skip is not a result to report.
+inline bool& SkippedForAnotherRank()
+{
+  static bool skipped = false;
+  return skipped;
+}
+
+// When serial tests are dealt out to ranks (see gtest-mpi-serial-tests.hpp),
+// the number of the running serial test, which is the same on every
+// rank, and whether this rank runs it; otherwise, a number of -1
+struct DealtTest
+{
+  DealtTest() : number(-1), here(false) {}
+
+  int number;
+  bool here;
+};
+
+inline DealtTest& CurrentDealtTest()
+{
+  static DealtTest dealt;
+  return dealt;
+}
+
+// Whether the printers are skipping the running test themselves, under
+// MPIListenerOptions::fail_fast. Such a skip is not a result to report.
+inline bool& SkippingAfterFailure()
+{
+  static bool skipping = false;
+  return skipping;
+}
+
+// Told when the printers collect results, during which ranks wait on
+// one another, so that another listener (see gtest-mpi-watchdog.hpp)
+// can tell that time apart from time spent between tests. The printers
+// call OnCollectionStart before collecting at the end of an iteration,
+// and OnCollectionEnd once they have collected at the end of a test, a
+// test suite or an iteration; the ends of tests and test suites are
+// delivered to listeners appended after the printer before them.
+class CollectionObserver
+{
+ public:
+  virtual ~CollectionObserver() {}
+  virtual void OnCollectionStart() = 0;
+  virtual void OnCollectionEnd() = 0;
+};
+
+// The observer to tell, or NULL for none
+inline CollectionObserver*& CurrentCollectionObserver()
+{
+  static CollectionObserver *observer = NULL;
+  return observer;
+}
+
+inline void NotifyCollectionStart()
+{
+  if (CurrentCollectionObserver()) {
+    CurrentCollectionObserver()->OnCollectionStart();
+  }
+}
+
+inline void NotifyCollectionEnd()
+{
+  if (CurrentCollectionObserver()) {
+    CurrentCollectionObserver()->OnCollectionEnd();
+  }
+}
+
+// Skips test_info, which is starting, because some rank failed an
+// earlier test under MPIListenerOptions::fail_fast
+inline void SkipAfterFailure(const ::testing::TestInfo& test_info)
+{
+#ifdef GTEST_SKIP
+  SkippingAfterFailure() = true;
+  ::testing::internal::AssertHelper(::testing::TestPartResult::kSkip,
+                                    test_info.file(), test_info.line(),
+                                    "Skipped after a failure on some rank")
+      = ::testing::Message();
+  SkippingAfterFailure() = false;
+#endif // GTEST_SKIP
+}
+
+// The lowest rank of comm that failed, given whether this one did, or
+// size if none did
+inline int FirstFailingRank(MPI_Comm comm, int rank, int size, bool failed)
+{
+  int localRank = failed ? rank : size;
+  int firstRank = size;
+  MPI_Allreduce(&localRank, &firstRank, 1, MPI_INT, MPI_MIN, comm);
+  return firstRank;
+}
+
+// Whether the test named test_name ran and failed on this rank
+inline bool FailedOnThisRank(const std::string& test_name)
+{
+  const ::testing::UnitTest& unit_test = *::testing::UnitTest::GetInstance();
+#ifndef GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+  for (int i = 0; i < unit_test.total_test_case_count(); i++) {
+    const ::testing::TestCase& test_suite = *unit_test.GetTestCase(i);
+#else
+  for (int i = 0; i < unit_test.total_test_suite_count(); i++) {
+    const ::testing::TestSuite& test_suite = *unit_test.GetTestSuite(i);
+#endif // GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+    for (int j = 0; j < test_suite.total_test_count(); j++) {
+      const ::testing::TestInfo& test_info = *test_suite.GetTestInfo(j);
+      if (FullTestName(test_info) == test_name) {
+        return test_info.result()->Failed();
+      }
+    }
+  }
+  return false;
+}
+
+// Under a schedule, ranks run different tests, so the printers can only
+// collect results once every rank is done, and cannot reduce per-test
+// statistics across ranks that did not run the test.
+inline MPIListenerOptions ScheduledOptions(const MPIListenerOptions& options)
+{
+  MPIListenerOptions scheduled(options);
+  if (CurrentSchedule().IsActive()) {
+    scheduled.reporting = kReportPerIteration;
+    scheduled.report_timing = false;
+    scheduled.report_memory = false;
+    scheduled.fail_fast = false;
+  }
+  return scheduled;
+}
+
+// Records test_info in batch and returns the index under which its
+// results are packed: its position in the schedule, if any, or else in
+// the batch.
+inline int AddTestToBatch(const ::testing::TestInfo& test_info, int rank,
+                          ResultBatch& batch)
+{
+  const TestSchedule& schedule = CurrentSchedule();
+  if (schedule.IsActive()) {
+    return schedule.IndexOf(FullTestName(test_info));
+  }
+  if (rank == 0) { batch.test_names.push_back(FullTestName(test_info)); }
+  return batch.test_count++;
+}
+
+// Under a schedule, makes batch cover every scheduled test, so that all
+// ranks take part in collecting it, whichever tests they ran.
+inline void AddScheduleToBatch(int rank, ResultBatch& batch)
+{
+  const TestSchedule& schedule = CurrentSchedule();
+  if (!schedule.IsActive()) { return; }
+  batch.test_count = static_cast<int>(schedule.test_names.size());
+  if (rank == 0) { batch.test_names = schedule.test_names; }
+}
+
+// Whether timing should be flagged as a load imbalance
+inline bool IsImbalanced(const MPIListenerOptions& options,
+                         const TestTiming& timing, int size)
+{
+  return options.imbalance_threshold > 0.0
+      && timing.max >= options.imbalance_min_seconds
+      && timing.Imbalance(size) >= options.imbalance_threshold;
+}
+
+// MPI_User_function combining TestTiming structs; ties for the slowest
+// rank go to the lowest rank, so that the operation is commutative.
+inline void CombineTestTimings(void *in, void *inout, int *len,
+                               MPI_Datatype * /* datatype */)
+{
+  const TestTiming *a = static_cast<const TestTiming*>(in);
+  TestTiming *b = static_cast<TestTiming*>(inout);
+  for (int i = 0; i < *len; i++) {
+    b[i].min = std::min(a[i].min, b[i].min);
+    b[i].sum += a[i].sum;
+    if (a[i].max > b[i].max
+        || (a[i].max == b[i].max && a[i].max_rank < b[i].max_rank)) {
+      b[i].max = a[i].max;
+      b[i].max_rank = a[i].max_rank;
+    }
+  }
+}
+
+class DoubleBlockOp;
+
+// Every DoubleBlockOp created so far, for FreeBlockOps
+inline std::vector<DoubleBlockOp*>& BlockOps()
+{
+  static std::vector<DoubleBlockOp*> ops;
+  return ops;
+}
+
+// A datatype of count doubles and an operation combining them, for
+// reducing structs of doubles as blocks; the derived datatype keeps MPI
+// from splitting a struct in two when it applies the operation to
+// pieces of a buffer. Both are created the first time they are needed
+// and kept until FreeBlockOps, so that reductions run at every
+// reporting point do not create and free them each time.
+class DoubleBlockOp
+{
+ public:
+  DoubleBlockOp(int count_, MPI_User_function *function_)
+      : count(count_), function(function_), created(false),
+        type(MPI_DATATYPE_NULL), op(MPI_OP_NULL) {}
+
+  MPI_Datatype Type() { Create(); return type; }
+  MPI_Op Op() { Create(); return op; }
+
+  void Free()
+  {
+    if (!created) { return; }
+    MPI_Op_free(&op);
+    MPI_Type_free(&type);
+    created = false;
+  }
+
+ private:
+  int count;
+  MPI_User_function *function;
+  bool created;
+  MPI_Datatype type;
+  MPI_Op op;
+
+  void Create()
+  {
+    if (created) { return; }
+    MPI_Type_contiguous(count, MPI_DOUBLE, &type);
+    MPI_Type_commit(&type);
+    MPI_Op_create(function, 1, &op);
+    created = true;
+    BlockOps().push_back(this);
+  }
+};
+
+// Frees every DoubleBlockOp, while MPI is still usable; MPIEnvironment
+// calls it just before finalizing MPI.
+inline void FreeBlockOps()
+{
+  std::vector<DoubleBlockOp*>& ops = BlockOps();
+  for (size_t i = 0; i < ops.size(); i++) { ops[i]->Free(); }
+  ops.clear();
+}
+
+inline DoubleBlockOp& TestTimingOp()
+{
+  static DoubleBlockOp timingOp(4, &CombineTestTimings);
+  return timingOp;
+}
+
+// Moves the per-test times recorded in batch into local, as this rank's
+// contribution to reducing them, and sizes batch.timings on rank 0 to
+// receive the per-test statistics.
+inline void LocalTestTimings(int rank, ResultBatch& batch,
+                             std::vector<TestTiming>& local)
+{
+  local.resize(batch.test_times.size());
+  for (size_t i = 0; i < local.size(); i++) {
+    local[i].min = local[i].max = local[i].sum = batch.test_times[i];
+    local[i].max_rank = rank;
+  }
+  batch.test_times.clear();
+  batch.timings.resize(rank == 0 ? local.size() : 0);
+}
+
+// Reduces the per-test times recorded in batch on every rank to per-test
+// statistics on rank 0, using a single MPI_Reduce for the whole batch.
+inline void ReduceTestTimings(MPI_Comm comm, int rank, ResultBatch& batch)
+{
+  std::vector<TestTiming> local;
+  LocalTestTimings(rank, batch, local);
+  if (local.empty()) { return; }
+
+  DoubleBlockOp& timingOp = TestTimingOp();
+  MPI_Reduce(&local[0], rank == 0 ? &batch.timings[0] : NULL,
+             static_cast<int>(local.size()), timingOp.Type(), timingOp.Op(),
+             0, comm);
+}
+
+// Records timing as XML/JSON properties. When the test has already
+// ended, Google Test attaches the properties to the enclosing test suite
+// or program instead, so the keys are then prefixed with the test name.
+inline void RecordTimingProperties(const std::string& key_prefix,
+                                   const TestTiming& timing, int size)
+{
+  std::stringstream value;
+  value << timing.min;
+  ::testing::Test::RecordProperty(key_prefix + "mpi_time_min", value.str());
+  value.str("");
+  value << timing.Mean(size);
+  ::testing::Test::RecordProperty(key_prefix + "mpi_time_mean", value.str());
+  value.str("");
+  value << timing.max;
+  ::testing::Test::RecordProperty(key_prefix + "mpi_time_max", value.str());
+  ::testing::Test::RecordProperty(key_prefix + "mpi_time_max_rank",
+                                  static_cast<int>(timing.max_rank));
+  value.str("");
+  value << timing.Imbalance(size);
+  ::testing::Test::RecordProperty(key_prefix + "mpi_time_imbalance",
+                                  value.str());
+}
+
+// Splits comm into one communicator per node, as identified by
+// MPI_Get_processor_name, for summing memory over the ranks on a node.
+// The ranks on a node are told apart by the lowest rank among them in
+// comm, which becomes rank 0 of their node communicator. Sets node_comm
+// to MPI_COMM_NULL if memory is not being reported.
+inline void SplitByNode(MPI_Comm comm, const MPIListenerOptions& options,
+                        MPI_Comm *node_comm)
+{
+  *node_comm = MPI_COMM_NULL;
+  if (!options.report_memory) { return; }
+
+  int rank, size, length;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+  char name[MPI_MAX_PROCESSOR_NAME];
+  std::memset(name, 0, sizeof(name));
+  MPI_Get_processor_name(name, &length);
+  std::vector<char> names(static_cast<size_t>(size) * MPI_MAX_PROCESSOR_NAME);
+  MPI_Allgather(name, MPI_MAX_PROCESSOR_NAME, MPI_CHAR, &names[0],
+                MPI_MAX_PROCESSOR_NAME, MPI_CHAR, comm);
+
+  int leader = rank;
+  for (int r = 0; r < rank; r++) {
+    if (std::strncmp(&names[static_cast<size_t>(r) * MPI_MAX_PROCESSOR_NAME],
+                     name, MPI_MAX_PROCESSOR_NAME) == 0) {
+      leader = r;
+      break;
+    }
+  }
+  MPI_Comm_split(comm, leader, rank, node_comm);
+  ListenerComms().push_back(*node_comm);
+}
+
+// Moves the per-test memory growth recorded in batch into local, as
+// this rank's contribution to reducing it, and sizes batch.memory on
+// rank 0 to receive the per-test statistics. The growth is first summed
+// over each node onto the node's lowest rank, which alone contributes
+// node totals.
+inline void LocalTestMemory(MPI_Comm node_comm, int rank, ResultBatch& batch,
+                            std::vector<TestMemory>& local)
+{
+  const size_t testCount = batch.test_memory.size();
+  batch.memory.resize(rank == 0 ? testCount : 0);
+  local.resize(testCount);
+  if (testCount == 0) { return; }
+
+  int nodeRank;
+  MPI_Comm_rank(node_comm, &nodeRank);
+  std::vector<double> nodeTotals(testCount);
+  MPI_Reduce(&batch.test_memory[0], &nodeTotals[0],
+             static_cast<int>(testCount), MPI_DOUBLE, MPI_SUM, 0, node_comm);
+
+  for (size_t i = 0; i < testCount; i++) {
+    local[i].rank_max.value = batch.test_memory[i];
+    local[i].rank_max.rank = rank;
+    local[i].node_max.value = (nodeRank == 0) ? nodeTotals[i] : -1.0;
+    local[i].node_max.rank = rank;
+  }
+  batch.test_memory.clear();
+}
+
+// Reduces the per-test memory growth recorded in batch on every rank to
+// per-test statistics on rank 0: first a sum over each node, then a
+// single MPI_MAXLOC over all ranks.
+inline void ReduceTestMemory(MPI_Comm comm, MPI_Comm node_comm, int rank,
+                             ResultBatch& batch)
+{
+  std::vector<TestMemory> local;
+  LocalTestMemory(node_comm, rank, batch, local);
+  if (local.empty()) { return; }
+
+  MPI_Reduce(&local[0], rank == 0 ? &batch.memory[0] : NULL,
+             static_cast<int>(2 * local.size()), MPI_DOUBLE_INT, MPI_MAXLOC,
+             0, comm);
+}
+
+// Starts reducing count elements of send onto rank 0 of comm, adding a
+// request to requests; recv may only be read once they complete. MPI
+// before 3.0 has no nonblocking collectives, so the reduction then
+// completes before this returns.
+inline void StartReduce(const void *send, void *recv, int count,
+                        MPI_Datatype datatype, MPI_Op op, MPI_Comm comm,
+                        std::vector<MPI_Request>& requests)
+{
+#if defined(MPI_VERSION) && MPI_VERSION >= 3
+  requests.push_back(MPI_REQUEST_NULL);
+  MPI_Ireduce(send, recv, count, datatype, op, 0, comm, &requests.back());
+#else
+  MPI_Reduce(const_cast<void*>(send), recv, count, datatype, op, 0, comm);
+#endif
+}
+
+// Starts gathering one int from every rank of comm onto rank 0, as
+// StartReduce does.
+inline void StartGatherInt(const int *send, int *recv, MPI_Comm comm,
+                           std::vector<MPI_Request>& requests)
+{
+#if defined(MPI_VERSION) && MPI_VERSION >= 3
+  requests.push_back(MPI_REQUEST_NULL);
+  MPI_Igather(send, 1, MPI_INT, recv, 1, MPI_INT, 0, comm, &requests.back());
+#else
+  MPI_Gather(const_cast<int*>(send), 1, MPI_INT, recv, 1, MPI_INT, 0, comm);
+#endif
+}
+
+// Moves packed buffers to rank 0 without making the other ranks wait
+// for it. At each reporting point, rank 0 gathers one int per rank
+// saying whether the rank has results, and only those that do post an
+// MPI_Isend of their buffer; ranks then move on. Rank 0 receives from
+// just those ranks when the next batch is posted, or when Drain is
+// called, by which time the messages have usually arrived. MPI
+// guarantees that messages between a pair of ranks on the same tag
+// arrive in order, so batches cannot be confused with one another. Each
+// rank keeps two hand-offs, so that it only blocks if the batch before
+// last is still in flight.
+//
+// Timing and memory statistics are reduced onto rank 0 the same way:
+// with MPI-3, each rank starts an MPI_Ireduce and moves on, and rank 0
+// completes it when it receives the batch. Only summing memory over
+// each node still blocks, on the ranks of that node. Before MPI-3, the
+// gather and the reductions complete before Post returns.
+class PipelinedCollector
+{
+ public:
+  PipelinedCollector() : pending(), has_pending(false), next_slot(0),
+                         pending_has_results() {}
+
+  // Hands batch off, leaving it empty. On rank 0, returns whether a
+  // previously posted batch was completed into completed. Statistics
+  // are only reduced if the Features policy serves them.
+  template <class Features>
+  bool Post(MPI_Comm comm, MPI_Comm node_comm, int rank, int size,
+            const MPIListenerOptions& options, ResultBatch& batch,
+            ResultBatch& completed)
+  {
+    bool hasCompleted = false;
+    Handoff& handoff = handoffs[next_slot];
+    next_slot = 1 - next_slot;
+    if (rank == 0) {
+      // Draining completes both hand-offs, along with the batch
+      hasCompleted = Drain(comm, rank, size, completed);
+      pending.Swap(batch);
+      has_pending = true;
+      handoff.has_results = pending.buffer.empty() ? 0 : 1;
+      pending_has_results.assign(size, 0);
+    } else {
+      Complete(handoff);
+      handoff.buffer.swap(batch.buffer);
+      handoff.has_results = handoff.buffer.empty() ? 0 : 1;
+    }
+    ResultBatch& statistics = (rank == 0) ? pending : batch;
+
+    StartGatherInt(&handoff.has_results,
+                   rank == 0 ? &pending_has_results[0] : NULL, comm,
+                   handoff.requests);
+    if (Features::kTiming && options.report_timing) {
+      LocalTestTimings(rank, statistics, handoff.timings);
+      if (!handoff.timings.empty()) {
+        DoubleBlockOp& timingOp = TestTimingOp();
+        StartReduce(&handoff.timings[0],
+                    rank == 0 ? &pending.timings[0] : NULL,
+                    static_cast<int>(handoff.timings.size()),
+                    timingOp.Type(), timingOp.Op(), comm, handoff.requests);
+      }
+    }
+    if (Features::kMemory && options.report_memory) {
+      LocalTestMemory(node_comm, rank, statistics, handoff.memory);
+      if (!handoff.memory.empty()) {
+        StartReduce(&handoff.memory[0], rank == 0 ? &pending.memory[0] : NULL,
+                    static_cast<int>(2 * handoff.memory.size()),
+                    MPI_DOUBLE_INT, MPI_MAXLOC, comm, handoff.requests);
+      }
+    }
+    if (rank != 0 && handoff.has_results) {
+      handoff.requests.push_back(MPI_REQUEST_NULL);
+      MPI_Isend(&handoff.buffer[0], static_cast<int>(handoff.buffer.size()),
+                MPI_BYTE, 0, kResultTag, comm, &handoff.requests.back());
+    }
+    batch.Clear();
+    return hasCompleted;
+  }
+
+  // Completes everything this rank has handed off. On rank 0, then
+  // receives the outstanding batch, if any, into completed and returns
+  // whether there was one.
+  bool Drain(MPI_Comm comm, int rank, int size, ResultBatch& completed)
+  {
+    Complete(handoffs[0]);
+    Complete(handoffs[1]);
+    if (rank != 0 || !has_pending) { return false; }
+
+    completed.Clear();
+    completed.Swap(pending);
+    has_pending = false;
+    for (int r = 1; r < size; r++) {
+      if (!pending_has_results[r]) { continue; }
+      MPI_Status status;
+      int rankBufferSize;
+      MPI_Probe(r, kResultTag, comm, &status);
+      MPI_Get_count(&status, MPI_BYTE, &rankBufferSize);
+
+      const size_t offset = completed.buffer.size();
+      completed.buffer.resize(offset + rankBufferSize);
+      MPI_Recv(&completed.buffer[offset], rankBufferSize, MPI_BYTE, r,
+               kResultTag, comm, MPI_STATUS_IGNORE);
+    }
+    return true;
+  }
+
+ private:
+  // What a rank hands off at one reporting point, kept until the
+  // operations on it complete
+  struct Handoff
+  {
+    Handoff() : buffer(), has_results(0), timings(), memory(), requests() {}
+
+    std::vector<char> buffer;
+    int has_results;
+    std::vector<TestTiming> timings;
+    std::vector<TestMemory> memory;
+    std::vector<MPI_Request> requests;
+  };
+
+  Handoff handoffs[2];
+  ResultBatch pending;
+  bool has_pending;
+  int next_slot;
+  // On rank 0, whether each rank has results in the pending batch
+  std::vector<int> pending_has_results;
+
+  static void Complete(Handoff& handoff)
+  {
+    if (handoff.requests.empty()) { return; }
+    MPI_Waitall(static_cast<int>(handoff.requests.size()),
+                &handoff.requests[0], MPI_STATUSES_IGNORE);
+    handoff.requests.clear();
+  }
+};
+
+
+// Records memory as XML/JSON properties, keyed as in
+// RecordTimingProperties.
+inline void RecordMemoryProperties(const std::string& key_prefix,
+                                   const TestMemory& memory)
+{
+  std::stringstream value;
+  value << memory.rank_max.value;
+  ::testing::Test::RecordProperty(key_prefix + "mpi_mem_peak_kb_max",
+                                  value.str());
+  ::testing::Test::RecordProperty(key_prefix + "mpi_mem_peak_kb_max_rank",
+                                  memory.rank_max.rank);
+  value.str("");
+  value << memory.node_max.value;
+  ::testing::Test::RecordProperty(key_prefix + "mpi_mem_node_peak_kb_max",
+                                  value.str());
+  ::testing::Test::RecordProperty(key_prefix + "mpi_mem_node_peak_kb_max_rank",
+                                  memory.node_max.rank);
+}
+
+// Stops tracker at the end of test_info, recording the growth in batch
+// if memory is being reported, and fails the test on this rank if the
+// growth exceeds the budget. The test is still running, so the failure
+// is attributed to it and collected along with its other results.
+inline void EndMemorySample(const MPIListenerOptions& options,
+                            const ::testing::TestInfo& test_info, int rank,
+                            const MemoryTracker& tracker, ResultBatch& batch)
+{
+  if (!options.SamplesMemory()) { return; }
+
+  const long growth = tracker.Stop();
+  if (options.report_memory) {
+    batch.test_memory.push_back(static_cast<double>(growth));
+  }
+  if (options.memory_budget_kb > 0 && growth > options.memory_budget_kb) {
+    ADD_FAILURE_AT(test_info.file(), test_info.line())
+        << "Peak memory grew by " << growth << " kB on rank " << rank
+        << ", exceeding the budget of " << options.memory_budget_kb << " kB";
+  }
+}
+
+// Collects the results of every test in batch onto rank 0, leaving
+// batch empty. Returns true on rank 0 if gathered holds results ready to
+// be reported; under pipelined aggregation, these belong to an earlier
+// batch. Features tells which of timing, memory and deduplication are
+// compiled in.
+template <class Features>
+inline bool CollectBatch(MPI_Comm comm, MPI_Comm node_comm, int rank,
+                         int size, const MPIListenerOptions& options,
+                         PipelinedCollector& pipeline,
+                         ResultBatch& batch, ResultBatch& gathered)
+{
+  gathered.Clear();
+  TruncateResults(batch.buffer, rank, options.max_results_per_rank);
+  if (options.aggregation == kPipelinedAggregation) {
+    // The pipeline starts the reductions itself, so as not to wait on them
+    if (!pipeline.Post<Features>(comm, node_comm, rank, size, options,
+                                 batch, gathered)) {
+      return false;
+    }
+    if (Features::kDeduplication && options.deduplicate_failures) {
+      DeduplicateResults(gathered.buffer);
+    }
+    return true;
+  }
+
+  if (Features::kTiming && options.report_timing) {
+    ReduceTestTimings(comm, rank, batch);
+  }
+  if (Features::kMemory && options.report_memory) {
+    ReduceTestMemory(comm, node_comm, rank, batch);
+  }
+  gathered.test_names.swap(batch.test_names);
+  gathered.test_count = batch.test_count;
+  gathered.test_times.swap(batch.test_times);
+  gathered.test_skipped.swap(batch.test_skipped);
+  gathered.timings.swap(batch.timings);
+  gathered.memory.swap(batch.memory);
+  CollectResults<Features>(comm, rank, size, options, batch.buffer,
+                          gathered.buffer);
+  batch.Clear();
+  return rank == 0;
+}
+
+// Completes any collection still in flight, as CollectBatch does.
+template <class Features>
+inline bool DrainBatches(MPI_Comm comm, int rank, int size,
+                         const MPIListenerOptions& options,
+                         PipelinedCollector& pipeline, ResultBatch& gathered)
+{
+  if (options.aggregation != kPipelinedAggregation) { return false; }
+  if (!pipeline.Drain(comm, rank, size, gathered)) { return false; }
+  if (Features::kDeduplication && options.deduplicate_failures) {
+    DeduplicateResults(gathered.buffer);
+  }
+  return true;
+}
+
+// Hands every test in gathered to options.result_writer, if set, with
+// its failures from results, which must be sorted by test. A test is
+// skipped if it was skipped on any rank, or by the printer itself.
+inline void WriteResults(const MPIListenerOptions& options, int size,
+                         const ResultBatch& gathered,
+                         const std::vector<RankResult>& results)
+{
+  if (!options.result_writer) { return; }
+  std::vector<RankResult> failures;
+  size_t i = 0;
+  for (int t = 0; t < gathered.test_count; t++) {
+    failures.clear();
+    bool skipped = gathered.test_skipped.size()
+                       == static_cast<size_t>(gathered.test_count)
+                   && gathered.test_skipped[t];
+    for (; i < results.size() && results[i].test_index == t; i++) {
+      if (results[i].result.failed()) { failures.push_back(results[i]); }
+      if (IsSkip(results[i].result)) { skipped = true; }
+    }
+    double seconds = 0.0;
+    if (!gathered.timings.empty()) {
+      seconds = gathered.timings[t].max;
+    } else if (gathered.test_times.size()
+               == static_cast<size_t>(gathered.test_count)) {
+      seconds = gathered.test_times[t];
+    }
+    options.result_writer->WriteTest(gathered.test_names[t], seconds,
+                                     skipped, failures, size);
+  }
+}
+
+inline int RepeatFlag()
+{
+#ifdef GTEST_FLAG_GET
+  return GTEST_FLAG_GET(repeat);
+#else
+  return ::testing::GTEST_FLAG(repeat);
+#endif
+}
+
+// Whether Google Test tears environments down after every iteration of
+// --gtest_repeat, rather than only after the last; versions before 1.12,
+// which introduced GTEST_FLAG_GET along with the flag, always do.
+inline bool RecreatesEnvironments()
+{
+#ifdef GTEST_FLAG_GET
+  return GTEST_FLAG_GET(recreate_environments_when_repeating);
+#else
+  return true;
+#endif
+}
+
+// Whether iteration is the last one --gtest_repeat asks for. The
+// printers and MPIEnvironment keep MPI state until it ends, even if
+// environments are torn down before.
+inline bool IsLastIteration(int iteration)
+{
+  const int repeat = RepeatFlag();
+  return repeat >= 0 && iteration >= repeat - 1;
+}
+
+// Whether environments are being torn down for the last time, given
+// how often they were before, in tear_down_count, which it increments.
+// Listeners that free MPI resources when environments are torn down
+// must wait for this.
+inline bool TearingDownLastTime(int& tear_down_count)
+{
+  const int iteration = tear_down_count++;
+  return !RecreatesEnvironments() || IsLastIteration(iteration);
+}
+
+// Outcomes of every test over the iterations of --gtest_repeat, for
+// MPIListenerOptions::report_flaky_tests. Tests are numbered by their
+// rank in name order, so every rank numbers them alike whatever tests it
+// runs and in whatever order. Each rank sets a bit per test it failed,
+// and one per test it ran, and at the end of each iteration a single
+// MPI_Allreduce with MPI_BOR tells every rank which tests failed and
+// which ran on any rank.
+class FlakyTestTracker
+{
+ public:
+  FlakyTestTracker() : test_ids(), test_names(), bits(), rank_failed(),
+                       failed_iterations(), passed_iterations(),
+                       iterations(0) {}
+
+  // Numbers the tests of unit_test, the first time it is called
+  void Start(const ::testing::UnitTest& unit_test)
+  {
+    if (!test_names.empty()) { return; }
+#ifndef GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+    for (int i = 0; i < unit_test.total_test_case_count(); i++) {
+      const ::testing::TestCase& test_suite = *unit_test.GetTestCase(i);
+#else
+    for (int i = 0; i < unit_test.total_test_suite_count(); i++) {
+      const ::testing::TestSuite& test_suite = *unit_test.GetTestSuite(i);
+#endif // GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+      for (int j = 0; j < test_suite.total_test_count(); j++) {
+        test_names.push_back(FullTestName(*test_suite.GetTestInfo(j)));
+      }
+    }
+    std::sort(test_names.begin(), test_names.end());
+    for (size_t t = 0; t < test_names.size(); t++) {
+      test_ids[test_names[t]] = static_cast<int>(t);
+    }
+    bits.assign(2 * Words(), 0u);
+    rank_failed.assign(test_names.size(), 0);
+    failed_iterations.assign(test_names.size(), 0);
+    passed_iterations.assign(test_names.size(), 0);
+  }
+
+  // Records how test_info, which just ended, went on this rank
+  void Record(const ::testing::TestInfo& test_info, bool failed)
+  {
+    std::map<std::string, int>::const_iterator found =
+        test_ids.find(FullTestName(test_info));
+    if (found == test_ids.end()) { return; }
+    const int t = found->second;
+    const unsigned bit = 1u << (t % kBitsPerWord);
+#ifdef GTEST_SKIP
+    if (test_info.result()->Skipped()) { return; }
+#endif // GTEST_SKIP
+    bits[Words() + t / kBitsPerWord] |= bit;
+    if (failed) {
+      bits[t / kBitsPerWord] |= bit;
+      rank_failed[t] = 1;
+    }
+  }
+
+  // Merges the outcomes of the iteration that just ended over comm
+  void EndIteration(MPI_Comm comm)
+  {
+    if (bits.empty()) { return; }
+    std::vector<unsigned> merged(bits.size());
+    MPI_Allreduce(&bits[0], &merged[0], static_cast<int>(bits.size()),
+                  MPI_UNSIGNED, MPI_BOR, comm);
+    for (size_t t = 0; t < test_names.size(); t++) {
+      const unsigned bit = 1u << (t % kBitsPerWord);
+      if (merged[t / kBitsPerWord] & bit) {
+        failed_iterations[t]++;
+      } else if (merged[Words() + t / kBitsPerWord] & bit) {
+        passed_iterations[t]++;
+      }
+    }
+    std::fill(bits.begin(), bits.end(), 0u);
+    iterations++;
+  }
+
+  // Prints on rank 0 every test that both passed and failed, with the
+  // ranks that failed it; rank 0 gathers one byte per such test per rank.
+  void Report(MPI_Comm comm, int rank, int size) const
+  {
+    std::vector<int> flaky;
+    std::vector<char> localFailed;
+    for (size_t t = 0; t < test_names.size(); t++) {
+      if (failed_iterations[t] > 0 && passed_iterations[t] > 0) {
+        flaky.push_back(static_cast<int>(t));
+        localFailed.push_back(static_cast<char>(rank_failed[t]));
+      }
+    }
+    if (rank == 0) {
+      printf("*** %d flaky test%s over %d iteration%s%s\n",
+             static_cast<int>(flaky.size()), flaky.size() == 1 ? "" : "s",
+             iterations, iterations == 1 ? "" : "s",
+             flaky.empty() ? "." : ":");
+    }
+    if (flaky.empty()) { return; }
+
+    const int count = static_cast<int>(flaky.size());
+    std::vector<char> allFailed(rank == 0 ? count * size : 0);
+    MPI_Gather(&localFailed[0], count, MPI_CHAR,
+               rank == 0 ? &allFailed[0] : NULL, count, MPI_CHAR, 0, comm);
+    if (rank != 0) { return; }
+    for (int i = 0; i < count; i++) {
+      RankSet ranks;
+      for (int r = 0; r < size; r++) {
+        if (allFailed[r * count + i]) { ranks.Merge(RankSet(r)); }
+      }
+      const int t = flaky[i];
+      printf("      %s failed in %d of %d iterations, on rank%s %s\n",
+             test_names[t].c_str(), failed_iterations[t],
+             failed_iterations[t] + passed_iterations[t],
+             ranks.HasSingleRank() ? "" : "s", ranks.ToString().c_str());
+    }
+  }
+
+ private:
+  static const int kBitsPerWord = 32;
+
+  std::map<std::string, int> test_ids;
+  std::vector<std::string> test_names;
+  // A bit per test this rank failed in the running iteration, then one
+  // per test it ran
+  std::vector<unsigned> bits;
+  // Whether this rank failed each test in any iteration
+  std::vector<char> rank_failed;
+  std::vector<int> failed_iterations;
+  std::vector<int> passed_iterations;
+  int iterations;
+
+  size_t Words() const
+  {
+    return (test_names.size() + kBitsPerWord - 1) / kBitsPerWord;
+  }
+};
+
+} // namespace internal
+
+// This class sets up the global test environment, which is needed
+// to finalize MPI.
+//
+// MPI may be initialized with MPI_Init_thread instead of MPI_Init. The
+// printers only call MPI from the thread running RUN_ALL_TESTS, and
+// never while a test body runs, so they work at any thread level; tests
+// whose own threads call MPI need the level those calls require. With
+// MPI-2, passing that level to the constructor makes SetUp fail if MPI
+// provides less.
+class MPIEnvironment : public ::testing::Environment {
+ public:
+ MPIEnvironment() : ::testing::Environment(), required_thread_level(-1),
+                    tear_down_count(0) {}
+
+#if defined(MPI_VERSION) && MPI_VERSION >= 2
+  explicit MPIEnvironment(int required_thread_level_)
+      : ::testing::Environment(),
+        required_thread_level(required_thread_level_), tear_down_count(0) {}
+#endif
+
+  virtual ~MPIEnvironment() {}
+
+  virtual void SetUp() {
+    int is_mpi_initialized;
+    ASSERT_EQ(MPI_Initialized(&is_mpi_initialized), MPI_SUCCESS);
+    if (!is_mpi_initialized) {
+      printf("MPI must be initialized before RUN_ALL_TESTS!\n");
+      printf("Add '::testing::InitGoogleTest(&argc, argv);\n");
+      printf("     MPI_Init(&argc, &argv);' to your 'main' function!\n");
+      FAIL();
+    }
+#if defined(MPI_VERSION) && MPI_VERSION >= 2
+    if (required_thread_level >= 0) {
+      int provided;
+      ASSERT_EQ(MPI_Query_thread(&provided), MPI_SUCCESS);
+      if (provided < required_thread_level) {
+        printf("MPI provides thread level %d, but the tests need %d!\n",
+               provided, required_thread_level);
+        printf("Initialize MPI with 'MPI_Init_thread(&argc, &argv, "
+               "required, &provided);'.\n");
+        FAIL();
+      }
+    }
+#endif
+  }
+
+  // Finalizes MPI once the last iteration of --gtest_repeat ends
+  virtual void TearDown() {
+    if (!internal::TearingDownLastTime(tear_down_count)) { return; }
+    int is_mpi_finalized;
+    ASSERT_EQ(MPI_Finalized(&is_mpi_finalized), MPI_SUCCESS);
+    if (!is_mpi_finalized) {
+      int rank;
+      ASSERT_EQ(MPI_Comm_rank(MPI_COMM_WORLD, &rank), MPI_SUCCESS);
+      if (rank == 0) { printf("Finalizing MPI...\n"); }
+      internal::FreeBlockOps();
+      ASSERT_EQ(MPI_Finalize(), MPI_SUCCESS);
+    }
+    ASSERT_EQ(MPI_Finalized(&is_mpi_finalized), MPI_SUCCESS);
+    ASSERT_TRUE(is_mpi_finalized);
+  }
+
+ private:
+  // Thread level that MPI must provide, or -1 to accept any
+  int required_thread_level;
+  // Number of times TearDown ran before
+  int tear_down_count;
+
+  // Disallow copying
+  MPIEnvironment(const MPIEnvironment& env) {}
+
+}; // class MPIEnvironment
+
+// Features a printer can serve. A printer whose Features policy sets
+// one of these to false ignores the matching options, and the code that
+// serves the feature, in the printer and in the helpers that collect
+// its results, is guarded by the constant, so the compiler drops it.
+// How results travel (options.aggregation, options.gatherer) stays a
+// run-time choice.
+struct MPIAllFeatures
+{
+  static const bool kTiming = true;        // report_timing
+  static const bool kMemory = true;        // report_memory, memory_budget_kb
+  static const bool kDeduplication = true; // deduplicate_failures
+  static const bool kFailFast = true;      // fail_fast
+  static const bool kFlakyTests = true;    // report_flaky_tests
+};
+
+namespace internal
+{
+
+// options, as a printer with the given Features policy applies them
+template <class Features>
+inline MPIListenerOptions FeatureOptions(const MPIListenerOptions& options)
+{
+  MPIListenerOptions featured(ScheduledOptions(options));
+  featured.report_timing = Features::kTiming && featured.report_timing;
+  featured.report_memory = Features::kMemory && featured.report_memory;
+  if (!Features::kMemory) { featured.memory_budget_kb = 0; }
+  featured.deduplicate_failures =
+      Features::kDeduplication && featured.deduplicate_failures;
+  featured.fail_fast = Features::kFailFast && featured.fail_fast;
+  featured.report_flaky_tests =
+      Features::kFlakyTests && featured.report_flaky_tests;
+  return featured;
+}
+
+} // namespace internal
+
+// Base of the formatting policies of MPIPrinter. MPIPrinter passes
+// Google Test's events to its policy on rank 0, and this base ignores
+// them; a policy hides whichever events it handles. The calls are
+// resolved at compile time, so ignored events cost nothing.
+class MPIPrinterFormat
+{
+ public:
+  // Whether results must wait until no test runs to be reported,
+  // because reporting them adds them to the running test
+  static const bool kReportsIntoRunningTest = false;
+
+  // Whether rank 0 needs test_part_result, from any rank
+  static bool Collects(const ::testing::TestPartResult& /* test_part_result */)
+  {
+    return true;
+  }
+
+  void OnTestProgramStart(const ::testing::UnitTest& /* unit_test */) {}
+  void OnTestIterationStart(const ::testing::UnitTest& /* unit_test */,
+                            int /* iteration */) {}
+  void OnEnvironmentsSetUpStart(const ::testing::UnitTest& /* unit_test */) {}
+  void OnEnvironmentsSetUpEnd(const ::testing::UnitTest& /* unit_test */) {}
+#ifndef GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+  void OnTestCaseStart(const ::testing::TestCase& /* test_case */) {}
+  void OnTestCaseEnd(const ::testing::TestCase& /* test_case */) {}
+#endif // GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+  void OnTestStart(const ::testing::TestInfo& /* test_info */,
+                   const MPIListenerOptions& /* options */) {}
+  void OnTestPartResult(const ::testing::TestPartResult& /* result */) {}
+  void OnTestEnd(const ::testing::TestInfo& /* test_info */) {}
+  void OnEnvironmentsTearDownStart(const ::testing::UnitTest& /* unit_test */)
+  {}
+  void OnEnvironmentsTearDownEnd(const ::testing::UnitTest& /* unit_test */) {}
+  void OnTestIterationEnd(const ::testing::UnitTest& /* unit_test */,
+                          int /* iteration */) {}
+  void OnTestProgramEnd(const ::testing::UnitTest& /* unit_test */) {}
+};
+
+// Formatting policy of MPIMinimalistPrinter, which more or less takes
+// the code in Google Test's MinimalistPrinter example: rank 0 prints
+// every result itself, test by test, in rank order within each test.
+class MPIMinimalistFormat : public MPIPrinterFormat
+{
+ public:
+  // Only need to report test start info on rank 0; batched tests
+  // are announced when their results are reported
+  void OnTestStart(const ::testing::TestInfo& test_info,
+                   const MPIListenerOptions& options)
+  {
+    if (!options.DefersReporting()) {
+      printf("*** Test %s.%s starting.\n",
+             test_info.test_case_name(), test_info.name());
+    }
+  }
+
+  void ReportResults(const internal::ResultBatch& gathered,
+                     const std::vector<internal::RankResult>& results,
+                     const MPIListenerOptions& options, int size)
+  {
+    size_t i = 0;
+    for (int t = 0; t < gathered.test_count; t++) {
+      const internal::TestSchedule& schedule = internal::CurrentSchedule();
+      if (schedule.IsActive()) {
+        printf("*** Test %s starting on rank%s %s.\n",
+               gathered.test_names[t].c_str(),
+               schedule.test_ranks[t].HasSingleRank() ? "" : "s",
+               schedule.test_ranks[t].ToString().c_str());
+      } else if (options.DefersReporting()) {
+        printf("*** Test %s starting.\n", gathered.test_names[t].c_str());
+      }
+      for (; i < results.size() && results[i].test_index == t; i++) {
+        const ::testing::TestPartResult& test_part_result = results[i].result;
+        printf("      %s on rank%s %s, %s:%d\n%s\n",
+               test_part_result.failed() ? "*** Failure" : "Success",
+               results[i].ranks.HasSingleRank() ? "" : "s",
+               results[i].ranks.ToString().c_str(),
+               test_part_result.file_name() ? test_part_result.file_name()
+                                            : "unknown file",
+               test_part_result.line_number(),
+               test_part_result.summary());
+      }
+      if (!gathered.timings.empty()) {
+        const internal::TestTiming& timing = gathered.timings[t];
+        printf("      Time across ranks: %s\n",
+               timing.ToString(size).c_str());
+        if (internal::IsImbalanced(options, timing, size)) {
+          printf("      *** Load imbalance: slowest rank took %.2fx "
+                 "the mean time\n", timing.Imbalance(size));
+        }
+        internal::RecordTimingProperties(
+            options.DefersReporting() ? gathered.test_names[t] + "." : "",
+            timing, size);
+      }
+      if (!gathered.memory.empty()) {
+        const internal::TestMemory& memory = gathered.memory[t];
+        printf("      Peak memory growth: %s\n", memory.ToString().c_str());
+        internal::RecordMemoryProperties(
+            options.DefersReporting() ? gathered.test_names[t] + "." : "",
+            memory);
+      }
+      printf("*** Test %s ending.\n", gathered.test_names[t].c_str());
+    }
+  }
+};
+
+// Formatting policy of MPIWrapperPrinter: rank 0 forwards Google Test's
+// events to a wrapped listener, typically Google Test's own printer,
+// and adds the failures of other ranks to its own results, so that the
+// wrapped listener reports them too.
+class MPIWrapperFormat : public MPIPrinterFormat
+{
+ public:
+  // Use a pointer here instead of a reference because
+  // ::testing::TestEventListeners::Release returns a pointer
+  // (namely, one of type ::testing::TesteEventListener*).
+  explicit MPIWrapperFormat(::testing::TestEventListener *l) : listener(l) {}
+
+  static const bool kReportsIntoRunningTest = true;
+
+  // Rank 0 only reports failures, so there is no need to ship
+  // successful results from SUCCESS() anywhere
+  static bool Collects(const ::testing::TestPartResult& test_part_result)
+  {
+    return test_part_result.failed();
+  }
+
+  void OnTestProgramStart(const ::testing::UnitTest& unit_test)
+  {
+    listener->OnTestProgramStart(unit_test);
+  }
+
+  void OnTestIterationStart(const ::testing::UnitTest& unit_test,
+                            int iteration)
+  {
+    listener->OnTestIterationStart(unit_test, iteration);
+  }
+
+  void OnEnvironmentsSetUpStart(const ::testing::UnitTest& unit_test)
+  {
+    listener->OnEnvironmentsSetUpStart(unit_test);
+  }
+
+  void OnEnvironmentsSetUpEnd(const ::testing::UnitTest& unit_test)
+  {
+    listener->OnEnvironmentsSetUpEnd(unit_test);
+  }
+
+#ifndef GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+  void OnTestCaseStart(const ::testing::TestCase& test_case)
+  {
+    listener->OnTestCaseStart(test_case);
+  }
+
+  void OnTestCaseEnd(const ::testing::TestCase& test_case)
+  {
+    listener->OnTestCaseEnd(test_case);
+  }
+#endif // GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+
+  void OnTestStart(const ::testing::TestInfo& test_info,
+                   const MPIListenerOptions& /* options */)
+  {
+    listener->OnTestStart(test_info);
+  }
+
+  void OnTestPartResult(const ::testing::TestPartResult& test_part_result)
+  {
+    listener->OnTestPartResult(test_part_result);
+  }
+
+  void OnTestEnd(const ::testing::TestInfo& test_info)
+  {
+    listener->OnTestEnd(test_info);
+  }
+
+  void OnEnvironmentsTearDownStart(const ::testing::UnitTest& unit_test)
+  {
+    listener->OnEnvironmentsTearDownStart(unit_test);
+  }
+
+  void OnEnvironmentsTearDownEnd(const ::testing::UnitTest& unit_test)
+  {
+    listener->OnEnvironmentsTearDownEnd(unit_test);
+  }
+
+  // Google Test's summary only counts the tests whose own results
+  // failed on rank 0, so the tests that only failed through results
+  // reported after they ended, or left to the result writer, are listed
+  // after it
+  void OnTestIterationEnd(const ::testing::UnitTest& unit_test, int iteration)
+  {
+    listener->OnTestIterationEnd(unit_test, iteration);
+    if (late_failures.empty()) { return; }
+    printf("[  FAILED  ] %d test%s failed on other ranks, listed below:\n",
+           static_cast<int>(late_failures.size()),
+           late_failures.size() == 1 ? "" : "s");
+    for (size_t i = 0; i < late_failures.size(); i++) {
+      printf("[  FAILED  ] %s\n", late_failures[i].c_str());
+    }
+    late_failures.clear();
+    fflush(stdout);
+  }
+
+  void OnTestProgramEnd(const ::testing::UnitTest& unit_test)
+  {
+    listener->OnTestProgramEnd(unit_test);
+  }
+
+  // Reports gathered failures on rank 0 through ADD_FAILURE_AT, test by
+  // test, in rank order within each test. When reporting per test, the
+  // test is still running, so Google Test attributes each failure to
+  // it; otherwise, the failure message names the test it came from.
+  void ReportResults(const internal::ResultBatch& gathered,
+                     const std::vector<internal::RankResult>& results,
+                     const MPIListenerOptions& options, int size)
+  {
+    const bool writerOnly = options.result_writer
+                            && options.result_writer_only;
+    size_t i = 0;
+    for (int t = 0; t < gathered.test_count; t++) {
+      const std::string& test_name = gathered.test_names[t];
+      bool hasFailures = false;
+      for (; i < results.size() && results[i].test_index == t; i++) {
+        const ::testing::TestPartResult& test_part_result = results[i].result;
+        if (!test_part_result.failed()) { continue; }
+        hasFailures = true;
+        if (writerOnly) { continue; }
+        std::string message(test_part_result.message());
+        std::string rank_prefix(results[i].RankPrefix(size));
+        std::istringstream input_stream(message);
+        std::stringstream to_stream_into_failure;
+        std::string line_as_string;
+        if (options.DefersReporting())
+        {
+            to_stream_into_failure << rank_prefix << " In test "
+                                   << test_name << ":" << std::endl;
+        }
+        while (std::getline(input_stream, line_as_string))
+        {
+            to_stream_into_failure << rank_prefix << " "
+                                   << line_as_string << std::endl;
+        }
+
+        ADD_FAILURE_AT(test_part_result.file_name(),
+                       test_part_result.line_number()) <<
+            to_stream_into_failure.str();
+      }
+
+      // Failures added after their test ended go to the enclosing test
+      // suite or program, and those left to the writer are not added at
+      // all, so Google Test does not count the test itself as failed
+      // unless it also failed on rank 0
+      if (hasFailures && (options.DefersReporting() || writerOnly)
+          && !internal::FailedOnThisRank(test_name)
+          && std::find(late_failures.begin(), late_failures.end(),
+                       test_name) == late_failures.end()) {
+        late_failures.push_back(test_name);
+      }
+
+      // Rank 0 only ran some of the scheduled tests, so Google Test's
+      // own output does not account for the others
+      const internal::TestSchedule& schedule = internal::CurrentSchedule();
+      if (schedule.IsActive()) {
+        printf("[ SCHEDULE ] %s on rank%s %s: %s\n", test_name.c_str(),
+               schedule.test_ranks[t].HasSingleRank() ? "" : "s",
+               schedule.test_ranks[t].ToString().c_str(),
+               hasFailures ? "FAILED" : "OK");
+      }
+
+      if (!gathered.timings.empty()) {
+        const internal::TestTiming& timing = gathered.timings[t];
+        printf("[ MPI TIME ] %s: %s\n",
+               test_name.c_str(), timing.ToString(size).c_str());
+        if (internal::IsImbalanced(options, timing, size)) {
+          printf("[ MPI TIME ] *** Load imbalance in %s: slowest rank took "
+                 "%.2fx the mean time\n",
+                 test_name.c_str(), timing.Imbalance(size));
+        }
+        internal::RecordTimingProperties(
+            options.DefersReporting() ? test_name + "." : "", timing, size);
+      }
+
+      if (!gathered.memory.empty()) {
+        const internal::TestMemory& memory = gathered.memory[t];
+        printf("[ MPI MEM  ] %s: peak memory growth %s\n",
+               test_name.c_str(), memory.ToString().c_str());
+        internal::RecordMemoryProperties(
+            options.DefersReporting() ? test_name + "." : "", memory);
+      }
+    }
+  }
+
+ private:
+  ::testing::TestEventListener *listener;
+  // Tests of the running iteration that failed on other ranks only,
+  // and whose failures were reported after they ended or left to the
+  // result writer
+  std::vector<std::string> late_failures;
+};
+
+// This class listens to Google Test's events on every rank and gathers
+// all results onto rank zero, which reports them through its Format
+// policy (see MPIPrinterFormat). MPIListenerOptions chooses how results
+// travel to rank 0 at run time; the Features policy (see MPIAllFeatures)
+// chooses at compile time which optional features the printer serves.
+// The printer only calls its policies directly, never through virtual
+// functions, so it pays only for what they do.
+template <class Format, class Features = MPIAllFeatures>
+class MPIPrinter : public ::testing::TestEventListener
+{
+ public:
+  MPIPrinter() : ::testing::TestEventListener(), format(), records(),
+    options(internal::FeatureOptions<Features>(MPIListenerOptions())),
+    stopped(false), iteration(0), iteration_running(false), flaky_tests()
+  {
+    Init(MPI_COMM_WORLD);
+  }
+
+  MPIPrinter(MPI_Comm comm_,
+             const MPIListenerOptions& options_ = MPIListenerOptions())
+    : ::testing::TestEventListener(), format(), records(),
+      options(internal::FeatureOptions<Features>(options_)),
+      stopped(false), iteration(0), iteration_running(false), flaky_tests()
+  {
+    Init(comm_);
+  }
+
+  // For formatting policies that wrap another listener, l
+  MPIPrinter(::testing::TestEventListener *l, MPI_Comm comm_,
+             const MPIListenerOptions& options_ = MPIListenerOptions())
+    : ::testing::TestEventListener(), format(l), records(),
+      options(internal::FeatureOptions<Features>(options_)),
+      stopped(false), iteration(0), iteration_running(false), flaky_tests()
+  {
+    Init(comm_);
+  }
+
+  MPIPrinter(const MPIPrinter& printer)
+    : ::testing::TestEventListener(), format(printer.format),
+      records(printer.records), options(printer.options),
+      stopped(printer.stopped), iteration(printer.iteration),
+      iteration_running(false), flaky_tests(printer.flaky_tests)
+  {
+    Init(printer.comm);
+  }
+
+  // Called before test activity starts
+  virtual void OnTestProgramStart(const ::testing::UnitTest& unit_test)
+  {
+    if (rank == 0) { format.OnTestProgramStart(unit_test); }
+  }
+
+  // Called before each test iteration starts, where iteration is
+  // the iterate index. There could be more than one iteration if
+  // GTEST_FLAG(repeat) is used.
+  virtual void OnTestIterationStart(const ::testing::UnitTest& unit_test,
+                                    int iteration_)
+  {
+    iteration = iteration_;
+    iteration_running = true;
+    if (Features::kFlakyTests && options.report_flaky_tests) {
+      flaky_tests.Start(unit_test);
+    }
+    if (rank == 0) { format.OnTestIterationStart(unit_test, iteration); }
+  }
+
+  // Called before environment setup before start of each test iteration
+  virtual void OnEnvironmentsSetUpStart(const ::testing::UnitTest& unit_test)
+  {
+    if (rank == 0) { format.OnEnvironmentsSetUpStart(unit_test); }
+  }
+
+  virtual void OnEnvironmentsSetUpEnd(const ::testing::UnitTest& unit_test)
+  {
+    if (rank == 0) { format.OnEnvironmentsSetUpEnd(unit_test); }
+  }
+
+#ifndef GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+  virtual void OnTestCaseStart(const ::testing::TestCase& test_case)
+  {
+    if (rank == 0) { format.OnTestCaseStart(test_case); }
+  }
+#endif // GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+
+  // Called before a test starts.
+  virtual void OnTestStart(const ::testing::TestInfo& test_info)
+  {
+    if (rank == 0) { format.OnTestStart(test_info, options); }
+    test_start_time = MPI_Wtime();
+    if (Features::kMemory && options.SamplesMemory()) {
+      memory_tracker.Start();
+    }
+    if (Features::kFailFast && stopped) {
+      internal::SkipAfterFailure(test_info);
+    }
+  }
+
+  // Called after an assertion failure or an explicit SUCCESS() macro.
+  // In an MPI program, this means that certain ranks may not call this
+  // function if a test part does not fail on all ranks. Consequently, it
+  // is difficult to have explicit synchronization points here.
+  virtual void OnTestPartResult
+    (const ::testing::TestPartResult& test_part_result)
+  {
+    if (internal::SkippedForAnotherRank()
+        || internal::SkippingAfterFailure()) { return; }
+    // A result writer also needs to know which tests were skipped
+    if (Format::Collects(test_part_result)
+        || (options.result_writer && internal::IsSkip(test_part_result))) {
+      records.Add(rank, test_part_result);
+    }
+    if (rank == 0) { format.OnTestPartResult(test_part_result); }
+  }
+
+  // Called after a test ends.
+  virtual void OnTestEnd(const ::testing::TestInfo& test_info)
+  {
+    const int testIndex = internal::AddTestToBatch(test_info, rank, batch);
+    if ((Features::kTiming && options.report_timing)
+        || options.result_writer) {
+      batch.test_times.push_back(MPI_Wtime() - test_start_time);
+    }
+    if (Features::kFailFast && options.fail_fast && options.result_writer
+        && rank == 0) {
+      batch.test_skipped.push_back(stopped ? 1 : 0);
+    }
+    if (Features::kMemory) {
+      internal::EndMemorySample(options, test_info, rank, memory_tracker,
+                                batch);
+    }
+    // Including any memory budget failure, but not the failures of
+    // other ranks reported into a dealt test
+    const bool failed = test_info.result()->Failed();
+    records.AppendTo(batch.buffer, testIndex);
+    if (ReportsDealtTests()) { SendDealtResults(); }
+    records.Reset();
+    if (ReportsDealtTests()) { ReportDealtResults(test_info); }
+    if (Features::kFlakyTests && options.report_flaky_tests) {
+      flaky_tests.Record(test_info, failed);
+    }
+
+    if (options.reporting == kReportPerTest) { ReportBatch(); }
+    if (rank == 0) { format.OnTestEnd(test_info); }
+    if (Features::kFailFast) { StopAfterFailure(test_info, failed); }
+    internal::NotifyCollectionEnd();
+  }
+
+#ifndef GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+  virtual void OnTestCaseEnd(const ::testing::TestCase& test_case)
+  {
+    if (options.reporting == kReportPerTestSuite) { ReportBatch(); }
+    ReportDeferredResults();
+    internal::NotifyCollectionEnd();
+    if (rank == 0) { format.OnTestCaseEnd(test_case); }
+  }
+#else
+  virtual void OnTestSuiteEnd(const ::testing::TestSuite& /* test_suite */)
+  {
+    if (options.reporting == kReportPerTestSuite) { ReportBatch(); }
+    ReportDeferredResults();
+    internal::NotifyCollectionEnd();
+  }
+#endif // GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+
+  // Called before the Environment is torn down, which is the last point
+  // at which MPI is usable, because MPIEnvironment finalizes MPI.
+  virtual void OnEnvironmentsTearDownStart(const ::testing::UnitTest& unit_test)
+  {
+    int is_mpi_finalized;
+    assert(MPI_Finalized(&is_mpi_finalized) == MPI_SUCCESS);
+    if (!is_mpi_finalized) {
+      EndIteration();
+      if (internal::IsLastIteration(iteration)) {
+        if (Features::kFlakyTests && options.report_flaky_tests) {
+          flaky_tests.Report(comm, rank, size);
+        }
+        if (options.result_writer && rank == 0) {
+          options.result_writer->Close();
+        }
+        if (options.gatherer) { options.gatherer->Free(); }
+        internal::FreeListenerComm(&node_comm);
+        internal::FreeListenerComm(&comm);
+      }
+    }
+    if (rank == 0) { format.OnEnvironmentsTearDownStart(unit_test); }
+  }
+
+  virtual void OnEnvironmentsTearDownEnd(const ::testing::UnitTest& unit_test)
+  {
+    if (rank == 0) { format.OnEnvironmentsTearDownEnd(unit_test); }
+  }
+
+  // Unless environments were torn down first, the iteration's results
+  // are still to be collected
+  virtual void OnTestIterationEnd(const ::testing::UnitTest& unit_test,
+                                  int iteration_)
+  {
+    int is_mpi_finalized;
+    assert(MPI_Finalized(&is_mpi_finalized) == MPI_SUCCESS);
+    if (!is_mpi_finalized) { EndIteration(); }
+    if (rank == 0) { format.OnTestIterationEnd(unit_test, iteration_); }
+  }
+
+  // Called when test driver program ends
+  virtual void OnTestProgramEnd(const ::testing::UnitTest& unit_test)
+  {
+    if (rank == 0) { format.OnTestProgramEnd(unit_test); }
+  }
+
+ private:
+  Format format;
+  MPI_Comm comm;
+  MPI_Comm node_comm;
+  int rank;
+  int size;
+  internal::ResultRecords records;
+  MPIListenerOptions options;
+  internal::ResultBatch batch;
+  internal::PipelinedCollector pipeline;
+  std::vector<internal::ResultBatch> deferred_batches;
+  double test_start_time;
+  internal::MemoryTracker memory_tracker;
+  // Whether the remaining tests are skipped (see options.fail_fast)
+  bool stopped;
+  // The iteration of --gtest_repeat running, and whether its results
+  // are still to be collected
+  int iteration;
+  bool iteration_running;
+  internal::FlakyTestTracker flaky_tests;
+  // On rank 0, the results of dealt serial tests that arrived before
+  // rank 0 reached the test, by number, and the tests whose results it
+  // has already reported into the running test
+  std::map<int, std::vector<char> > early_dealt_results;
+  std::set<std::string> reported_dealt_tests;
+
+  // Sets up the printer's own duplicate of comm_
+  void Init(MPI_Comm comm_)
+  {
+    int is_mpi_initialized;
+    assert(MPI_Initialized(&is_mpi_initialized) == MPI_SUCCESS);
+    if (!is_mpi_initialized) {
+      printf("MPI must be initialized before RUN_ALL_TESTS!\n");
+      printf("Add '::testing::InitGoogleTest(&argc, argv);\n");
+      printf("     MPI_Init(&argc, &argv);' to your 'main' function!\n");
+      assert(0);
+    }
+
+    internal::DupListenerComm(comm_, &comm);
+    UpdateCommState();
+    internal::SplitByNode(comm, options, &node_comm);
+  }
+
+  int UpdateCommState()
+  {
+    int flag = MPI_Comm_rank(comm, &rank);
+    if (flag != MPI_SUCCESS) { return flag; }
+    flag = MPI_Comm_size(comm, &size);
+    return flag;
+  }
+
+  // Under options.fail_fast, agrees with the other ranks whether any
+  // of them failed test_info, which just ended, and if so stops;
+  // failed tells whether this rank did, before any failures of other
+  // ranks were reported into the test
+  void StopAfterFailure(const ::testing::TestInfo& test_info, bool failed)
+  {
+    if (!options.fail_fast || stopped) { return; }
+    const int firstRank = internal::FirstFailingRank(comm, rank, size,
+                                                     failed);
+    stopped = (firstRank < size);
+    if (stopped && rank == 0) {
+      printf("*** Test %s failed on rank %d; skipping the remaining tests.\n",
+             internal::FullTestName(test_info).c_str(), firstRank);
+    }
+  }
+
+  // Collects whatever the iteration that just ended has not reported
+  // yet, once, whether environments are torn down first or not
+  void EndIteration()
+  {
+    if (!iteration_running) { return; }
+    iteration_running = false;
+    internal::NotifyCollectionStart();
+    ReportBatch();
+    internal::ResultBatch gathered;
+    if (internal::DrainBatches<Features>(comm, rank, size, options,
+                                         pipeline, gathered)) {
+      ReportOrDeferResults(gathered);
+    }
+    ReportDeferredResults();
+    if (Features::kFlakyTests && options.report_flaky_tests) {
+      flaky_tests.EndIteration(comm);
+    }
+    internal::NotifyCollectionEnd();
+  }
+
+  // Collects the results of every test in the batch onto rank 0
+  void ReportBatch()
+  {
+    internal::AddScheduleToBatch(rank, batch);
+    if (batch.test_count == 0) { return; }
+
+    internal::ResultBatch gathered;
+    if (internal::CollectBatch<Features>(comm, node_comm, rank, size,
+                                         options, pipeline, batch,
+                                         gathered)) {
+      ReportOrDeferResults(gathered);
+    }
+  }
+
+  // A failure added while a test runs is attributed to that test, so
+  // when the format adds results to the running test, results from tests
+  // that have already ended are held back until no test is running.
+  void ReportOrDeferResults(const internal::ResultBatch& gathered)
+  {
+    if (Format::kReportsIntoRunningTest && options.DefersReporting()
+        && ::testing::UnitTest::GetInstance()->current_test_info()) {
+      deferred_batches.push_back(gathered);
+    } else {
+      ReportResults(gathered);
+    }
+  }
+
+  void ReportDeferredResults()
+  {
+    for (size_t i = 0; i < deferred_batches.size(); i++) {
+      ReportResults(deferred_batches[i]);
+    }
+    deferred_batches.clear();
+  }
+
+  // A serial test dealt to another rank is skipped on rank 0, so when
+  // the format adds results to the running test but reporting is
+  // deferred, rank 0 would show it as skipped even if it failed.
+  // Instead, the rank that runs it also sends its results straight to
+  // rank 0, which waits for them when the test ends there. The other
+  // ranks do not wait for each other.
+  bool ReportsDealtTests() const
+  {
+    return Format::kReportsIntoRunningTest && options.DefersReporting()
+        && internal::CurrentDealtTest().number >= 0
+        && !internal::CurrentSchedule().IsActive();
+  }
+
+  // On the rank that ran the dealt serial test that just ended, other
+  // than rank 0, sends its results to rank 0
+  void SendDealtResults()
+  {
+    const internal::DealtTest& dealt = internal::CurrentDealtTest();
+    if (!dealt.here || rank == 0) { return; }
+    std::vector<char> message;
+    internal::PackInt(message, dealt.number);
+    records.AppendTo(message, 0);
+    MPI_Send(&message[0], static_cast<int>(message.size()), MPI_BYTE, 0,
+             internal::kDealtResultTag, comm);
+  }
+
+  // On rank 0, if another rank ran test_info, a dealt serial test that
+  // just ended, waits for its results and reports them into the test
+  void ReportDealtResults(const ::testing::TestInfo& test_info)
+  {
+    const internal::DealtTest& dealt = internal::CurrentDealtTest();
+    if (dealt.here || rank != 0) { return; }
+    while (early_dealt_results.find(dealt.number)
+           == early_dealt_results.end()) {
+      MPI_Status status;
+      MPI_Probe(MPI_ANY_SOURCE, internal::kDealtResultTag, comm, &status);
+      int messageSize;
+      MPI_Get_count(&status, MPI_BYTE, &messageSize);
+      std::vector<char> message(messageSize);
+      MPI_Recv(&message[0], messageSize, MPI_BYTE, status.MPI_SOURCE,
+               internal::kDealtResultTag, comm, MPI_STATUS_IGNORE);
+      const char *cursor = &message[0];
+      const int number = internal::UnpackInt(cursor);
+      early_dealt_results[number].assign(message.begin() + sizeof(int),
+                                         message.end());
+    }
+    std::vector<char> buffer;
+    buffer.swap(early_dealt_results[dealt.number]);
+    early_dealt_results.erase(dealt.number);
+    if (buffer.empty()) { return; }
+
+    internal::ResultBatch dealtBatch;
+    dealtBatch.test_names.push_back(internal::FullTestName(test_info));
+    dealtBatch.test_count = 1;
+    std::vector<internal::RankResult> results;
+    internal::UnpackResults(buffer, results);
+    MPIListenerOptions perTest(options);
+    perTest.reporting = kReportPerTest;
+    format.ReportResults(dealtBatch, results, perTest, size);
+    records.Reset();
+    reported_dealt_tests.insert(dealtBatch.test_names[0]);
+  }
+
+  // Hands gathered results to the format on rank 0, test by test, in
+  // rank order within each test, leaving out those of dealt serial tests
+  // already reported
+  void ReportResults(const internal::ResultBatch& gathered)
+  {
+    std::vector<internal::RankResult> results;
+    internal::UnpackResults(gathered.buffer, results);
+    std::stable_sort(results.begin(), results.end());
+    internal::WriteResults(options, size, gathered, results);
+    if (!reported_dealt_tests.empty()) {
+      std::vector<internal::RankResult> unreported;
+      for (size_t i = 0; i < results.size(); i++) {
+        if (reported_dealt_tests.count(
+                gathered.test_names[results[i].test_index]) == 0) {
+          unreported.push_back(results[i]);
+        }
+      }
+      for (int t = 0; t < gathered.test_count; t++) {
+        reported_dealt_tests.erase(gathered.test_names[t]);
+      }
+      results.swap(unreported);
+    }
+    format.ReportResults(gathered, results, options, size);
+
+    // A format that reports through ADD_FAILURE_AT calls
+    // OnTestPartResult, which appends to records; those results are not
+    // meant to be reported again
+    records.Reset();
+  }
+
+}; // class MPIPrinter
+
+// Google Test's MinimalistPrinter example, wrapped in MPI calls
+typedef MPIPrinter<MPIMinimalistFormat> MPIMinimalistPrinter;
+
+// Wraps another listener, typically Google Test's default printer, and
+// reports the failures of every rank through it on rank 0
+typedef MPIPrinter<MPIWrapperFormat> MPIWrapperPrinter;
 
 } // namespace GTestMPIListener
 
@@ -0,0 +1,295 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+*******************************************************************************/
+
+// This header holds a listener that never communicates while tests
+// run: each rank appends its own results to a binary log file of its
+// own, and the gtest-mpi-log-merge tool merges the logs of all ranks
+// into one report after the job. It only depends on MPI-1, but is kept
+// apart from gtest-mpi-listener.hpp because the merge tool reads the
+// logs with the functions below.
+
+#ifndef GTEST_MPI_LOG_LISTENER_H
+#define GTEST_MPI_LOG_LISTENER_H
+
+#include "gtest-mpi-listener.hpp"
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace GTestMPIListener
+{
+
+// Status of a test on one rank, as recorded in a rank log
+enum LoggedTestStatus
+{
+  kLoggedTestPassed = 0,
+  kLoggedTestFailed = 1,
+  kLoggedTestSkipped = 2
+};
+
+namespace internal
+{
+
+// A rank log starts with an eight-character magic string and two ints,
+// the writing rank and the size of its communicator. Then follows one
+// record per test, in the order the rank ran them: five ints (iteration,
+// position of the test in the test program, LoggedTestStatus, name
+// size, size of the results), the test's wall-clock time as a double,
+// the full name of the test, and the test's part results in the wire
+// format used to send results to rank 0, with the test's position as
+// their test index. Like that wire format, logs are only meant to be
+// read on machines sharing the int and double representation of the
+// machine that wrote them.
+const char kRankLogMagic[] = "GTMPILG1";
+const size_t kRankLogMagicSize = 8;
+
+inline void PackDouble(std::vector<char>& buffer, double value)
+{
+  const size_t offset = buffer.size();
+  buffer.resize(offset + sizeof(double));
+  std::memcpy(&buffer[offset], &value, sizeof(double));
+}
+
+inline double UnpackDouble(const char *&cursor)
+{
+  double value;
+  std::memcpy(&value, cursor, sizeof(double));
+  cursor += sizeof(double);
+  return value;
+}
+
+// One test's record, as read back from a rank log
+struct LoggedTest
+{
+  LoggedTest() : iteration(0), position(0), status(kLoggedTestPassed),
+                 seconds(0.0), name(), results() {}
+
+  int iteration;
+  int position;
+  int status;
+  double seconds;
+  std::string name;
+  std::vector<char> results;
+};
+
+// A whole rank log, as read back by ReadRankLog
+struct RankLog
+{
+  RankLog() : rank(0), size(0), tests() {}
+
+  int rank;
+  int size;
+  std::vector<LoggedTest> tests;
+};
+
+// Reads the rank log at path into log. Returns false, after printing
+// why, if the file cannot be read or is not a rank log; a log cut short
+// by a crash yields the tests that were completely written.
+inline bool ReadRankLog(const std::string& path, RankLog& log)
+{
+  FILE *file = std::fopen(path.c_str(), "rb");
+  if (!file) {
+    printf("Could not open '%s'!\n", path.c_str());
+    return false;
+  }
+  std::vector<char> contents;
+  char chunk[65536];
+  size_t count;
+  while ((count = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    contents.insert(contents.end(), chunk, chunk + count);
+  }
+  std::fclose(file);
+
+  const size_t headerSize = kRankLogMagicSize + 2 * sizeof(int);
+  if (contents.size() < headerSize
+      || std::memcmp(&contents[0], kRankLogMagic, kRankLogMagicSize) != 0) {
+    printf("'%s' is not a rank log!\n", path.c_str());
+    return false;
+  }
+  const char *cursor = &contents[0] + kRankLogMagicSize;
+  const char *end = &contents[0] + contents.size();
+  log.rank = UnpackInt(cursor);
+  log.size = UnpackInt(cursor);
+
+  const size_t recordHeaderSize = 5 * sizeof(int) + sizeof(double);
+  while (static_cast<size_t>(end - cursor) >= recordHeaderSize) {
+    LoggedTest test;
+    test.iteration = UnpackInt(cursor);
+    test.position = UnpackInt(cursor);
+    test.status = UnpackInt(cursor);
+    const int nameSize = UnpackInt(cursor);
+    const int resultsSize = UnpackInt(cursor);
+    test.seconds = UnpackDouble(cursor);
+    if (static_cast<size_t>(end - cursor)
+        < static_cast<size_t>(nameSize) + resultsSize) {
+      break;
+    }
+    test.name.assign(cursor, nameSize);
+    cursor += nameSize;
+    test.results.assign(cursor, cursor + resultsSize);
+    cursor += resultsSize;
+    log.tests.push_back(test);
+  }
+  return true;
+}
+
+} // namespace internal
+
+// This class writes each rank's results to a log file of its own,
+// named <directory>/<prefix>.<rank>.gtestlog, so that reporting takes
+// no communication at all and no rank ever waits on another. Each test
+// is written with one fwrite and flushed, so that the logs show how far
+// every rank got even if the job is killed. Point directory at
+// node-local scratch to keep the writes off the parallel file system,
+// and copy the logs out before the job ends; then run
+// gtest-mpi-log-merge on them to get a console, JUnit XML, or JSON
+// report.
+class MPIRankLogPrinter : public ::testing::EmptyTestEventListener
+{
+ public:
+  MPIRankLogPrinter(const std::string& directory = ".",
+                    MPI_Comm comm = MPI_COMM_WORLD,
+                    const std::string& prefix = "gtest-mpi")
+      : ::testing::EmptyTestEventListener(), file(NULL), file_name(),
+        records(), record(), positions(), iteration(0), test_start_time(0.0)
+  {
+    int is_mpi_initialized;
+    assert(MPI_Initialized(&is_mpi_initialized) == MPI_SUCCESS);
+    if (!is_mpi_initialized) {
+      printf("MPI must be initialized before RUN_ALL_TESTS!\n");
+      printf("Add '::testing::InitGoogleTest(&argc, argv);\n");
+      printf("     MPI_Init(&argc, &argv);' to your 'main' function!\n");
+      assert(0);
+    }
+
+    int size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    std::stringstream name;
+    name << directory << "/" << prefix << "." << rank << ".gtestlog";
+    file_name = name.str();
+    file = std::fopen(file_name.c_str(), "wb");
+    if (!file) {
+      printf("Could not open '%s' for test output on rank %d!\n",
+             file_name.c_str(), rank);
+      assert(0);
+    }
+
+    std::vector<char> header(internal::kRankLogMagic,
+                             internal::kRankLogMagic
+                             + internal::kRankLogMagicSize);
+    internal::PackInt(header, rank);
+    internal::PackInt(header, size);
+    std::fwrite(&header[0], 1, header.size(), file);
+  }
+
+  virtual ~MPIRankLogPrinter() { Close(); }
+
+  // Numbers the tests by their position in the test program, so that
+  // the merge tool can put them back in order even if ranks ran
+  // different tests.
+  virtual void OnTestIterationStart(const ::testing::UnitTest& unit_test,
+                                    int iteration_) {
+    iteration = iteration_;
+    positions.clear();
+#ifndef GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+    for (int i = 0; i < unit_test.total_test_case_count(); i++) {
+      const ::testing::TestCase& test_suite = *unit_test.GetTestCase(i);
+#else
+    for (int i = 0; i < unit_test.total_test_suite_count(); i++) {
+      const ::testing::TestSuite& test_suite = *unit_test.GetTestSuite(i);
+#endif // GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+      for (int j = 0; j < test_suite.total_test_count(); j++) {
+        const int position = static_cast<int>(positions.size());
+        positions[internal::FullTestName(*test_suite.GetTestInfo(j))] =
+            position;
+      }
+    }
+    if (rank == 0 && iteration == 0) {
+      printf("Writing test results to rank logs like '%s'.\n",
+             file_name.c_str());
+    }
+  }
+
+  // Called before a test starts.
+  virtual void OnTestStart(const ::testing::TestInfo& /* test_info */) {
+    test_start_time = MPI_Wtime();
+  }
+
+  // Called after an assertion failure or an explicit SUCCESS() macro.
+  virtual void OnTestPartResult
+    (const ::testing::TestPartResult& test_part_result) {
+    if (internal::SkippedForAnotherRank()) { return; }
+    records.Add(rank, test_part_result);
+  }
+
+  // Called after a test ends; appends the test's record to the log.
+  virtual void OnTestEnd(const ::testing::TestInfo& test_info) {
+    const double seconds = MPI_Wtime() - test_start_time;
+    const std::string name(internal::FullTestName(test_info));
+    const int position = positions[name];
+    int status = test_info.result()->Failed() ? kLoggedTestFailed
+                                              : kLoggedTestPassed;
+#ifdef GTEST_SKIP
+    if (test_info.result()->Skipped()) { status = kLoggedTestSkipped; }
+#endif // GTEST_SKIP
+
+    // The size of the results is filled in once they are appended
+    record.clear();
+    internal::PackInt(record, iteration);
+    internal::PackInt(record, position);
+    internal::PackInt(record, status);
+    internal::PackInt(record, static_cast<int>(name.size()));
+    internal::PackInt(record, 0);
+    internal::PackDouble(record, seconds);
+    record.insert(record.end(), name.begin(), name.end());
+    const size_t resultsStart = record.size();
+    records.AppendTo(record, position);
+    records.Reset();
+    const int resultsSize = static_cast<int>(record.size() - resultsStart);
+    std::memcpy(&record[4 * sizeof(int)], &resultsSize, sizeof(int));
+    std::fwrite(&record[0], 1, record.size(), file);
+    std::fflush(file);
+  }
+
+  // Called after all test activities have ended.
+  virtual void OnTestProgramEnd(const ::testing::UnitTest& /* unit_test */) {
+    Close();
+  }
+
+ private:
+  FILE *file;
+  std::string file_name;
+  int rank;
+  internal::ResultRecords records;
+  std::vector<char> record;
+  std::map<std::string, int> positions;
+  int iteration;
+  double test_start_time;
+
+  // Disallow copying; each rank writes one log
+  MPIRankLogPrinter(const MPIRankLogPrinter& printer);
+
+  void Close()
+  {
+    if (file) {
+      std::fclose(file);
+      file = NULL;
+    }
+  }
+
+}; // class MPIRankLogPrinter
+
+} // namespace GTestMPIListener
+
+#endif /* GTEST_MPI_LOG_LISTENER_H */
@@ -0,0 +1,1299 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+*******************************************************************************/
+
+// This header holds a listener that profiles the MPI traffic of each
+// test through the MPI profiling interface (PMPI). It intercepts
+// one-sided calls, so it requires MPI-2, and it is kept apart from
+// gtest-mpi-listener.hpp so that the latter only depends on MPI-1.
+//
+// The intercepting MPI_* functions may only be defined once per
+// program, so exactly one source file must define
+// GTEST_MPI_PROFILER_DEFINE_WRAPPERS before including this header:
+//
+//   #define GTEST_MPI_PROFILER_DEFINE_WRAPPERS
+//   #include "gtest-mpi-profiler.hpp"
+//
+// Without the wrappers, the profiler reports no traffic.
+
+#ifndef GTEST_MPI_PROFILER_H
+#define GTEST_MPI_PROFILER_H
+
+#include "gtest-mpi-listener.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <string>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+// MPI-3 declares send buffers and count arrays const
+#if MPI_VERSION >= 3
+#define GTEST_MPI_PROFILER_CONST const
+#else
+#define GTEST_MPI_PROFILER_CONST
+#endif
+
+namespace GTestMPIListener
+{
+
+// The kinds of MPI calls the profiler tells apart. Nonblocking
+// collectives count as collective, and request-based one-sided calls
+// (e.g., MPI_Rput) as one-sided; completion calls on requests (MPI_Wait,
+// MPI_Test, and their variants) count as point-to-point.
+enum MPITrafficCategory
+{
+  kPointToPointTraffic,
+  kCollectiveTraffic,
+  kOneSidedTraffic,
+  kNumTrafficCategories
+};
+
+// Calls made, bytes sent, and seconds spent in MPI by one rank in one
+// category. Bytes count the data a rank hands to MPI for sending (or,
+// for MPI_Get, fetching), as count times the size of the datatype.
+// Counts are doubles so that they can be reduced as MPI_DOUBLE.
+struct MPITrafficCounts
+{
+  double calls;
+  double bytes;
+  double seconds;
+};
+
+struct MPITraffic
+{
+  MPITraffic() { Clear(); }
+
+  void Clear()
+  {
+    for (int c = 0; c < kNumTrafficCategories; c++) {
+      counts[c].calls = counts[c].bytes = counts[c].seconds = 0.0;
+    }
+  }
+
+  MPITrafficCounts counts[kNumTrafficCategories];
+};
+
+namespace internal
+{
+
+// The profile of the running test on this rank. The counters are not
+// synchronized, so tests that make MPI calls from several threads at
+// once get approximate counts.
+struct TrafficProfile
+{
+  TrafficProfile() : active(false), traffic() {}
+
+  bool active;
+  MPITraffic traffic;
+};
+
+inline TrafficProfile& CurrentTrafficProfile()
+{
+  static TrafficProfile profile;
+  return profile;
+}
+
+inline const char *TrafficCategoryName(int category)
+{
+  static const char *names[kNumTrafficCategories] =
+      { "point-to-point", "collective", "one-sided" };
+  return names[category];
+}
+
+// Short names for XML/JSON property keys
+inline const char *TrafficCategoryKey(int category)
+{
+  static const char *keys[kNumTrafficCategories] = { "p2p", "coll", "rma" };
+  return keys[category];
+}
+
+inline double DatatypeBytes(double count, MPI_Datatype datatype)
+{
+  int typeSize = 0;
+  PMPI_Type_size(datatype, &typeSize);
+  return count * typeSize;
+}
+
+// Whether this rank is root of a rooted collective on comm
+inline bool IsRoot(int root, MPI_Comm comm)
+{
+  int rank;
+  PMPI_Comm_rank(comm, &rank);
+  return rank == root;
+}
+
+inline int CommSize(MPI_Comm comm)
+{
+  int size;
+  PMPI_Comm_size(comm, &size);
+  return size;
+}
+
+// Sums the count per rank of comm in counts, as passed to vector
+// collectives, when a test is running
+inline double SumCounts(const int *counts, MPI_Comm comm)
+{
+  if (!CurrentTrafficProfile().active || IsListenerComm(comm)) { return 0.0; }
+  double sum = 0.0;
+  const int size = CommSize(comm);
+  for (int r = 0; r < size; r++) { sum += counts[r]; }
+  return sum;
+}
+
+// One-sided and completion calls name a window or requests rather than
+// a communicator, so the windows created over listeners' communicators,
+// and the requests started on them, are tracked until they are freed or
+// completed, whether or not a test is running.
+inline std::vector<MPI_Win>& ListenerWindows()
+{
+  static std::vector<MPI_Win> windows;
+  return windows;
+}
+
+inline bool IsListenerWindow(MPI_Win win)
+{
+  const std::vector<MPI_Win>& windows = ListenerWindows();
+  return std::find(windows.begin(), windows.end(), win) != windows.end();
+}
+
+// Call after creating win over comm
+inline void TrackWindow(MPI_Comm comm, MPI_Win win)
+{
+  if (IsListenerComm(comm)) { ListenerWindows().push_back(win); }
+}
+
+// Call before freeing win
+inline void UntrackWindow(MPI_Win win)
+{
+  std::vector<MPI_Win>& windows = ListenerWindows();
+  windows.erase(std::remove(windows.begin(), windows.end(), win),
+                windows.end());
+}
+
+inline std::vector<MPI_Request>& ListenerRequests()
+{
+  static std::vector<MPI_Request> requests;
+  return requests;
+}
+
+// Call after starting request on a listener's communicator or window
+inline void TrackRequest(bool listener, MPI_Request request)
+{
+  if (listener && request != MPI_REQUEST_NULL) {
+    ListenerRequests().push_back(request);
+  }
+}
+
+// Completion of count requests: built before the completion call, it
+// tells whether the call only completes listeners' requests, and after
+// the call, Untrack forgets those of them that completed, since MPI may
+// hand their handles out again.
+class RequestCompletion
+{
+ public:
+  RequestCompletion(int count, const MPI_Request *requests)
+      : listener_indices(), listener_only(false)
+  {
+    const std::vector<MPI_Request>& tracked = ListenerRequests();
+    if (tracked.empty()) { return; }
+    int active = 0;
+    for (int i = 0; i < count; i++) {
+      if (requests[i] == MPI_REQUEST_NULL) { continue; }
+      active++;
+      if (std::find(tracked.begin(), tracked.end(), requests[i])
+          != tracked.end()) {
+        listener_indices.push_back(std::make_pair(i, requests[i]));
+      }
+    }
+    listener_only = (active > 0)
+        && (static_cast<int>(listener_indices.size()) == active);
+  }
+
+  bool ListenerOnly() const { return listener_only; }
+
+  void Untrack(const MPI_Request *requests) const
+  {
+    std::vector<MPI_Request>& tracked = ListenerRequests();
+    for (size_t i = 0; i < listener_indices.size(); i++) {
+      if (requests[listener_indices[i].first] != MPI_REQUEST_NULL) {
+        continue;
+      }
+      tracked.erase(std::find(tracked.begin(), tracked.end(),
+                              listener_indices[i].second));
+    }
+  }
+
+ private:
+  std::vector< std::pair<int, MPI_Request> > listener_indices;
+  bool listener_only;
+};
+
+// Times one intercepted call and adds it to the current profile, unless
+// no test is running or the call is a listener's own traffic. The
+// wrappers construct one of these before calling into PMPI.
+class ProfiledCall
+{
+ public:
+  ProfiledCall(MPITrafficCategory category_, MPI_Comm comm, double count,
+               MPI_Datatype datatype) :
+      category(category_),
+      counted(CurrentTrafficProfile().active && !IsListenerComm(comm)),
+      bytes((counted && count > 0) ? DatatypeBytes(count, datatype) : 0.0),
+      start(counted ? PMPI_Wtime() : 0.0) {}
+
+  // For calls naming no communicator, such as calls on a window; some
+  // MPI implementations define MPI_Comm and MPI_Win as the same type, so
+  // callers say whether the call is a listener's instead
+  ProfiledCall(MPITrafficCategory category_, bool listener, double count,
+               MPI_Datatype datatype) :
+      category(category_),
+      counted(CurrentTrafficProfile().active && !listener),
+      bytes((counted && count > 0) ? DatatypeBytes(count, datatype) : 0.0),
+      start(counted ? PMPI_Wtime() : 0.0) {}
+
+  // For completion calls on requests
+  explicit ProfiledCall(const RequestCompletion& completion) :
+      category(kPointToPointTraffic),
+      counted(CurrentTrafficProfile().active && !completion.ListenerOnly()),
+      bytes(0.0), start(counted ? PMPI_Wtime() : 0.0) {}
+
+  ~ProfiledCall()
+  {
+    if (!counted) { return; }
+    MPITrafficCounts& counts =
+        CurrentTrafficProfile().traffic.counts[category];
+    counts.calls += 1.0;
+    counts.bytes += bytes;
+    counts.seconds += PMPI_Wtime() - start;
+  }
+
+ private:
+  MPITrafficCategory category;
+  bool counted;
+  double bytes;
+  double start;
+};
+
+} // namespace internal
+
+// Returns the MPI traffic this rank has generated so far in the running
+// test, so that tests can assert on it, e.g., to catch a halo exchange
+// that starts sending twice the bytes it should:
+//
+//   EXPECT_LE(GTestMPIListener::CurrentTestMPITraffic()
+//                 .counts[GTestMPIListener::kPointToPointTraffic].bytes,
+//             2.0 * haloBytes);
+inline MPITraffic CurrentTestMPITraffic()
+{
+  return internal::CurrentTrafficProfile().traffic;
+}
+
+// This class profiles the MPI traffic of each test on every rank and
+// reports, on rank 0, the totals across ranks and the largest amount on
+// any one rank, both in the printed output and as XML/JSON properties.
+// Traffic on the communicators of the printers in this library is not
+// counted. Append it after the printer, so that Google Test, which
+// delivers end-of-test events in reverse order, calls it first.
+//
+// Under a schedule (see gtest-mpi-scheduler.hpp), ranks run different
+// tests, so the profiler keeps each test's counts until the end of the
+// iteration, reduces them all at once, and prints them after the
+// printer's summary. It then records no properties, as no test is
+// running.
+class MPITrafficProfiler : public ::testing::EmptyTestEventListener
+{
+ public:
+  MPITrafficProfiler(MPI_Comm comm_ = MPI_COMM_WORLD)
+      : ::testing::EmptyTestEventListener(), scheduled_traffic(),
+        tear_down_count(0)
+  {
+    int is_mpi_initialized;
+    assert(MPI_Initialized(&is_mpi_initialized) == MPI_SUCCESS);
+    if (!is_mpi_initialized) {
+      printf("MPI must be initialized before RUN_ALL_TESTS!\n");
+      printf("Add '::testing::InitGoogleTest(&argc, argv);\n");
+      printf("     MPI_Init(&argc, &argv);' to your 'main' function!\n");
+      assert(0);
+    }
+
+    internal::DupListenerComm(comm_, &comm);
+    MPI_Comm_rank(comm, &rank);
+  }
+
+  // Called before a test starts.
+  virtual void OnTestStart(const ::testing::TestInfo& /* test_info */) {
+    internal::TrafficProfile& profile = internal::CurrentTrafficProfile();
+    profile.traffic.Clear();
+    profile.active = true;
+  }
+
+  // Called after a test ends. Reduces the profile onto rank 0 with two
+  // reductions, one for the totals and one for the largest per rank, or
+  // under a schedule, keeps it for the end of the iteration.
+  virtual void OnTestEnd(const ::testing::TestInfo& test_info) {
+    internal::TrafficProfile& profile = internal::CurrentTrafficProfile();
+    profile.active = false;
+
+    const internal::TestSchedule& schedule = internal::CurrentSchedule();
+    if (schedule.IsActive()) {
+      if (scheduled_traffic.empty()) {
+        scheduled_traffic.resize(schedule.test_names.size());
+      }
+      scheduled_traffic[schedule.IndexOf(
+          internal::FullTestName(test_info))] = profile.traffic;
+      return;
+    }
+
+    MPITraffic total, largest;
+    Reduce(&profile.traffic, &total, &largest, 1);
+    if (rank == 0) {
+      Print(internal::FullTestName(test_info), total, largest, true);
+    }
+  }
+
+  // Called before the Environment is torn down, which is the last point
+  // at which MPI is usable, because MPIEnvironment finalizes MPI.
+  virtual void OnEnvironmentsTearDownStart
+    (const ::testing::UnitTest& /* unit_test */) {
+    int is_mpi_finalized;
+    assert(MPI_Finalized(&is_mpi_finalized) == MPI_SUCCESS);
+    if (is_mpi_finalized) { return; }
+    ReportSchedule();
+    if (internal::TearingDownLastTime(tear_down_count)) {
+      internal::FreeListenerComm(&comm);
+    }
+  }
+
+ private:
+  MPI_Comm comm;
+  int rank;
+
+  // Under a schedule, this rank's traffic in each scheduled test of the
+  // current iteration, by position in the schedule; zero for the tests
+  // it did not run
+  std::vector<MPITraffic> scheduled_traffic;
+
+  // Number of times environments were torn down before
+  int tear_down_count;
+
+  // Disallow copying; the profile is global to the process
+  MPITrafficProfiler(const MPITrafficProfiler& profiler);
+
+  // Reduces count profiles onto rank 0, into their totals and largest
+  // values across ranks
+  void Reduce(MPITraffic *local, MPITraffic *total, MPITraffic *largest,
+              int count)
+  {
+    const int countCount = 3 * kNumTrafficCategories * count;
+    MPI_Reduce(&local[0].counts[0].calls, &total[0].counts[0].calls,
+               countCount, MPI_DOUBLE, MPI_SUM, 0, comm);
+    MPI_Reduce(&local[0].counts[0].calls, &largest[0].counts[0].calls,
+               countCount, MPI_DOUBLE, MPI_MAX, 0, comm);
+  }
+
+  // Under a schedule, reduces and prints the profiles of every test of
+  // the iteration. Collective over every rank, whichever tests it ran.
+  void ReportSchedule()
+  {
+    const internal::TestSchedule& schedule = internal::CurrentSchedule();
+    if (!schedule.IsActive()) { return; }
+    const size_t testCount = schedule.test_names.size();
+    scheduled_traffic.resize(testCount);
+    std::vector<MPITraffic> total(testCount), largest(testCount);
+    Reduce(&scheduled_traffic[0], &total[0], &largest[0],
+           static_cast<int>(testCount));
+    if (rank == 0) {
+      for (size_t t = 0; t < testCount; t++) {
+        Print(schedule.test_names[t], total[t], largest[t], false);
+      }
+    }
+    scheduled_traffic.clear();
+  }
+
+  // Prints the reduced profile of test_name on rank 0 and, while the test
+  // is still running, records it as properties of the test
+  void Print(const std::string& test_name, const MPITraffic& total,
+             const MPITraffic& largest, bool record)
+  {
+    for (int c = 0; c < kNumTrafficCategories; c++) {
+      const MPITrafficCounts& sum = total.counts[c];
+      const MPITrafficCounts& max = largest.counts[c];
+      if (sum.calls == 0.0) { continue; }
+      printf("[ MPI PROF ] %s %s: %.0f calls, %.0f bytes, %.3f ms; "
+             "at most %.0f calls, %.0f bytes, %.3f ms on one rank\n",
+             test_name.c_str(), internal::TrafficCategoryName(c),
+             sum.calls, sum.bytes, 1000.0 * sum.seconds,
+             max.calls, max.bytes, 1000.0 * max.seconds);
+      if (!record) { continue; }
+
+      const std::string key = std::string("mpi_")
+                              + internal::TrafficCategoryKey(c);
+      std::stringstream value;
+      value << sum.calls;
+      ::testing::Test::RecordProperty(key + "_calls", value.str());
+      value.str("");
+      value << sum.bytes;
+      ::testing::Test::RecordProperty(key + "_bytes", value.str());
+      value.str("");
+      value << max.bytes;
+      ::testing::Test::RecordProperty(key + "_bytes_max", value.str());
+      value.str("");
+      value << sum.seconds;
+      ::testing::Test::RecordProperty(key + "_seconds", value.str());
+    }
+  }
+
+}; // class MPITrafficProfiler
+
+} // namespace GTestMPIListener
+
+#ifdef GTEST_MPI_PROFILER_DEFINE_WRAPPERS
+
+// The intercepting functions. Each counts the call, then forwards it to
+// its PMPI_* twin. Calls that start requests on a listener's
+// communicator or window, or create windows over a listener's
+// communicator, also track them, so that later calls naming them are
+// not counted either.
+
+using GTestMPIListener::internal::ProfiledCall;
+using GTestMPIListener::internal::RequestCompletion;
+using GTestMPIListener::internal::IsListenerComm;
+using GTestMPIListener::internal::IsListenerWindow;
+using GTestMPIListener::internal::TrackRequest;
+using GTestMPIListener::internal::TrackWindow;
+using GTestMPIListener::internal::UntrackWindow;
+using GTestMPIListener::internal::IsRoot;
+using GTestMPIListener::internal::CommSize;
+using GTestMPIListener::internal::SumCounts;
+
+// Point-to-point
+
+int MPI_Send(GTEST_MPI_PROFILER_CONST void *buf, int count,
+             MPI_Datatype datatype, int dest, int tag, MPI_Comm comm)
+{
+  ProfiledCall call(GTestMPIListener::kPointToPointTraffic, comm, count,
+                    datatype);
+  return PMPI_Send(buf, count, datatype, dest, tag, comm);
+}
+
+int MPI_Ssend(GTEST_MPI_PROFILER_CONST void *buf, int count,
+              MPI_Datatype datatype, int dest, int tag, MPI_Comm comm)
+{
+  ProfiledCall call(GTestMPIListener::kPointToPointTraffic, comm, count,
+                    datatype);
+  return PMPI_Ssend(buf, count, datatype, dest, tag, comm);
+}
+
+int MPI_Bsend(GTEST_MPI_PROFILER_CONST void *buf, int count,
+              MPI_Datatype datatype, int dest, int tag, MPI_Comm comm)
+{
+  ProfiledCall call(GTestMPIListener::kPointToPointTraffic, comm, count,
+                    datatype);
+  return PMPI_Bsend(buf, count, datatype, dest, tag, comm);
+}
+
+int MPI_Rsend(GTEST_MPI_PROFILER_CONST void *buf, int count,
+              MPI_Datatype datatype, int dest, int tag, MPI_Comm comm)
+{
+  ProfiledCall call(GTestMPIListener::kPointToPointTraffic, comm, count,
+                    datatype);
+  return PMPI_Rsend(buf, count, datatype, dest, tag, comm);
+}
+
+int MPI_Isend(GTEST_MPI_PROFILER_CONST void *buf, int count,
+              MPI_Datatype datatype, int dest, int tag, MPI_Comm comm,
+              MPI_Request *request)
+{
+  ProfiledCall call(GTestMPIListener::kPointToPointTraffic, comm, count,
+                    datatype);
+  const int flag = PMPI_Isend(buf, count, datatype, dest, tag, comm, request);
+  TrackRequest(IsListenerComm(comm), *request);
+  return flag;
+}
+
+int MPI_Issend(GTEST_MPI_PROFILER_CONST void *buf, int count,
+               MPI_Datatype datatype, int dest, int tag, MPI_Comm comm,
+               MPI_Request *request)
+{
+  ProfiledCall call(GTestMPIListener::kPointToPointTraffic, comm, count,
+                    datatype);
+  const int flag = PMPI_Issend(buf, count, datatype, dest, tag, comm,
+                               request);
+  TrackRequest(IsListenerComm(comm), *request);
+  return flag;
+}
+
+int MPI_Ibsend(GTEST_MPI_PROFILER_CONST void *buf, int count,
+               MPI_Datatype datatype, int dest, int tag, MPI_Comm comm,
+               MPI_Request *request)
+{
+  ProfiledCall call(GTestMPIListener::kPointToPointTraffic, comm, count,
+                    datatype);
+  const int flag = PMPI_Ibsend(buf, count, datatype, dest, tag, comm,
+                               request);
+  TrackRequest(IsListenerComm(comm), *request);
+  return flag;
+}
+
+int MPI_Irsend(GTEST_MPI_PROFILER_CONST void *buf, int count,
+               MPI_Datatype datatype, int dest, int tag, MPI_Comm comm,
+               MPI_Request *request)
+{
+  ProfiledCall call(GTestMPIListener::kPointToPointTraffic, comm, count,
+                    datatype);
+  const int flag = PMPI_Irsend(buf, count, datatype, dest, tag, comm,
+                               request);
+  TrackRequest(IsListenerComm(comm), *request);
+  return flag;
+}
+
+int MPI_Recv(void *buf, int count, MPI_Datatype datatype, int source,
+             int tag, MPI_Comm comm, MPI_Status *status)
+{
+  ProfiledCall call(GTestMPIListener::kPointToPointTraffic, comm, 0,
+                    datatype);
+  return PMPI_Recv(buf, count, datatype, source, tag, comm, status);
+}
+
+int MPI_Irecv(void *buf, int count, MPI_Datatype datatype, int source,
+              int tag, MPI_Comm comm, MPI_Request *request)
+{
+  ProfiledCall call(GTestMPIListener::kPointToPointTraffic, comm, 0,
+                    datatype);
+  const int flag = PMPI_Irecv(buf, count, datatype, source, tag, comm,
+                              request);
+  TrackRequest(IsListenerComm(comm), *request);
+  return flag;
+}
+
+int MPI_Sendrecv(GTEST_MPI_PROFILER_CONST void *sendbuf, int sendcount,
+                 MPI_Datatype sendtype, int dest, int sendtag,
+                 void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                 int source, int recvtag, MPI_Comm comm, MPI_Status *status)
+{
+  ProfiledCall call(GTestMPIListener::kPointToPointTraffic, comm, sendcount,
+                    sendtype);
+  return PMPI_Sendrecv(sendbuf, sendcount, sendtype, dest, sendtag,
+                       recvbuf, recvcount, recvtype, source, recvtag,
+                       comm, status);
+}
+
+int MPI_Sendrecv_replace(void *buf, int count, MPI_Datatype datatype,
+                         int dest, int sendtag, int source, int recvtag,
+                         MPI_Comm comm, MPI_Status *status)
+{
+  ProfiledCall call(GTestMPIListener::kPointToPointTraffic, comm, count,
+                    datatype);
+  return PMPI_Sendrecv_replace(buf, count, datatype, dest, sendtag, source,
+                               recvtag, comm, status);
+}
+
+// Completion
+
+int MPI_Wait(MPI_Request *request, MPI_Status *status)
+{
+  const RequestCompletion completion(1, request);
+  ProfiledCall call(completion);
+  const int flag = PMPI_Wait(request, status);
+  completion.Untrack(request);
+  return flag;
+}
+
+int MPI_Waitall(int count, MPI_Request array_of_requests[],
+                MPI_Status array_of_statuses[])
+{
+  const RequestCompletion completion(count, array_of_requests);
+  ProfiledCall call(completion);
+  const int flag = PMPI_Waitall(count, array_of_requests, array_of_statuses);
+  completion.Untrack(array_of_requests);
+  return flag;
+}
+
+int MPI_Waitany(int count, MPI_Request array_of_requests[], int *index,
+                MPI_Status *status)
+{
+  const RequestCompletion completion(count, array_of_requests);
+  ProfiledCall call(completion);
+  const int flag = PMPI_Waitany(count, array_of_requests, index, status);
+  completion.Untrack(array_of_requests);
+  return flag;
+}
+
+int MPI_Waitsome(int incount, MPI_Request array_of_requests[],
+                 int *outcount, int array_of_indices[],
+                 MPI_Status array_of_statuses[])
+{
+  const RequestCompletion completion(incount, array_of_requests);
+  ProfiledCall call(completion);
+  const int flag = PMPI_Waitsome(incount, array_of_requests, outcount,
+                                 array_of_indices, array_of_statuses);
+  completion.Untrack(array_of_requests);
+  return flag;
+}
+
+int MPI_Test(MPI_Request *request, int *flag_, MPI_Status *status)
+{
+  const RequestCompletion completion(1, request);
+  ProfiledCall call(completion);
+  const int flag = PMPI_Test(request, flag_, status);
+  completion.Untrack(request);
+  return flag;
+}
+
+int MPI_Testall(int count, MPI_Request array_of_requests[], int *flag_,
+                MPI_Status array_of_statuses[])
+{
+  const RequestCompletion completion(count, array_of_requests);
+  ProfiledCall call(completion);
+  const int flag = PMPI_Testall(count, array_of_requests, flag_,
+                                array_of_statuses);
+  completion.Untrack(array_of_requests);
+  return flag;
+}
+
+int MPI_Testany(int count, MPI_Request array_of_requests[], int *index,
+                int *flag_, MPI_Status *status)
+{
+  const RequestCompletion completion(count, array_of_requests);
+  ProfiledCall call(completion);
+  const int flag = PMPI_Testany(count, array_of_requests, index, flag_,
+                                status);
+  completion.Untrack(array_of_requests);
+  return flag;
+}
+
+int MPI_Testsome(int incount, MPI_Request array_of_requests[],
+                 int *outcount, int array_of_indices[],
+                 MPI_Status array_of_statuses[])
+{
+  const RequestCompletion completion(incount, array_of_requests);
+  ProfiledCall call(completion);
+  const int flag = PMPI_Testsome(incount, array_of_requests, outcount,
+                                 array_of_indices, array_of_statuses);
+  completion.Untrack(array_of_requests);
+  return flag;
+}
+
+// Collectives
+
+int MPI_Barrier(MPI_Comm comm)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm, 0,
+                    MPI_BYTE);
+  return PMPI_Barrier(comm);
+}
+
+int MPI_Bcast(void *buffer, int count, MPI_Datatype datatype, int root,
+              MPI_Comm comm)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm,
+                    IsRoot(root, comm) ? count : 0, datatype);
+  return PMPI_Bcast(buffer, count, datatype, root, comm);
+}
+
+int MPI_Reduce(GTEST_MPI_PROFILER_CONST void *sendbuf, void *recvbuf,
+               int count, MPI_Datatype datatype, MPI_Op op, int root,
+               MPI_Comm comm)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm, count,
+                    datatype);
+  return PMPI_Reduce(sendbuf, recvbuf, count, datatype, op, root, comm);
+}
+
+int MPI_Allreduce(GTEST_MPI_PROFILER_CONST void *sendbuf, void *recvbuf,
+                  int count, MPI_Datatype datatype, MPI_Op op, MPI_Comm comm)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm, count,
+                    datatype);
+  return PMPI_Allreduce(sendbuf, recvbuf, count, datatype, op, comm);
+}
+
+int MPI_Reduce_scatter(GTEST_MPI_PROFILER_CONST void *sendbuf,
+                       void *recvbuf,
+                       GTEST_MPI_PROFILER_CONST int recvcounts[],
+                       MPI_Datatype datatype, MPI_Op op, MPI_Comm comm)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm,
+                    SumCounts(recvcounts, comm), datatype);
+  return PMPI_Reduce_scatter(sendbuf, recvbuf, recvcounts, datatype, op,
+                             comm);
+}
+
+int MPI_Scan(GTEST_MPI_PROFILER_CONST void *sendbuf, void *recvbuf,
+             int count, MPI_Datatype datatype, MPI_Op op, MPI_Comm comm)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm, count,
+                    datatype);
+  return PMPI_Scan(sendbuf, recvbuf, count, datatype, op, comm);
+}
+
+int MPI_Exscan(GTEST_MPI_PROFILER_CONST void *sendbuf, void *recvbuf,
+               int count, MPI_Datatype datatype, MPI_Op op, MPI_Comm comm)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm, count,
+                    datatype);
+  return PMPI_Exscan(sendbuf, recvbuf, count, datatype, op, comm);
+}
+
+int MPI_Gather(GTEST_MPI_PROFILER_CONST void *sendbuf, int sendcount,
+               MPI_Datatype sendtype, void *recvbuf, int recvcount,
+               MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm,
+                    (sendbuf == MPI_IN_PLACE) ? 0 : sendcount, sendtype);
+  return PMPI_Gather(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                     recvtype, root, comm);
+}
+
+int MPI_Gatherv(GTEST_MPI_PROFILER_CONST void *sendbuf, int sendcount,
+                MPI_Datatype sendtype, void *recvbuf,
+                GTEST_MPI_PROFILER_CONST int recvcounts[],
+                GTEST_MPI_PROFILER_CONST int displs[],
+                MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm,
+                    (sendbuf == MPI_IN_PLACE) ? 0 : sendcount, sendtype);
+  return PMPI_Gatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts,
+                      displs, recvtype, root, comm);
+}
+
+int MPI_Allgather(GTEST_MPI_PROFILER_CONST void *sendbuf, int sendcount,
+                  MPI_Datatype sendtype, void *recvbuf, int recvcount,
+                  MPI_Datatype recvtype, MPI_Comm comm)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm,
+                    (sendbuf == MPI_IN_PLACE) ? 0 : sendcount, sendtype);
+  return PMPI_Allgather(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                        recvtype, comm);
+}
+
+int MPI_Allgatherv(GTEST_MPI_PROFILER_CONST void *sendbuf, int sendcount,
+                   MPI_Datatype sendtype, void *recvbuf,
+                   GTEST_MPI_PROFILER_CONST int recvcounts[],
+                   GTEST_MPI_PROFILER_CONST int displs[],
+                   MPI_Datatype recvtype, MPI_Comm comm)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm,
+                    (sendbuf == MPI_IN_PLACE) ? 0 : sendcount, sendtype);
+  return PMPI_Allgatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts,
+                         displs, recvtype, comm);
+}
+
+int MPI_Scatter(GTEST_MPI_PROFILER_CONST void *sendbuf, int sendcount,
+                MPI_Datatype sendtype, void *recvbuf, int recvcount,
+                MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm,
+                    IsRoot(root, comm)
+                        ? static_cast<double>(sendcount) * CommSize(comm)
+                        : 0.0,
+                    sendtype);
+  return PMPI_Scatter(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                      recvtype, root, comm);
+}
+
+int MPI_Scatterv(GTEST_MPI_PROFILER_CONST void *sendbuf,
+                 GTEST_MPI_PROFILER_CONST int sendcounts[],
+                 GTEST_MPI_PROFILER_CONST int displs[],
+                 MPI_Datatype sendtype, void *recvbuf, int recvcount,
+                 MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm,
+                    IsRoot(root, comm) ? SumCounts(sendcounts, comm) : 0.0,
+                    sendtype);
+  return PMPI_Scatterv(sendbuf, sendcounts, displs, sendtype, recvbuf,
+                       recvcount, recvtype, root, comm);
+}
+
+int MPI_Alltoall(GTEST_MPI_PROFILER_CONST void *sendbuf, int sendcount,
+                 MPI_Datatype sendtype, void *recvbuf, int recvcount,
+                 MPI_Datatype recvtype, MPI_Comm comm)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm,
+                    (sendbuf == MPI_IN_PLACE)
+                        ? 0.0
+                        : static_cast<double>(sendcount) * CommSize(comm),
+                    sendtype);
+  return PMPI_Alltoall(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                       recvtype, comm);
+}
+
+int MPI_Alltoallv(GTEST_MPI_PROFILER_CONST void *sendbuf,
+                  GTEST_MPI_PROFILER_CONST int sendcounts[],
+                  GTEST_MPI_PROFILER_CONST int sdispls[],
+                  MPI_Datatype sendtype, void *recvbuf,
+                  GTEST_MPI_PROFILER_CONST int recvcounts[],
+                  GTEST_MPI_PROFILER_CONST int rdispls[],
+                  MPI_Datatype recvtype, MPI_Comm comm)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm,
+                    (sendbuf == MPI_IN_PLACE)
+                        ? 0.0 : SumCounts(sendcounts, comm),
+                    sendtype);
+  return PMPI_Alltoallv(sendbuf, sendcounts, sdispls, sendtype, recvbuf,
+                        recvcounts, rdispls, recvtype, comm);
+}
+
+#if MPI_VERSION >= 3
+
+// Nonblocking collectives, which MPI-3 introduced
+
+int MPI_Ibarrier(MPI_Comm comm, MPI_Request *request)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm, 0,
+                    MPI_BYTE);
+  const int flag = PMPI_Ibarrier(comm, request);
+  TrackRequest(IsListenerComm(comm), *request);
+  return flag;
+}
+
+int MPI_Ibcast(void *buffer, int count, MPI_Datatype datatype, int root,
+               MPI_Comm comm, MPI_Request *request)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm,
+                    IsRoot(root, comm) ? count : 0, datatype);
+  const int flag = PMPI_Ibcast(buffer, count, datatype, root, comm, request);
+  TrackRequest(IsListenerComm(comm), *request);
+  return flag;
+}
+
+int MPI_Ireduce(const void *sendbuf, void *recvbuf, int count,
+                MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm,
+                MPI_Request *request)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm, count,
+                    datatype);
+  const int flag = PMPI_Ireduce(sendbuf, recvbuf, count, datatype, op, root,
+                                comm, request);
+  TrackRequest(IsListenerComm(comm), *request);
+  return flag;
+}
+
+int MPI_Iallreduce(const void *sendbuf, void *recvbuf, int count,
+                   MPI_Datatype datatype, MPI_Op op, MPI_Comm comm,
+                   MPI_Request *request)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm, count,
+                    datatype);
+  const int flag = PMPI_Iallreduce(sendbuf, recvbuf, count, datatype, op,
+                                   comm, request);
+  TrackRequest(IsListenerComm(comm), *request);
+  return flag;
+}
+
+int MPI_Ireduce_scatter(const void *sendbuf, void *recvbuf,
+                        const int recvcounts[], MPI_Datatype datatype,
+                        MPI_Op op, MPI_Comm comm, MPI_Request *request)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm,
+                    SumCounts(recvcounts, comm), datatype);
+  const int flag = PMPI_Ireduce_scatter(sendbuf, recvbuf, recvcounts,
+                                        datatype, op, comm, request);
+  TrackRequest(IsListenerComm(comm), *request);
+  return flag;
+}
+
+int MPI_Iscan(const void *sendbuf, void *recvbuf, int count,
+              MPI_Datatype datatype, MPI_Op op, MPI_Comm comm,
+              MPI_Request *request)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm, count,
+                    datatype);
+  const int flag = PMPI_Iscan(sendbuf, recvbuf, count, datatype, op, comm,
+                              request);
+  TrackRequest(IsListenerComm(comm), *request);
+  return flag;
+}
+
+int MPI_Iexscan(const void *sendbuf, void *recvbuf, int count,
+                MPI_Datatype datatype, MPI_Op op, MPI_Comm comm,
+                MPI_Request *request)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm, count,
+                    datatype);
+  const int flag = PMPI_Iexscan(sendbuf, recvbuf, count, datatype, op, comm,
+                                request);
+  TrackRequest(IsListenerComm(comm), *request);
+  return flag;
+}
+
+int MPI_Igather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                int root, MPI_Comm comm, MPI_Request *request)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm,
+                    (sendbuf == MPI_IN_PLACE) ? 0 : sendcount, sendtype);
+  const int flag = PMPI_Igather(sendbuf, sendcount, sendtype, recvbuf,
+                                recvcount, recvtype, root, comm, request);
+  TrackRequest(IsListenerComm(comm), *request);
+  return flag;
+}
+
+int MPI_Igatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                 void *recvbuf, const int recvcounts[], const int displs[],
+                 MPI_Datatype recvtype, int root, MPI_Comm comm,
+                 MPI_Request *request)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm,
+                    (sendbuf == MPI_IN_PLACE) ? 0 : sendcount, sendtype);
+  const int flag = PMPI_Igatherv(sendbuf, sendcount, sendtype, recvbuf,
+                                 recvcounts, displs, recvtype, root, comm,
+                                 request);
+  TrackRequest(IsListenerComm(comm), *request);
+  return flag;
+}
+
+int MPI_Iallgather(const void *sendbuf, int sendcount,
+                   MPI_Datatype sendtype, void *recvbuf, int recvcount,
+                   MPI_Datatype recvtype, MPI_Comm comm,
+                   MPI_Request *request)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm,
+                    (sendbuf == MPI_IN_PLACE) ? 0 : sendcount, sendtype);
+  const int flag = PMPI_Iallgather(sendbuf, sendcount, sendtype, recvbuf,
+                                   recvcount, recvtype, comm, request);
+  TrackRequest(IsListenerComm(comm), *request);
+  return flag;
+}
+
+int MPI_Iallgatherv(const void *sendbuf, int sendcount,
+                    MPI_Datatype sendtype, void *recvbuf,
+                    const int recvcounts[], const int displs[],
+                    MPI_Datatype recvtype, MPI_Comm comm,
+                    MPI_Request *request)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm,
+                    (sendbuf == MPI_IN_PLACE) ? 0 : sendcount, sendtype);
+  const int flag = PMPI_Iallgatherv(sendbuf, sendcount, sendtype, recvbuf,
+                                    recvcounts, displs, recvtype, comm,
+                                    request);
+  TrackRequest(IsListenerComm(comm), *request);
+  return flag;
+}
+
+int MPI_Iscatter(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                 void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                 int root, MPI_Comm comm, MPI_Request *request)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm,
+                    IsRoot(root, comm)
+                        ? static_cast<double>(sendcount) * CommSize(comm)
+                        : 0.0,
+                    sendtype);
+  const int flag = PMPI_Iscatter(sendbuf, sendcount, sendtype, recvbuf,
+                                 recvcount, recvtype, root, comm, request);
+  TrackRequest(IsListenerComm(comm), *request);
+  return flag;
+}
+
+int MPI_Iscatterv(const void *sendbuf, const int sendcounts[],
+                  const int displs[], MPI_Datatype sendtype, void *recvbuf,
+                  int recvcount, MPI_Datatype recvtype, int root,
+                  MPI_Comm comm, MPI_Request *request)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm,
+                    IsRoot(root, comm) ? SumCounts(sendcounts, comm) : 0.0,
+                    sendtype);
+  const int flag = PMPI_Iscatterv(sendbuf, sendcounts, displs, sendtype,
+                                  recvbuf, recvcount, recvtype, root, comm,
+                                  request);
+  TrackRequest(IsListenerComm(comm), *request);
+  return flag;
+}
+
+int MPI_Ialltoall(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                  void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                  MPI_Comm comm, MPI_Request *request)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm,
+                    (sendbuf == MPI_IN_PLACE)
+                        ? 0.0
+                        : static_cast<double>(sendcount) * CommSize(comm),
+                    sendtype);
+  const int flag = PMPI_Ialltoall(sendbuf, sendcount, sendtype, recvbuf,
+                                  recvcount, recvtype, comm, request);
+  TrackRequest(IsListenerComm(comm), *request);
+  return flag;
+}
+
+int MPI_Ialltoallv(const void *sendbuf, const int sendcounts[],
+                   const int sdispls[], MPI_Datatype sendtype,
+                   void *recvbuf, const int recvcounts[],
+                   const int rdispls[], MPI_Datatype recvtype,
+                   MPI_Comm comm, MPI_Request *request)
+{
+  ProfiledCall call(GTestMPIListener::kCollectiveTraffic, comm,
+                    (sendbuf == MPI_IN_PLACE)
+                        ? 0.0 : SumCounts(sendcounts, comm),
+                    sendtype);
+  const int flag = PMPI_Ialltoallv(sendbuf, sendcounts, sdispls, sendtype,
+                                   recvbuf, recvcounts, rdispls, recvtype,
+                                   comm, request);
+  TrackRequest(IsListenerComm(comm), *request);
+  return flag;
+}
+
+#endif // MPI_VERSION >= 3
+
+// One-sided
+
+int MPI_Win_create(void *base, MPI_Aint size, int disp_unit, MPI_Info info,
+                   MPI_Comm comm, MPI_Win *win)
+{
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic, comm, 0, MPI_BYTE);
+  const int flag = PMPI_Win_create(base, size, disp_unit, info, comm, win);
+  TrackWindow(comm, *win);
+  return flag;
+}
+
+int MPI_Win_free(MPI_Win *win)
+{
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic,
+                    IsListenerWindow(*win), 0, MPI_BYTE);
+  UntrackWindow(*win);
+  return PMPI_Win_free(win);
+}
+
+int MPI_Put(GTEST_MPI_PROFILER_CONST void *origin_addr, int origin_count,
+            MPI_Datatype origin_datatype, int target_rank,
+            MPI_Aint target_disp, int target_count,
+            MPI_Datatype target_datatype, MPI_Win win)
+{
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic,
+                    IsListenerWindow(win), origin_count, origin_datatype);
+  return PMPI_Put(origin_addr, origin_count, origin_datatype, target_rank,
+                  target_disp, target_count, target_datatype, win);
+}
+
+int MPI_Get(void *origin_addr, int origin_count,
+            MPI_Datatype origin_datatype, int target_rank,
+            MPI_Aint target_disp, int target_count,
+            MPI_Datatype target_datatype, MPI_Win win)
+{
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic,
+                    IsListenerWindow(win), origin_count, origin_datatype);
+  return PMPI_Get(origin_addr, origin_count, origin_datatype, target_rank,
+                  target_disp, target_count, target_datatype, win);
+}
+
+int MPI_Accumulate(GTEST_MPI_PROFILER_CONST void *origin_addr,
+                   int origin_count, MPI_Datatype origin_datatype,
+                   int target_rank, MPI_Aint target_disp, int target_count,
+                   MPI_Datatype target_datatype, MPI_Op op, MPI_Win win)
+{
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic,
+                    IsListenerWindow(win), origin_count, origin_datatype);
+  return PMPI_Accumulate(origin_addr, origin_count, origin_datatype,
+                         target_rank, target_disp, target_count,
+                         target_datatype, op, win);
+}
+
+int MPI_Win_fence(int assert_, MPI_Win win)
+{
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic,
+                    IsListenerWindow(win), 0, MPI_BYTE);
+  return PMPI_Win_fence(assert_, win);
+}
+
+int MPI_Win_lock(int lock_type, int rank, int assert_, MPI_Win win)
+{
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic,
+                    IsListenerWindow(win), 0, MPI_BYTE);
+  return PMPI_Win_lock(lock_type, rank, assert_, win);
+}
+
+int MPI_Win_unlock(int rank, MPI_Win win)
+{
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic,
+                    IsListenerWindow(win), 0, MPI_BYTE);
+  return PMPI_Win_unlock(rank, win);
+}
+
+#if MPI_VERSION >= 3
+
+// One-sided calls that MPI-3 introduced
+
+int MPI_Win_allocate(MPI_Aint size, int disp_unit, MPI_Info info,
+                     MPI_Comm comm, void *baseptr, MPI_Win *win)
+{
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic, comm, 0, MPI_BYTE);
+  const int flag = PMPI_Win_allocate(size, disp_unit, info, comm, baseptr,
+                                     win);
+  TrackWindow(comm, *win);
+  return flag;
+}
+
+int MPI_Win_allocate_shared(MPI_Aint size, int disp_unit, MPI_Info info,
+                            MPI_Comm comm, void *baseptr, MPI_Win *win)
+{
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic, comm, 0, MPI_BYTE);
+  const int flag = PMPI_Win_allocate_shared(size, disp_unit, info, comm,
+                                            baseptr, win);
+  TrackWindow(comm, *win);
+  return flag;
+}
+
+int MPI_Win_create_dynamic(MPI_Info info, MPI_Comm comm, MPI_Win *win)
+{
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic, comm, 0, MPI_BYTE);
+  const int flag = PMPI_Win_create_dynamic(info, comm, win);
+  TrackWindow(comm, *win);
+  return flag;
+}
+
+int MPI_Fetch_and_op(const void *origin_addr, void *result_addr,
+                     MPI_Datatype datatype, int target_rank,
+                     MPI_Aint target_disp, MPI_Op op, MPI_Win win)
+{
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic,
+                    IsListenerWindow(win), 1, datatype);
+  return PMPI_Fetch_and_op(origin_addr, result_addr, datatype, target_rank,
+                           target_disp, op, win);
+}
+
+int MPI_Compare_and_swap(const void *origin_addr, const void *compare_addr,
+                         void *result_addr, MPI_Datatype datatype,
+                         int target_rank, MPI_Aint target_disp, MPI_Win win)
+{
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic,
+                    IsListenerWindow(win), 1, datatype);
+  return PMPI_Compare_and_swap(origin_addr, compare_addr, result_addr,
+                               datatype, target_rank, target_disp, win);
+}
+
+int MPI_Get_accumulate(const void *origin_addr, int origin_count,
+                       MPI_Datatype origin_datatype, void *result_addr,
+                       int result_count, MPI_Datatype result_datatype,
+                       int target_rank, MPI_Aint target_disp,
+                       int target_count, MPI_Datatype target_datatype,
+                       MPI_Op op, MPI_Win win)
+{
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic,
+                    IsListenerWindow(win), origin_count, origin_datatype);
+  return PMPI_Get_accumulate(origin_addr, origin_count, origin_datatype,
+                             result_addr, result_count, result_datatype,
+                             target_rank, target_disp, target_count,
+                             target_datatype, op, win);
+}
+
+int MPI_Rput(const void *origin_addr, int origin_count,
+             MPI_Datatype origin_datatype, int target_rank,
+             MPI_Aint target_disp, int target_count,
+             MPI_Datatype target_datatype, MPI_Win win, MPI_Request *request)
+{
+  const bool listener = IsListenerWindow(win);
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic, listener,
+                    origin_count, origin_datatype);
+  const int flag = PMPI_Rput(origin_addr, origin_count, origin_datatype,
+                             target_rank, target_disp, target_count,
+                             target_datatype, win, request);
+  TrackRequest(listener, *request);
+  return flag;
+}
+
+int MPI_Rget(void *origin_addr, int origin_count,
+             MPI_Datatype origin_datatype, int target_rank,
+             MPI_Aint target_disp, int target_count,
+             MPI_Datatype target_datatype, MPI_Win win, MPI_Request *request)
+{
+  const bool listener = IsListenerWindow(win);
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic, listener,
+                    origin_count, origin_datatype);
+  const int flag = PMPI_Rget(origin_addr, origin_count, origin_datatype,
+                             target_rank, target_disp, target_count,
+                             target_datatype, win, request);
+  TrackRequest(listener, *request);
+  return flag;
+}
+
+int MPI_Raccumulate(const void *origin_addr, int origin_count,
+                    MPI_Datatype origin_datatype, int target_rank,
+                    MPI_Aint target_disp, int target_count,
+                    MPI_Datatype target_datatype, MPI_Op op, MPI_Win win,
+                    MPI_Request *request)
+{
+  const bool listener = IsListenerWindow(win);
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic, listener,
+                    origin_count, origin_datatype);
+  const int flag = PMPI_Raccumulate(origin_addr, origin_count,
+                                    origin_datatype, target_rank,
+                                    target_disp, target_count,
+                                    target_datatype, op, win, request);
+  TrackRequest(listener, *request);
+  return flag;
+}
+
+int MPI_Rget_accumulate(const void *origin_addr, int origin_count,
+                        MPI_Datatype origin_datatype, void *result_addr,
+                        int result_count, MPI_Datatype result_datatype,
+                        int target_rank, MPI_Aint target_disp,
+                        int target_count, MPI_Datatype target_datatype,
+                        MPI_Op op, MPI_Win win, MPI_Request *request)
+{
+  const bool listener = IsListenerWindow(win);
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic, listener,
+                    origin_count, origin_datatype);
+  const int flag = PMPI_Rget_accumulate(origin_addr, origin_count,
+                                        origin_datatype, result_addr,
+                                        result_count, result_datatype,
+                                        target_rank, target_disp,
+                                        target_count, target_datatype, op,
+                                        win, request);
+  TrackRequest(listener, *request);
+  return flag;
+}
+
+int MPI_Win_lock_all(int assert_, MPI_Win win)
+{
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic,
+                    IsListenerWindow(win), 0, MPI_BYTE);
+  return PMPI_Win_lock_all(assert_, win);
+}
+
+int MPI_Win_unlock_all(MPI_Win win)
+{
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic,
+                    IsListenerWindow(win), 0, MPI_BYTE);
+  return PMPI_Win_unlock_all(win);
+}
+
+int MPI_Win_flush(int rank, MPI_Win win)
+{
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic,
+                    IsListenerWindow(win), 0, MPI_BYTE);
+  return PMPI_Win_flush(rank, win);
+}
+
+int MPI_Win_flush_all(MPI_Win win)
+{
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic,
+                    IsListenerWindow(win), 0, MPI_BYTE);
+  return PMPI_Win_flush_all(win);
+}
+
+int MPI_Win_flush_local(int rank, MPI_Win win)
+{
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic,
+                    IsListenerWindow(win), 0, MPI_BYTE);
+  return PMPI_Win_flush_local(rank, win);
+}
+
+int MPI_Win_flush_local_all(MPI_Win win)
+{
+  ProfiledCall call(GTestMPIListener::kOneSidedTraffic,
+                    IsListenerWindow(win), 0, MPI_BYTE);
+  return PMPI_Win_flush_local_all(win);
+}
+
+#endif // MPI_VERSION >= 3
+
+#endif // GTEST_MPI_PROFILER_DEFINE_WRAPPERS
+
+#endif /* GTEST_MPI_PROFILER_H */
@@ -0,0 +1,277 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+*******************************************************************************/
+
+// This header holds a writer that streams a JUnit XML or JSON report to
+// disk test by test, with one failure entry per distinct failure,
+// tagged with the ranks it occurred on. It only depends on MPI-1, but is
+// kept apart from gtest-mpi-listener.hpp because it is opt-in.
+
+#ifndef GTEST_MPI_REPORT_WRITER_H
+#define GTEST_MPI_REPORT_WRITER_H
+
+#include "gtest-mpi-listener.hpp"
+#include <cassert>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace GTestMPIListener
+{
+
+// Formats MPIStreamingReportWriter can write
+enum ReportFormat
+{
+  kJUnitXmlReport,
+  // Follows the layout of Google Test's JSON report
+  kJsonReport
+};
+
+namespace internal
+{
+
+inline std::string EscapeXml(const std::string& text)
+{
+  std::string out;
+  for (size_t i = 0; i < text.size(); i++) {
+    switch (text[i]) {
+      case '<': out += "&lt;"; break;
+      case '>': out += "&gt;"; break;
+      case '&': out += "&amp;"; break;
+      case '"': out += "&quot;"; break;
+      case '\'': out += "&apos;"; break;
+      case '\n': out += "&#x0A;"; break;
+      default: out += text[i];
+    }
+  }
+  return out;
+}
+
+// Splits any "]]>" in text across two CDATA sections
+inline std::string EscapeCData(const std::string& text)
+{
+  std::string out;
+  size_t start = 0, end;
+  while ((end = text.find("]]>", start)) != std::string::npos) {
+    out += text.substr(start, end + 2 - start) + "]]><![CDATA[";
+    start = end + 2;
+  }
+  return out + text.substr(start);
+}
+
+inline std::string EscapeJson(const std::string& text)
+{
+  std::string out;
+  for (size_t i = 0; i < text.size(); i++) {
+    const unsigned char c = static_cast<unsigned char>(text[i]);
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\t': out += "\\t"; break;
+      case '\r': out += "\\r"; break;
+      default:
+        if (c < 0x20) {
+          char code[8];
+          snprintf(code, sizeof(code), "\\u%04x", c);
+          out += code;
+        } else {
+          out += text[i];
+        }
+    }
+  }
+  return out;
+}
+
+// The full text of a failure, as Google Test's own reports give it
+inline std::string FailureText(const RankResult& failure, int size)
+{
+  const ::testing::TestPartResult& result = failure.result;
+  std::stringstream text;
+  text << failure.RankPrefix(size) << " "
+       << (result.file_name() ? result.file_name() : "unknown file") << ":"
+       << result.line_number() << "\n" << result.message();
+  return text.str();
+}
+
+} // namespace internal
+
+// This class writes a report on rank 0 as the printers report each
+// test, instead of Google Test's XML or JSON generator writing one when
+// the program ends. Point MPIListenerOptions::result_writer at it and
+// remove the default XML generator. Each failure gets an entry of its
+// own, with the ranks it occurred on as an attribute, rather than being
+// re-added to a test on rank 0.
+//
+// After each test, the file is completed with whatever closing tags
+// (or brackets) are still open, and flushed; the next test overwrites
+// them. So rank 0 holds nothing but the current test, and the report is
+// well-formed, and complete up to the last test reported, even if the
+// job is killed. For the same reason, test suite elements carry no test
+// or failure counts, which JUnit consumers compute from the test cases
+// themselves.
+class MPIStreamingReportWriter : public ResultWriter
+{
+ public:
+  MPIStreamingReportWriter(const std::string& file_name_,
+                           ReportFormat format_ = kJUnitXmlReport)
+      : ResultWriter(), file_name(file_name_), format(format_), file(NULL),
+        suite_name(), has_suite(false), has_test(false), body_end(0) {}
+
+  virtual ~MPIStreamingReportWriter() { Close(); }
+
+  virtual void WriteTest(const std::string& test_name, double seconds,
+                         bool skipped,
+                         const std::vector<internal::RankResult>& failures,
+                         int size)
+  {
+    if (!file) { Open(); }
+    std::fseek(file, body_end, SEEK_SET);
+
+    const size_t dot = test_name.find('.');
+    const std::string suite(test_name.substr(0, dot));
+    const std::string name(test_name.substr(dot + 1));
+    if (!has_suite || suite != suite_name) {
+      if (has_suite) { std::fputs(SuiteEnd().c_str(), file); }
+      WriteSuiteStart(suite);
+      suite_name = suite;
+      has_suite = true;
+      has_test = false;
+    }
+    if (format == kJsonReport) {
+      WriteJsonTest(suite, name, seconds, skipped, failures, size);
+    } else {
+      WriteXmlTest(suite, name, seconds, skipped, failures, size);
+    }
+    has_test = true;
+    WriteTrailer();
+  }
+
+  virtual void Close()
+  {
+    if (file) {
+      std::fclose(file);
+      file = NULL;
+    }
+  }
+
+ private:
+  std::string file_name;
+  ReportFormat format;
+  FILE *file;
+  std::string suite_name;
+  bool has_suite;
+  bool has_test;
+  // Where the closing tags or brackets written after the last test start
+  long body_end;
+
+  // Disallow copying; the writer owns its file
+  MPIStreamingReportWriter(const MPIStreamingReportWriter& writer);
+
+  void Open()
+  {
+    file = std::fopen(file_name.c_str(), "w");
+    if (!file) {
+      printf("Could not open '%s' for the test report!\n", file_name.c_str());
+      assert(0);
+    }
+    if (format == kJsonReport) {
+      std::fputs("{\n  \"name\": \"AllTests\",\n  \"testsuites\": [", file);
+    } else {
+      std::fputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                 "<testsuites name=\"AllTests\">\n", file);
+    }
+    WriteTrailer();
+  }
+
+  std::string SuiteEnd() const
+  {
+    return (format == kJsonReport) ? "\n      ]\n    }" : "  </testsuite>\n";
+  }
+
+  void WriteSuiteStart(const std::string& suite)
+  {
+    if (format == kJsonReport) {
+      fprintf(file, "%s\n    {\n      \"name\": \"%s\",\n"
+              "      \"testsuite\": [",
+              has_suite ? "," : "", internal::EscapeJson(suite).c_str());
+    } else {
+      fprintf(file, "  <testsuite name=\"%s\">\n",
+              internal::EscapeXml(suite).c_str());
+    }
+  }
+
+  void WriteXmlTest(const std::string& suite, const std::string& name,
+                    double seconds, bool skipped,
+                    const std::vector<internal::RankResult>& failures,
+                    int size)
+  {
+    fprintf(file, "    <testcase name=\"%s\" classname=\"%s\" time=\"%.3f\"",
+            internal::EscapeXml(name).c_str(),
+            internal::EscapeXml(suite).c_str(), seconds);
+    if (failures.empty() && !skipped) {
+      std::fputs(" />\n", file);
+      return;
+    }
+    std::fputs(">\n", file);
+    for (size_t i = 0; i < failures.size(); i++) {
+      const std::string text(internal::FailureText(failures[i], size));
+      fprintf(file, "      <failure message=\"%s\" type=\"\" ranks=\"%s\">"
+              "<![CDATA[%s]]></failure>\n",
+              internal::EscapeXml(text).c_str(),
+              failures[i].ranks.ToString().c_str(),
+              internal::EscapeCData(text).c_str());
+    }
+    if (skipped) { std::fputs("      <skipped />\n", file); }
+    std::fputs("    </testcase>\n", file);
+  }
+
+  void WriteJsonTest(const std::string& suite, const std::string& name,
+                     double seconds, bool skipped,
+                     const std::vector<internal::RankResult>& failures,
+                     int size)
+  {
+    fprintf(file, "%s\n        {\n          \"name\": \"%s\",\n"
+            "          \"classname\": \"%s\",\n"
+            "          \"status\": \"RUN\",\n"
+            "          \"result\": \"%s\",\n"
+            "          \"time\": \"%.3fs\"",
+            has_test ? "," : "", internal::EscapeJson(name).c_str(),
+            internal::EscapeJson(suite).c_str(),
+            skipped ? "SKIPPED" : "COMPLETED", seconds);
+    if (!failures.empty()) {
+      std::fputs(",\n          \"failures\": [", file);
+      for (size_t i = 0; i < failures.size(); i++) {
+        fprintf(file, "%s\n            {\n              \"failure\": \"%s\",\n"
+                "              \"type\": \"\",\n"
+                "              \"ranks\": \"%s\"\n            }",
+                (i == 0) ? "" : ",",
+                internal::EscapeJson(
+                    internal::FailureText(failures[i], size)).c_str(),
+                failures[i].ranks.ToString().c_str());
+      }
+      std::fputs("\n          ]", file);
+    }
+    std::fputs("\n        }", file);
+  }
+
+  // Closes everything still open, remembering where, and flushes
+  void WriteTrailer()
+  {
+    body_end = std::ftell(file);
+    if (has_suite) { std::fputs(SuiteEnd().c_str(), file); }
+    std::fputs((format == kJsonReport) ? "\n  ]\n}\n" : "</testsuites>\n",
+               file);
+    std::fflush(file);
+  }
+
+}; // class MPIStreamingReportWriter
+
+} // namespace GTestMPIListener
+
+#endif /* GTEST_MPI_REPORT_WRITER_H */
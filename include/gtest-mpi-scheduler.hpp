@@ -0,0 +1,325 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+*******************************************************************************/
+
+// This header holds a scheduler that runs tests needing few ranks
+// concurrently on disjoint groups of ranks, instead of running every
+// test on every rank. It only depends on MPI-1, but is kept apart from
+// gtest-mpi-listener.hpp because it is opt-in.
+
+#ifndef GTEST_MPI_SCHEDULER_H
+#define GTEST_MPI_SCHEDULER_H
+
+#include "gtest-mpi-listener.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace GTestMPIListener
+{
+
+namespace internal
+{
+
+// Whether name matches the Google Test filter pattern that starts at
+// pattern and ends at the next ':' or the end of the string
+inline bool MatchesPattern(const char *pattern, const char *name)
+{
+  switch (*pattern) {
+    case '\0':
+    case ':':
+      return *name == '\0';
+    case '?':
+      return *name != '\0' && MatchesPattern(pattern + 1, name + 1);
+    case '*':
+      return (*name != '\0' && MatchesPattern(pattern, name + 1))
+          || MatchesPattern(pattern + 1, name);
+    default:
+      return *pattern == *name && MatchesPattern(pattern + 1, name + 1);
+  }
+}
+
+// Whether name matches any of the ':'-separated patterns
+inline bool MatchesAnyPattern(const std::string& patterns,
+                              const std::string& name)
+{
+  size_t start = 0;
+  while (true) {
+    if (MatchesPattern(patterns.c_str() + start, name.c_str())) {
+      return true;
+    }
+    start = patterns.find(':', start);
+    if (start == std::string::npos) { return false; }
+    start++;
+  }
+}
+
+// Whether Google Test's --gtest_filter lets the test named name run
+inline bool MatchesFilter(const std::string& filter, const std::string& name)
+{
+  const size_t dash = filter.find('-');
+  const std::string positive = filter.substr(0, dash);
+  const std::string negative = (dash == std::string::npos)
+                               ? std::string() : filter.substr(dash + 1);
+  return MatchesAnyPattern(positive.empty() ? "*" : positive, name)
+      && !(!negative.empty() && MatchesAnyPattern(negative, name));
+}
+
+inline std::string FilterFlag()
+{
+#ifdef GTEST_FLAG_GET
+  return GTEST_FLAG_GET(filter);
+#else
+  return ::testing::GTEST_FLAG(filter);
+#endif
+}
+
+inline bool AlsoRunDisabledTestsFlag()
+{
+#ifdef GTEST_FLAG_GET
+  return GTEST_FLAG_GET(also_run_disabled_tests);
+#else
+  return ::testing::GTEST_FLAG(also_run_disabled_tests);
+#endif
+}
+
+// Sets the filter to run exactly the tests this rank is scheduled for,
+// and turns off shuffling: ranks sharing a group must run its tests in
+// the same order.
+inline void SetRankFilter(const std::string& filter)
+{
+#ifdef GTEST_FLAG_SET
+  GTEST_FLAG_SET(filter, filter);
+  GTEST_FLAG_SET(shuffle, false);
+#else
+  ::testing::GTEST_FLAG(filter) = filter;
+  ::testing::GTEST_FLAG(shuffle) = false;
+#endif
+}
+
+// The communicators of the groups this rank belongs to, one per group
+// size, and the one belonging to the running test
+struct GroupComms
+{
+  GroupComms() : by_size(), current(MPI_COMM_NULL) {}
+
+  std::map<int, MPI_Comm> by_size;
+  MPI_Comm current;
+};
+
+inline GroupComms& CurrentGroupComms()
+{
+  static GroupComms comms;
+  return comms;
+}
+
+} // namespace internal
+
+// Returns the communicator that the running test should use in place of
+// MPI_COMM_WORLD: under an MPITestScheduler, that of the group of ranks
+// running the test, and otherwise MPI_COMM_WORLD itself.
+inline MPI_Comm TestComm()
+{
+  const internal::GroupComms& comms = internal::CurrentGroupComms();
+  return (comms.current != MPI_COMM_NULL) ? comms.current : MPI_COMM_WORLD;
+}
+
+// This class runs each test on as many ranks as it declares it needs,
+// running tests on disjoint groups of ranks at the same time. Tests must
+// communicate over TestComm() instead of MPI_COMM_WORLD.
+//
+// Each test is placed, in the order Google Test runs them, on the group
+// of ranks (of the declared size, aligned to a multiple of that size)
+// that has been given the fewest tests so far; tests with no declared
+// size run on all ranks. Each rank then runs its tests in the usual
+// order, which keeps groups that share ranks from deadlocking. Only
+// tests passing --gtest_filter are scheduled.
+//
+// Schedule() must be called after InitGoogleTest and before the
+// printers are created, because they switch to reporting once per
+// iteration: ranks run different tests, so results are only collected,
+// and merged into one report on rank 0 in test order, once every rank
+// is done. For the same reason, timing and memory reports are turned
+// off. MPIWrapperPrinter reports failures from tests that rank 0 did not
+// run against the test program, naming the test, and prints a status
+// line for every scheduled test.
+class MPITestScheduler : public ::testing::EmptyTestEventListener
+{
+ public:
+  MPITestScheduler(MPI_Comm comm_ = MPI_COMM_WORLD)
+      : ::testing::EmptyTestEventListener(), comm(comm_), test_ranks(),
+        tear_down_count(0)
+  {
+    int is_mpi_initialized;
+    assert(MPI_Initialized(&is_mpi_initialized) == MPI_SUCCESS);
+    if (!is_mpi_initialized) {
+      printf("MPI must be initialized before RUN_ALL_TESTS!\n");
+      printf("Add '::testing::InitGoogleTest(&argc, argv);\n");
+      printf("     MPI_Init(&argc, &argv);' to your 'main' function!\n");
+      assert(0);
+    }
+  }
+
+  // Declares that tests whose full names match pattern, in the syntax of
+  // --gtest_filter (e.g., "Halo.*"), run on the given number of ranks.
+  // Later declarations take precedence over earlier ones.
+  void SetTestRanks(const std::string& pattern, int ranks)
+  {
+    test_ranks.push_back(std::make_pair(pattern, ranks));
+  }
+
+  // Places every test on a group of ranks, creates the groups'
+  // communicators, and restricts this rank to its own tests. Collective
+  // over the communicator passed to the constructor.
+  void Schedule()
+  {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    internal::TestSchedule& schedule = internal::CurrentSchedule();
+    const std::string filter(internal::FilterFlag());
+    const bool alsoRunDisabled = internal::AlsoRunDisabledTestsFlag();
+    std::vector<int> load(size, 0);
+    std::vector<int> groupSizes;
+    std::string rankFilter;
+
+    const ::testing::UnitTest& unit_test = *::testing::UnitTest::GetInstance();
+#ifndef GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+    for (int i = 0; i < unit_test.total_test_case_count(); i++) {
+      const ::testing::TestCase& test_suite = *unit_test.GetTestCase(i);
+#else
+    for (int i = 0; i < unit_test.total_test_suite_count(); i++) {
+      const ::testing::TestSuite& test_suite = *unit_test.GetTestSuite(i);
+#endif // GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+      for (int j = 0; j < test_suite.total_test_count(); j++) {
+        const ::testing::TestInfo& test_info = *test_suite.GetTestInfo(j);
+        const std::string name(internal::FullTestName(test_info));
+        const bool disabled =
+            std::string(test_info.test_case_name()).find("DISABLED_") == 0
+            || std::string(test_info.name()).find("DISABLED_") == 0;
+        if ((disabled && !alsoRunDisabled)
+            || !internal::MatchesFilter(filter, name)) {
+          continue;
+        }
+
+        // Place the test on the least loaded aligned group of its size
+        const int groupSize = DeclaredRanks(name, size);
+        int first = 0;
+        int leastLoad = -1;
+        for (int start = 0; start + groupSize <= size; start += groupSize) {
+          const int groupLoad = *std::max_element(
+              load.begin() + start, load.begin() + start + groupSize);
+          if (leastLoad < 0 || groupLoad < leastLoad) {
+            first = start;
+            leastLoad = groupLoad;
+          }
+        }
+        for (int r = first; r < first + groupSize; r++) { load[r]++; }
+
+        internal::RankSet ranks;
+        ranks.AddRange(first, first + groupSize - 1);
+        schedule.AddTest(name, ranks);
+        if (std::find(groupSizes.begin(), groupSizes.end(), groupSize)
+            == groupSizes.end()) {
+          groupSizes.push_back(groupSize);
+        }
+        if (rank >= first && rank < first + groupSize) {
+          rankFilter += (rankFilter.empty() ? "" : ":") + name;
+        }
+      }
+    }
+
+    // Every rank computed the same schedule, so every rank creates the
+    // same communicators, in the same order
+    std::sort(groupSizes.begin(), groupSizes.end());
+    internal::GroupComms& comms = internal::CurrentGroupComms();
+    for (size_t k = 0; k < groupSizes.size(); k++) {
+      const int groupSize = groupSizes[k];
+      const int groupCount = size / groupSize;
+      MPI_Comm group;
+      MPI_Comm_split(comm,
+                     (rank < groupCount * groupSize) ? rank / groupSize
+                                                     : MPI_UNDEFINED,
+                     rank, &group);
+      if (group != MPI_COMM_NULL) { comms.by_size[groupSize] = group; }
+    }
+
+    // A filter with only a negative pattern matching everything runs
+    // no tests
+    internal::SetRankFilter(rankFilter.empty() ? "-*" : rankFilter);
+  }
+
+  // Called before a test starts.
+  virtual void OnTestStart(const ::testing::TestInfo& test_info) {
+    const internal::TestSchedule& schedule = internal::CurrentSchedule();
+    if (!schedule.IsActive()) { return; }
+    const std::string name(internal::FullTestName(test_info));
+    const internal::RankSet& ranks =
+        schedule.test_ranks[schedule.IndexOf(name)];
+    const int groupSize = ranks.ranges[0].second - ranks.ranges[0].first + 1;
+    internal::CurrentGroupComms().current =
+        internal::CurrentGroupComms().by_size[groupSize];
+  }
+
+  // Called after a test ends.
+  virtual void OnTestEnd(const ::testing::TestInfo& /* test_info */) {
+    internal::CurrentGroupComms().current = MPI_COMM_NULL;
+  }
+
+  // Called before the Environment is torn down, which is the last point
+  // at which MPI is usable, because MPIEnvironment finalizes MPI.
+  virtual void OnEnvironmentsTearDownStart
+    (const ::testing::UnitTest& /* unit_test */) {
+    int is_mpi_finalized;
+    assert(MPI_Finalized(&is_mpi_finalized) == MPI_SUCCESS);
+    if (is_mpi_finalized
+        || !internal::TearingDownLastTime(tear_down_count)) {
+      return;
+    }
+
+    internal::GroupComms& comms = internal::CurrentGroupComms();
+    for (std::map<int, MPI_Comm>::iterator group = comms.by_size.begin();
+         group != comms.by_size.end(); ++group) {
+      MPI_Comm_free(&group->second);
+    }
+    comms.by_size.clear();
+  }
+
+ private:
+  MPI_Comm comm;
+  std::vector< std::pair<std::string, int> > test_ranks;
+
+  // Number of times environments were torn down before
+  int tear_down_count;
+
+  // Disallow copying; the schedule is global to the process
+  MPITestScheduler(const MPITestScheduler& scheduler);
+
+  // Number of ranks the test named name declared, clamped to the
+  // number of ranks available; all of them, if it declared none
+  int DeclaredRanks(const std::string& name, int size) const
+  {
+    int ranks = size;
+    for (size_t i = 0; i < test_ranks.size(); i++) {
+      if (internal::MatchesAnyPattern(test_ranks[i].first, name)) {
+        ranks = test_ranks[i].second;
+      }
+    }
+    return std::max(1, std::min(ranks, size));
+  }
+
+}; // class MPITestScheduler
+
+} // namespace GTestMPIListener
+
+#endif /* GTEST_MPI_SCHEDULER_H */
@@ -0,0 +1,206 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+*******************************************************************************/
+
+// This header deals serial tests, which need no communication, out to
+// whichever rank is free, so that each runs exactly once instead of once
+// per rank. Ranks take tests from a shared counter with
+// MPI_Fetch_and_op, so this header requires MPI-3, and it is kept apart
+// from gtest-mpi-listener.hpp so that the latter only depends on MPI-1.
+// Skipping tests requires Google Test 1.10 or later.
+
+#ifndef GTEST_MPI_SERIAL_TESTS_H
+#define GTEST_MPI_SERIAL_TESTS_H
+
+#include "gtest-mpi-listener.hpp"
+#include <cassert>
+#include <cstdio>
+#include <ctime>
+
+namespace GTestMPIListener
+{
+
+namespace internal
+{
+
+// State of the dealer on this rank. Every rank meets the serial tests in
+// the same order, and numbers them as it meets them. The counter on rank
+// 0 holds the number of the next test no rank has taken yet; a rank
+// holds at most one taken test, its ticket.
+struct SerialTestDealer
+{
+  SerialTestDealer() : win(MPI_WIN_NULL), counter(0), next_index(0),
+                       ticket(-1) {}
+
+  MPI_Win win;
+  long counter;
+  long next_index;
+  long ticket;
+};
+
+inline SerialTestDealer& CurrentSerialTestDealer()
+{
+  static SerialTestDealer dealer;
+  return dealer;
+}
+
+// Has every rank shuffle tests with rank 0's seed, since ranks must
+// meet the serial tests in the same order. Google Test picks a seed
+// from the clock when none is given; so does rank 0 here, within the
+// same range.
+inline void ShareRandomSeed(MPI_Comm comm)
+{
+#ifdef GTEST_FLAG_GET
+  int seed = GTEST_FLAG_GET(random_seed);
+#else
+  int seed = ::testing::GTEST_FLAG(random_seed);
+#endif
+  if (seed == 0) {
+    seed = static_cast<int>(std::time(NULL) % 99999) + 1;
+  }
+  MPI_Bcast(&seed, 1, MPI_INT, 0, comm);
+#ifdef GTEST_FLAG_SET
+  GTEST_FLAG_SET(random_seed, seed);
+#else
+  ::testing::GTEST_FLAG(random_seed) = seed;
+#endif
+}
+
+// Returns whether this rank should run the serial test it has just
+// reached. A rank whose ticket lies behind the test takes a new one.
+// Since a rank takes its next ticket as soon as it passes its last, the
+// new ticket never lies behind the test, and every test below it has
+// been taken by some rank; so each test runs exactly once.
+inline bool ClaimSerialTest()
+{
+  SerialTestDealer& dealer = CurrentSerialTestDealer();
+  if (dealer.win == MPI_WIN_NULL) { return true; }
+
+  const long index = dealer.next_index++;
+  if (dealer.ticket < index) {
+    const long one = 1;
+    MPI_Fetch_and_op(&one, &dealer.ticket, MPI_LONG, 0, 0, MPI_SUM,
+                     dealer.win);
+    MPI_Win_flush(0, dealer.win);
+  }
+  DealtTest& dealt = CurrentDealtTest();
+  dealt.number = static_cast<int>(index);
+  dealt.here = (dealer.ticket == index);
+  return dealt.here;
+}
+
+} // namespace internal
+
+// Fixture for serial tests. On ranks other than the one that takes the
+// test, SetUp skips it. Fixtures deriving from this one should call
+// MPISerialTest::SetUp first and return if IsSkipped().
+class MPISerialTest : public ::testing::Test
+{
+ protected:
+  virtual void SetUp()
+  {
+    internal::SkippedForAnotherRank() = !internal::ClaimSerialTest();
+    if (internal::SkippedForAnotherRank()) {
+      GTEST_SKIP() << "Runs on another rank";
+    }
+  }
+
+  virtual void TearDown() { internal::SkippedForAnotherRank() = false; }
+};
+
+// This class sets up the counter from which ranks take serial tests, on
+// a window over a private duplicate of comm. Append it to the listeners
+// before RUN_ALL_TESTS; it releases the window before MPI is finalized.
+//
+// The printers still collect serial tests' results on every rank, so
+// for throughput to scale with the number of ranks, report per test
+// suite or per iteration (see MPIListenerOptions::reporting) rather
+// than synchronizing all ranks after every test. MPIWrapperPrinter then
+// has each rank send the results of the serial tests it runs straight
+// to rank 0 as well, so that rank 0 does not show a test that failed
+// elsewhere as skipped.
+//
+// Ranks must meet the serial tests in the same order, so under
+// --gtest_shuffle, the dealer has every rank use rank 0's random seed.
+class MPISerialTestDealer : public ::testing::EmptyTestEventListener
+{
+ public:
+  MPISerialTestDealer(MPI_Comm comm_ = MPI_COMM_WORLD)
+      : ::testing::EmptyTestEventListener(), tear_down_count(0)
+  {
+    int is_mpi_initialized;
+    assert(MPI_Initialized(&is_mpi_initialized) == MPI_SUCCESS);
+    if (!is_mpi_initialized) {
+      printf("MPI must be initialized before RUN_ALL_TESTS!\n");
+      printf("Add '::testing::InitGoogleTest(&argc, argv);\n");
+      printf("     MPI_Init(&argc, &argv);' to your 'main' function!\n");
+      assert(0);
+    }
+
+    internal::DupListenerComm(comm_, &comm);
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    // A lone rank runs every test without needing a counter
+    if (size == 1) { return; }
+    internal::ShareRandomSeed(comm);
+
+    internal::SerialTestDealer& dealer = internal::CurrentSerialTestDealer();
+    MPI_Win_create(&dealer.counter,
+                   (rank == 0) ? static_cast<MPI_Aint>(sizeof(long)) : 0,
+                   sizeof(long), MPI_INFO_NULL, comm, &dealer.win);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, dealer.win);
+  }
+
+  // Called before a test starts. Until a serial test claims it, the test
+  // is not dealt.
+  virtual void OnTestStart(const ::testing::TestInfo& /* test_info */) {
+    internal::CurrentDealtTest() = internal::DealtTest();
+  }
+
+  // Called before the Environment is torn down, which is the last point
+  // at which MPI is usable, because MPIEnvironment finalizes MPI.
+  virtual void OnEnvironmentsTearDownStart
+    (const ::testing::UnitTest& /* unit_test */) {
+    int is_mpi_finalized;
+    assert(MPI_Finalized(&is_mpi_finalized) == MPI_SUCCESS);
+    if (is_mpi_finalized
+        || !internal::TearingDownLastTime(tear_down_count)) {
+      return;
+    }
+
+    internal::SerialTestDealer& dealer = internal::CurrentSerialTestDealer();
+    if (dealer.win != MPI_WIN_NULL) {
+      MPI_Win_unlock_all(dealer.win);
+      MPI_Win_free(&dealer.win);
+    }
+    internal::FreeListenerComm(&comm);
+  }
+
+ private:
+  MPI_Comm comm;
+
+  // Number of times environments were torn down before
+  int tear_down_count;
+
+  // Disallow copying; the counter is global to the process
+  MPISerialTestDealer(const MPISerialTestDealer& dealer);
+
+}; // class MPISerialTestDealer
+
+} // namespace GTestMPIListener
+
+// Defines a serial test, which runs on exactly one rank, in the manner of
+// TEST. All tests in a test suite must be serial, or none.
+#define MPI_SERIAL_TEST(test_suite_name, test_name)                  \
+  GTEST_TEST_(test_suite_name, test_name,                            \
+              ::GTestMPIListener::MPISerialTest,                     \
+              ::testing::internal::GetTypeId<                        \
+                  ::GTestMPIListener::MPISerialTest>())
+
+#endif /* GTEST_MPI_SERIAL_TESTS_H */
@@ -0,0 +1,228 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+*******************************************************************************/
+
+// This header holds a result gatherer that collects results within
+// each node through a shared-memory window instead of messages, so
+// that only one rank per node sends results to rank 0. It uses
+// MPI_Comm_split_type and MPI_Win_allocate_shared, so it requires
+// MPI-3, and it is kept apart from gtest-mpi-listener.hpp so that the
+// latter only depends on MPI-1.
+
+#ifndef GTEST_MPI_SHARED_MEMORY_H
+#define GTEST_MPI_SHARED_MEMORY_H
+
+#include "gtest-mpi-listener.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace GTestMPIListener
+{
+
+namespace internal
+{
+
+// Orders results by test, then by the lowest rank they occurred on
+inline bool HasLowerTestAndRank(const RankResult& a, const RankResult& b)
+{
+  if (a.test_index != b.test_index) { return a.test_index < b.test_index; }
+  return a.ranks.ranges[0].first < b.ranks.ranges[0].first;
+}
+
+// Puts the records in buffer in rank order within each test, for when
+// nodes do not hold contiguous blocks of ranks.
+inline void SortResultsByRank(std::vector<char>& buffer)
+{
+  std::vector<RankResult> results;
+  UnpackResults(buffer, results);
+  std::stable_sort(results.begin(), results.end(), HasLowerTestAndRank);
+  buffer.clear();
+  for (size_t i = 0; i < results.size(); i++) {
+    PackResult(buffer, results[i].ranks, results[i].test_index,
+               results[i].result);
+  }
+}
+
+} // namespace internal
+
+// This class collects results in two steps. Within each node, every
+// rank copies its packed results straight into a window of memory
+// shared with the node's lowest rank, its leader, which then holds all
+// of the node's results in rank order without a single message being
+// sent. Then only the leaders gather their nodes' results onto rank 0,
+// with one MPI_Gatherv, after merging duplicates within the node if the
+// printer deduplicates failures. Use it by pointing
+// MPIListenerOptions::gatherer at an instance that outlives the
+// printer.
+//
+// The window holds one int per rank on the node for the sizes of the
+// ranks' results, followed by the results themselves. It grows when a
+// test's results do not fit, which every rank on the node agrees on
+// because every rank reads all the sizes.
+class MPISharedMemoryGatherer : public ResultGatherer
+{
+ public:
+  MPISharedMemoryGatherer(size_t initial_capacity = 64 * 1024)
+      : ResultGatherer(), setup_comm(MPI_COMM_NULL), node_comm(MPI_COMM_NULL),
+        leader_comm(MPI_COMM_NULL), node_rank(0), node_size(1),
+        contiguous(true), win(MPI_WIN_NULL), sizes(NULL), data(NULL),
+        capacity(initial_capacity) {}
+
+  virtual ~MPISharedMemoryGatherer() {}
+
+  virtual void Gather(MPI_Comm comm, int rank, int /* size */,
+                      bool deduplicate,
+                      const std::vector<char>& local,
+                      std::vector<char>& gathered)
+  {
+    if (setup_comm == MPI_COMM_NULL) { SetUp(comm, rank); }
+    if (setup_comm != comm) {
+      printf("An MPISharedMemoryGatherer can only serve one printer!\n");
+      assert(0);
+    }
+
+    // Publish this rank's size, then read everyone's to find where this
+    // rank's results go, and how much room the node needs
+    sizes[node_rank] = static_cast<int>(local.size());
+    Synchronize();
+    size_t offset = 0, total = 0;
+    for (int r = 0; r < node_size; r++) {
+      if (r == node_rank) { offset = total; }
+      total += sizes[r];
+    }
+    if (total > capacity) {
+      // Every rank on the node saw the same sizes, so all reallocate
+      FreeWindow();
+      capacity = std::max(total, 2 * capacity);
+      AllocateWindow();
+    }
+    if (!local.empty()) {
+      std::memcpy(data + offset, &local[0], local.size());
+    }
+    Synchronize();
+
+    if (node_rank != 0) { return; }
+
+    // The leader takes a private copy, so that the node may move on to
+    // the next test while the leaders communicate
+    std::vector<char> nodeResults(data, data + total);
+    if (deduplicate) { internal::DeduplicateResults(nodeResults); }
+    int leaderRank, leaderCount;
+    MPI_Comm_rank(leader_comm, &leaderRank);
+    MPI_Comm_size(leader_comm, &leaderCount);
+    if (leaderCount == 1) {
+      gathered.swap(nodeResults);
+      return;
+    }
+    internal::GatherResults(leader_comm, leaderRank, leaderCount,
+                            nodeResults, gathered);
+    if (leaderRank == 0) {
+      if (deduplicate) { internal::DeduplicateResults(gathered); }
+      if (!contiguous) { internal::SortResultsByRank(gathered); }
+    }
+  }
+
+  virtual void Free()
+  {
+    int is_mpi_finalized;
+    assert(MPI_Finalized(&is_mpi_finalized) == MPI_SUCCESS);
+    if (is_mpi_finalized || setup_comm == MPI_COMM_NULL) { return; }
+    FreeWindow();
+    internal::FreeListenerComm(&leader_comm);
+    internal::FreeListenerComm(&node_comm);
+    setup_comm = MPI_COMM_NULL;
+  }
+
+ private:
+  MPI_Comm setup_comm;
+  MPI_Comm node_comm;
+  MPI_Comm leader_comm;
+  int node_rank;
+  int node_size;
+  bool contiguous;
+  MPI_Win win;
+  int *sizes;
+  char *data;
+  size_t capacity;
+
+  // Disallow copying; the window belongs to one gatherer
+  MPISharedMemoryGatherer(const MPISharedMemoryGatherer& gatherer);
+
+  // Splits comm into nodes, and the nodes' leaders into a communicator
+  // of their own in which rank 0 of comm is also rank 0. Collective
+  // over comm.
+  void SetUp(MPI_Comm comm, int rank)
+  {
+    setup_comm = comm;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL,
+                        &node_comm);
+    internal::ListenerComms().push_back(node_comm);
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_size(node_comm, &node_size);
+    MPI_Comm_split(comm, (node_rank == 0) ? 0 : MPI_UNDEFINED, rank,
+                   &leader_comm);
+    if (leader_comm != MPI_COMM_NULL) {
+      internal::ListenerComms().push_back(leader_comm);
+    }
+
+    // Results arrive at rank 0 in rank order only if every node holds
+    // a contiguous block of ranks
+    int leader = rank;
+    MPI_Bcast(&leader, 1, MPI_INT, 0, node_comm);
+    int localContiguous = (rank == leader + node_rank) ? 1 : 0;
+    int allContiguous;
+    MPI_Allreduce(&localContiguous, &allContiguous, 1, MPI_INT, MPI_MIN,
+                  comm);
+    contiguous = (allContiguous == 1);
+
+    AllocateWindow();
+  }
+
+  // Allocates the window, all of it on the leader, and locks it for the
+  // rest of its life. Collective over node_comm.
+  void AllocateWindow()
+  {
+    const MPI_Aint windowSize = (node_rank == 0)
+        ? static_cast<MPI_Aint>(node_size * sizeof(int) + capacity) : 0;
+    char *base;
+    MPI_Win_allocate_shared(windowSize, 1, MPI_INFO_NULL, node_comm,
+                            &base, &win);
+    MPI_Aint leaderSize;
+    int displacementUnit;
+    MPI_Win_shared_query(win, 0, &leaderSize, &displacementUnit, &base);
+    sizes = reinterpret_cast<int*>(base);
+    data = base + node_size * sizeof(int);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+  }
+
+  void FreeWindow()
+  {
+    if (win == MPI_WIN_NULL) { return; }
+    MPI_Win_unlock_all(win);
+    MPI_Win_free(&win);
+    sizes = NULL;
+    data = NULL;
+  }
+
+  // Makes every rank's stores to the window visible to every other
+  // rank on the node
+  void Synchronize()
+  {
+    MPI_Win_sync(win);
+    MPI_Barrier(node_comm);
+    MPI_Win_sync(win);
+  }
+
+}; // class MPISharedMemoryGatherer
+
+} // namespace GTestMPIListener
+
+#endif /* GTEST_MPI_SHARED_MEMORY_H */
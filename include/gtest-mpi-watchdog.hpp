@@ -0,0 +1,443 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+*******************************************************************************/
+
+// This header holds a listener that aborts a run when a test hangs,
+// after reporting which ranks are stuck where. It runs a watchdog thread
+// beside the tests, so it requires C++11 threads; for the watchdog to
+// talk to other ranks while the tests block in MPI, it requires MPI-2
+// and a thread level of MPI_THREAD_MULTIPLE. It is kept apart from
+// gtest-mpi-listener.hpp so that the latter only depends on MPI-1.
+
+#ifndef GTEST_MPI_WATCHDOG_H
+#define GTEST_MPI_WATCHDOG_H
+
+#include "gtest-mpi-listener.hpp"
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace GTestMPIListener
+{
+
+namespace internal
+{
+
+// Tags for watchdog traffic, which moves on the watchdog's private
+// duplicate communicator
+const int kWatchdogTimedOutTag = 1;
+const int kWatchdogQueryTag = 2;
+const int kWatchdogStatusTag = 3;
+
+// Where a rank is, as far as its watchdog knows
+enum WatchdogPhase
+{
+  // Between tests, with no results being collected
+  kWatchdogIdle,
+  // Running the body (or fixture) of a test
+  kWatchdogRunningTest,
+  // Done with the test, inside the printer's result collection
+  kWatchdogCollectingResults
+};
+
+// What a rank's watchdog tells rank 0 when asked, sent as MPI_BYTE
+struct WatchdogStatus
+{
+  int phase;
+  double seconds;
+  char test_name[256];
+};
+
+} // namespace internal
+
+// This class watches every test and, if a test has not finished within
+// its timeout (including collection of its results by the printer),
+// reports which ranks are still in which test, prints the test as
+// failed, and calls MPI_Abort, instead of letting a deadlock burn the
+// rest of the job's allocation.
+//
+// If MPI was initialized with MPI_THREAD_MULTIPLE, the watchdogs share
+// a side channel: the first to expire alerts rank 0, which queries every
+// rank for the test it is in and whether it is still running that test
+// or waiting on other ranks for results, and prints one report. Ranks
+// that do not answer within the grace period are listed as such.
+// Otherwise, each watchdog can only print what its own rank is doing.
+// As MPI may then not be called from the watchdog thread, it ends its
+// own process with std::_Exit rather than MPI_Abort; mpirun and srun
+// then terminate the other ranks.
+//
+// Append the watchdog after the printer. Google Test then delivers the
+// start of each test to the watchdog after the printer, and the end of
+// each test (which it delivers in reverse order) before, so that the
+// watchdog also covers the printer's result collection. The printer
+// tells the watchdog when it is done collecting; from then until the
+// next test starts, which includes setting up and tearing down test
+// suites and environments, nothing is timed. With other printers, the
+// watchdog stops timing when the next test suite or iteration starts.
+class MPIHangWatchdog : public ::testing::EmptyTestEventListener,
+                        private internal::CollectionObserver
+{
+ public:
+  MPIHangWatchdog(double timeout_seconds_, MPI_Comm comm_ = MPI_COMM_WORLD,
+                  double grace_seconds_ = 10.0)
+      : ::testing::EmptyTestEventListener(),
+        timeout_seconds(timeout_seconds_), grace_seconds(grace_seconds_),
+        test_timeouts(), has_side_channel(false), tear_down_count(0),
+        thread(), mutex(), wakeup(), stopping(false),
+        phase(internal::kWatchdogIdle), test_name(), test_timeout(0.0)
+  {
+    int is_mpi_initialized;
+    assert(MPI_Initialized(&is_mpi_initialized) == MPI_SUCCESS);
+    if (!is_mpi_initialized) {
+      printf("MPI must be initialized before RUN_ALL_TESTS!\n");
+      printf("Add '::testing::InitGoogleTest(&argc, argv);\n");
+      printf("     MPI_Init(&argc, &argv);' to your 'main' function!\n");
+      assert(0);
+    }
+
+    internal::DupListenerComm(comm_, &comm);
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int provided;
+    MPI_Query_thread(&provided);
+    has_side_channel = (provided == MPI_THREAD_MULTIPLE);
+    internal::CurrentCollectionObserver() = this;
+  }
+
+  virtual ~MPIHangWatchdog()
+  {
+    Stop();
+    if (internal::CurrentCollectionObserver() == this) {
+      internal::CurrentCollectionObserver() = NULL;
+    }
+  }
+
+  // Overrides the timeout for the test named "Suite.Test"
+  void SetTestTimeout(const std::string& name, double seconds)
+  {
+    test_timeouts[name] = seconds;
+  }
+
+  // Called before a test starts. Arms the watchdog for the test.
+  virtual void OnTestStart(const ::testing::TestInfo& test_info) {
+    const std::string name(internal::FullTestName(test_info));
+    std::map<std::string, double>::const_iterator found =
+        test_timeouts.find(name);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      phase = internal::kWatchdogRunningTest;
+      test_name = name;
+      test_timeout = (found != test_timeouts.end()) ? found->second
+                                                    : timeout_seconds;
+      test_start = std::chrono::steady_clock::now();
+    }
+    if (!thread.joinable()) {
+      thread = std::thread(&MPIHangWatchdog::Watch, this);
+    }
+  }
+
+  // Called after a test ends, before the printer collects its results;
+  // the test's deadline still applies.
+  virtual void OnTestEnd(const ::testing::TestInfo& /* test_info */) {
+    std::lock_guard<std::mutex> lock(mutex);
+    phase = internal::kWatchdogCollectingResults;
+  }
+
+  // Under batched reporting, the printer collects results when a test
+  // suite ends, so the watchdog grants that collection a fresh timeout.
+#ifndef GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+  virtual void OnTestCaseEnd(const ::testing::TestCase& /* test_case */) {
+    StartCollectionTimeout();
+  }
+#else
+  virtual void OnTestSuiteEnd(const ::testing::TestSuite& /* test_suite */) {
+    StartCollectionTimeout();
+  }
+#endif // GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+
+  // Called after the printer, by when it has collected the results of
+  // earlier tests. Setting up the test suite or the iteration's
+  // environments is not timed.
+  virtual void OnTestIterationStart(const ::testing::UnitTest& /* unit_test */,
+                                    int /* iteration */) {
+    StopTiming();
+  }
+
+#ifndef GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+  virtual void OnTestCaseStart(const ::testing::TestCase& /* test_case */) {
+    StopTiming();
+  }
+#else
+  virtual void OnTestSuiteStart(const ::testing::TestSuite& /* test_suite */) {
+    StopTiming();
+  }
+#endif // GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+
+  // Called before the Environment is torn down, which is the last point
+  // at which MPI is usable, because MPIEnvironment finalizes MPI. The
+  // printer, appended earlier, has finished collecting results by now.
+  virtual void OnEnvironmentsTearDownStart
+    (const ::testing::UnitTest& /* unit_test */) {
+    int is_mpi_finalized;
+    assert(MPI_Finalized(&is_mpi_finalized) == MPI_SUCCESS);
+    if (!internal::TearingDownLastTime(tear_down_count)) { return; }
+    Stop();
+    if (!is_mpi_finalized) { internal::FreeListenerComm(&comm); }
+  }
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  MPI_Comm comm;
+  int rank;
+  int size;
+  double timeout_seconds;
+  double grace_seconds;
+  std::map<std::string, double> test_timeouts;
+  bool has_side_channel;
+  // Number of times environments were torn down before
+  int tear_down_count;
+
+  // State shared with the watchdog thread, guarded by mutex
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  bool stopping;
+  internal::WatchdogPhase phase;
+  std::string test_name;
+  double test_timeout;
+  Clock::time_point test_start;
+
+  // Disallow copying; the thread cannot be shared
+  MPIHangWatchdog(const MPIHangWatchdog& watchdog);
+
+  // Times the collection of results that is about to start, with the
+  // timeout of the last test, unless a test is still running
+  void StartCollectionTimeout()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (phase != internal::kWatchdogRunningTest && !test_name.empty()) {
+      phase = internal::kWatchdogCollectingResults;
+      test_start = Clock::now();
+    }
+  }
+
+  void StopTiming()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (phase == internal::kWatchdogCollectingResults) {
+      phase = internal::kWatchdogIdle;
+    }
+  }
+
+  // The printer is about to collect the results of an iteration
+  virtual void OnCollectionStart() { StartCollectionTimeout(); }
+
+  // The printer is done collecting results
+  virtual void OnCollectionEnd() { StopTiming(); }
+
+  void Stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wakeup.notify_all();
+    if (thread.joinable()) { thread.join(); }
+  }
+
+  internal::WatchdogStatus CurrentStatus()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    internal::WatchdogStatus status;
+    std::memset(&status, 0, sizeof(status));
+    status.phase = phase;
+    status.seconds =
+        std::chrono::duration<double>(Clock::now() - test_start).count();
+    std::strncpy(status.test_name, test_name.c_str(),
+                 sizeof(status.test_name) - 1);
+    return status;
+  }
+
+  // Body of the watchdog thread: wakes up periodically to check the
+  // deadline of the current test and, when there is a side channel, to
+  // answer rank 0's queries.
+  void Watch()
+  {
+    const std::chrono::milliseconds poll(has_side_channel ? 100 : 1000);
+    bool alerted = false;
+    Clock::time_point alerted_at;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+      wakeup.wait_for(lock, poll);
+      if (stopping) { break; }
+      const bool expired = phase != internal::kWatchdogIdle
+          && Clock::now() - test_start
+             > std::chrono::duration<double>(test_timeout);
+      lock.unlock();
+
+      if (!has_side_channel) {
+        if (expired) { AbortAlone(); }
+      } else if (rank == 0) {
+        int timedOutElsewhere = 0;
+        MPI_Iprobe(MPI_ANY_SOURCE, internal::kWatchdogTimedOutTag, comm,
+                   &timedOutElsewhere, MPI_STATUS_IGNORE);
+        if (expired || timedOutElsewhere) { ReportAndAbort(); }
+      } else {
+        AnswerQueries();
+        if (expired && !alerted) {
+          internal::WatchdogStatus status = CurrentStatus();
+          MPI_Send(&status, sizeof(status), MPI_BYTE, 0,
+                   internal::kWatchdogTimedOutTag, comm);
+          alerted = true;
+          alerted_at = Clock::now();
+        } else if (alerted && Clock::now() - alerted_at
+                   > std::chrono::duration<double>(grace_seconds)) {
+          // Rank 0 never answered; it may be stuck beyond reach
+          AbortAlone();
+        }
+      }
+      lock.lock();
+    }
+  }
+
+  // Answers any query from rank 0 with this rank's status
+  void AnswerQueries()
+  {
+    int hasQuery = 0;
+    MPI_Iprobe(0, internal::kWatchdogQueryTag, comm, &hasQuery,
+               MPI_STATUS_IGNORE);
+    if (!hasQuery) { return; }
+    int query;
+    MPI_Recv(&query, 1, MPI_INT, 0, internal::kWatchdogQueryTag, comm,
+             MPI_STATUS_IGNORE);
+    internal::WatchdogStatus status = CurrentStatus();
+    MPI_Send(&status, sizeof(status), MPI_BYTE, 0,
+             internal::kWatchdogStatusTag, comm);
+  }
+
+  static const char *PhaseDescription(int phase_)
+  {
+    switch (phase_) {
+      case internal::kWatchdogRunningTest:
+        return "still running";
+      case internal::kWatchdogCollectingResults:
+        return "finished, waiting on other ranks to collect results of";
+      default:
+        return "is between tests, after";
+    }
+  }
+
+  // Prints what this rank is doing, then aborts the job. Below
+  // MPI_THREAD_MULTIPLE, this thread may not call MPI at all, so it
+  // exits the process instead, and leaves it to the launcher to take
+  // down the other ranks.
+  void AbortAlone()
+  {
+    const internal::WatchdogStatus status = CurrentStatus();
+    printf("[ WATCHDOG ] Rank %d/%d %s %s after %.1f s; aborting\n",
+           rank, size, PhaseDescription(status.phase), status.test_name,
+           status.seconds);
+    printf("[  FAILED  ] %s (timed out)\n", status.test_name);
+    fflush(stdout);
+    if (has_side_channel) {
+      MPI_Abort(comm, 1);
+    } else {
+      std::_Exit(1);
+    }
+  }
+
+  // On rank 0, queries every rank for its status, waits up to the grace
+  // period for the answers, prints them grouped by test and phase, and
+  // aborts the job.
+  void ReportAndAbort()
+  {
+    std::vector<internal::WatchdogStatus> statuses(size);
+    std::vector<MPI_Request> requests(size, MPI_REQUEST_NULL);
+    std::vector<int> queries(size, 0);
+    statuses[0] = CurrentStatus();
+    for (int r = 1; r < size; r++) {
+      MPI_Irecv(&statuses[r], sizeof(internal::WatchdogStatus), MPI_BYTE, r,
+                internal::kWatchdogStatusTag, comm, &requests[r]);
+    }
+    std::vector<MPI_Request> sends(size, MPI_REQUEST_NULL);
+    for (int r = 1; r < size; r++) {
+      MPI_Isend(&queries[r], 1, MPI_INT, r, internal::kWatchdogQueryTag,
+                comm, &sends[r]);
+    }
+
+    const Clock::time_point giveUp =
+        Clock::now() + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(grace_seconds));
+    std::vector<int> answered(size, 0);
+    answered[0] = 1;
+    int outstanding = size - 1;
+    while (outstanding > 0 && Clock::now() < giveUp) {
+      for (int r = 1; r < size; r++) {
+        if (answered[r]) { continue; }
+        MPI_Test(&requests[r], &answered[r], MPI_STATUS_IGNORE);
+        if (answered[r]) { outstanding--; }
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    // Group ranks by what they were doing
+    std::map< std::pair<std::string, int>, internal::RankSet > groups;
+    internal::RankSet silent;
+    std::string hung_test;
+    double longest = -1.0;
+    for (int r = 0; r < size; r++) {
+      if (!answered[r]) {
+        silent.Merge(internal::RankSet(r));
+        continue;
+      }
+      const internal::WatchdogStatus& status = statuses[r];
+      groups[std::make_pair(std::string(status.test_name), status.phase)]
+          .Merge(internal::RankSet(r));
+      if (status.phase == internal::kWatchdogRunningTest
+          && status.seconds > longest) {
+        hung_test = status.test_name;
+        longest = status.seconds;
+      }
+    }
+    if (hung_test.empty()) { hung_test = statuses[0].test_name; }
+
+    printf("[ WATCHDOG ] Test %s timed out\n", hung_test.c_str());
+    for (std::map< std::pair<std::string, int>,
+                   internal::RankSet >::const_iterator
+             group = groups.begin(); group != groups.end(); ++group) {
+      printf("[ WATCHDOG ] Rank%s %s/%d %s %s\n",
+             group->second.HasSingleRank() ? "" : "s",
+             group->second.ToString().c_str(), size,
+             PhaseDescription(group->first.second),
+             group->first.first.c_str());
+    }
+    if (!silent.ranges.empty()) {
+      printf("[ WATCHDOG ] Rank%s %s/%d did not answer within %.1f s\n",
+             silent.HasSingleRank() ? "" : "s", silent.ToString().c_str(),
+             size, grace_seconds);
+    }
+    printf("[  FAILED  ] %s (timed out)\n", hung_test.c_str());
+    printf("[ WATCHDOG ] Aborting\n");
+    fflush(stdout);
+    MPI_Abort(comm, 1);
+  }
+
+}; // class MPIHangWatchdog
+
+} // namespace GTestMPIListener
+
+#endif /* GTEST_MPI_WATCHDOG_H */
@@ -0,0 +1,136 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+ ******************************************************************************/
+
+#include "gtest/gtest.h"
+#include "gtest-mpi-assertions.hpp"
+#include "mpi.h"
+
+// Simple-minded functions for some testing
+
+namespace
+{
+int getMpiRank(MPI_Comm comm) {
+  int out;
+  MPI_Comm_rank(comm, &out);
+  return out;
+}
+
+int getMpiSize(MPI_Comm comm) {
+  int out;
+  MPI_Comm_size(comm, &out);
+  return out;
+}
+
+// Busy-waits for the given number of seconds
+void spin(double seconds) {
+  const double start = MPI_Wtime();
+  while (MPI_Wtime() - start < seconds) {}
+}
+
+} // end anonymous namespace
+
+// Each failing test below should report exactly one failure, however
+// many ranks fail it
+TEST(CollectiveMPI, PassOnAllRanks) {
+  MPI_Comm comm = MPI_COMM_WORLD;
+  int rank = getMpiRank(comm);
+  MPI_EXPECT_ALL_EQ(rank, getMpiRank(comm));
+  MPI_EXPECT_ALL_TRUE(rank < getMpiSize(comm));
+  MPI_EXPECT_ANY_TRUE(rank == 0);
+  MPI_EXPECT_MAX_LE(rank, getMpiSize(comm) - 1);
+  MPI_EXPECT_MIN_GE(rank, 0);
+}
+
+TEST(CollectiveMPI, FailOnAllRanks) {
+  MPI_Comm comm = MPI_COMM_WORLD;
+  int rank = getMpiRank(comm);
+  MPI_EXPECT_ALL_EQ(rank, getMpiRank(comm) + 1);
+}
+
+TEST(CollectiveMPI, FailExceptOnRankZero) {
+  MPI_Comm comm = MPI_COMM_WORLD;
+  int rank = getMpiRank(comm);
+  MPI_EXPECT_ALL_EQ(rank, 0) << "Only rank 0 should pass";
+}
+
+// On three ranks or more, the failing ranks are not contiguous, so the
+// failure counts them instead of giving them as a range
+TEST(CollectiveMPI, FailOnFirstAndLastRanks) {
+  MPI_Comm comm = MPI_COMM_WORLD;
+  int rank = getMpiRank(comm);
+  MPI_EXPECT_ALL_TRUE(rank != 0 && rank != getMpiSize(comm) - 1);
+}
+
+TEST(CollectiveMPI, FailOnNoRank) {
+  MPI_Comm comm = MPI_COMM_WORLD;
+  int rank = getMpiRank(comm);
+  MPI_EXPECT_ANY_TRUE(rank < 0);
+}
+
+TEST(CollectiveMPI, FailOnLargestRank) {
+  MPI_Comm comm = MPI_COMM_WORLD;
+  int rank = getMpiRank(comm);
+  MPI_EXPECT_MAX_LT(rank, getMpiSize(comm) - 1);
+}
+
+TEST(CollectiveMPI, AssertReturnsOnAllRanks) {
+  MPI_Comm comm = MPI_COMM_WORLD;
+  int rank = getMpiRank(comm);
+  MPI_ASSERT_ALL_FALSE(rank == 0);
+  // Never reached: every rank has returned
+  ADD_FAILURE() << "Collective assertion did not return on rank " << rank;
+}
+
+TEST(PerformanceMPI, PassWithinTimeLimit) {
+  MPI_EXPECT_TIME_MAX_LE(spin(0.001), 1.0);
+}
+
+// Fails because of the slowest rank only
+TEST(PerformanceMPI, FailOverTimeLimit) {
+  MPI_Comm comm = MPI_COMM_WORLD;
+  int rank = getMpiRank(comm);
+  MPI_EXPECT_TIME_MAX_LE(spin(rank == getMpiSize(comm) - 1 ? 0.02 : 0.0),
+                         0.01);
+}
+
+TEST(PerformanceMPI, PassAboveThroughput) {
+  MPI_EXPECT_THROUGHPUT_GE(spin(0.001), 1.0, 10.0);
+}
+
+TEST(PerformanceMPI, FailBelowThroughput) {
+  MPI_ASSERT_THROUGHPUT_GE(spin(0.01), 1.0, 1e6) << "Units are tests";
+}
+
+int main(int argc, char** argv) {
+  // Filter out Google Test arguments
+  ::testing::InitGoogleTest(&argc, argv);
+
+  // Initialize MPI
+  MPI_Init(&argc, &argv);
+
+  // Add object that will finalize MPI on exit; Google Test owns this pointer
+  ::testing::AddGlobalTestEnvironment(new GTestMPIListener::MPIEnvironment);
+
+  // Get the event listener list.
+  ::testing::TestEventListeners& listeners =
+      ::testing::UnitTest::GetInstance()->listeners();
+
+  // Remove default listener: the default printer and the default XML printer
+  delete listeners.Release(listeners.default_result_printer());
+  delete listeners.Release(listeners.default_xml_generator());
+
+  // Adds MPI listener; Google Test owns this pointer
+  listeners.Append(new GTestMPIListener::MPIMinimalistPrinter);
+
+  // Run tests, then clean up and exit. RUN_ALL_TESTS() returns 0 if all tests
+  // pass and 1 if some test fails.
+  int result = RUN_ALL_TESTS();
+
+  return 0;
+}
@@ -0,0 +1,83 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+ ******************************************************************************/
+
+#include "gtest/gtest.h"
+#include "gtest-mpi-listener.hpp"
+#include "mpi.h"
+
+// Tests run with options.fail_fast: the first failure, on any rank,
+// skips every test after it on all ranks
+
+namespace
+{
+int getMpiRank(MPI_Comm comm) {
+  int out;
+  MPI_Comm_rank(comm, &out);
+  return out;
+}
+
+int getMpiSize(MPI_Comm comm) {
+  int out;
+  MPI_Comm_size(comm, &out);
+  return out;
+}
+
+} // end anonymous namespace
+
+TEST(FailFastMPI, PassOnAllRanks) {
+  EXPECT_EQ(getMpiRank(MPI_COMM_WORLD), getMpiRank(MPI_COMM_WORLD));
+}
+
+// Should report one failure, on the largest rank, then stop the job
+TEST(FailFastMPI, FailOnLargestRank) {
+  MPI_Comm comm = MPI_COMM_WORLD;
+  EXPECT_LT(getMpiRank(comm), getMpiSize(comm) - 1);
+}
+
+// Should be skipped on every rank
+TEST(FailFastMPI, SkippedOnAllRanks) {
+  ADD_FAILURE() << "Ran after an earlier test failed";
+}
+
+TEST(FailFastMPILater, SkippedOnAllRanks) {
+  ADD_FAILURE() << "Ran after an earlier test failed";
+}
+
+int main(int argc, char** argv) {
+  // Filter out Google Test arguments
+  ::testing::InitGoogleTest(&argc, argv);
+
+  // Initialize MPI
+  MPI_Init(&argc, &argv);
+
+  // Add object that will finalize MPI on exit; Google Test owns this pointer
+  ::testing::AddGlobalTestEnvironment(new GTestMPIListener::MPIEnvironment);
+
+  // Get the event listener list.
+  ::testing::TestEventListeners& listeners =
+      ::testing::UnitTest::GetInstance()->listeners();
+
+  // Remove default listener: the default printer and the default XML printer
+  ::testing::TestEventListener *l =
+      listeners.Release(listeners.default_result_printer());
+  delete listeners.Release(listeners.default_xml_generator());
+
+  // Adds MPI listener, which stops all ranks after the first failure;
+  // Google Test owns this pointer
+  GTestMPIListener::MPIListenerOptions options;
+  options.fail_fast = true;
+  listeners.Append(
+      new GTestMPIListener::MPIWrapperPrinter(l, MPI_COMM_WORLD, options));
+
+  // Run tests, then clean up and exit. RUN_ALL_TESTS() returns 0 if all tests
+  // pass and 1 if some test fails.
+  int result = RUN_ALL_TESTS();
+
+  return 0;
+}
@@ -0,0 +1,84 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+ ******************************************************************************/
+
+#include "gtest/gtest.h"
+#include "gtest-mpi-listener.hpp"
+#include "mpi.h"
+
+// Tests repeated four times (unless --gtest_repeat says otherwise), of
+// which the report at the end should list exactly one as flaky
+
+namespace
+{
+int getMpiRank(MPI_Comm comm) {
+  int out;
+  MPI_Comm_rank(comm, &out);
+  return out;
+}
+
+int getMpiSize(MPI_Comm comm) {
+  int out;
+  MPI_Comm_size(comm, &out);
+  return out;
+}
+
+} // end anonymous namespace
+
+TEST(FlakyMPI, PassEveryTime) {
+  EXPECT_EQ(getMpiRank(MPI_COMM_WORLD), getMpiRank(MPI_COMM_WORLD));
+}
+
+// Fails every time, so it is not flaky
+TEST(FlakyMPI, FailEveryTime) {
+  int rank = getMpiRank(MPI_COMM_WORLD);
+  EXPECT_EQ(rank, rank + 1);
+}
+
+// Should be reported as failing in every other iteration, on the
+// largest rank
+TEST(FlakyMPI, FailEveryOtherTimeOnLargestRank) {
+  static int runs = 0;
+  MPI_Comm comm = MPI_COMM_WORLD;
+  const bool failing = (runs++ % 2 == 1);
+  EXPECT_FALSE(failing && getMpiRank(comm) == getMpiSize(comm) - 1);
+}
+
+int main(int argc, char** argv) {
+  // Filter out Google Test arguments; --gtest_repeat overrides the
+  // default set here
+  ::testing::GTEST_FLAG(repeat) = 4;
+  ::testing::InitGoogleTest(&argc, argv);
+
+  // Initialize MPI
+  MPI_Init(&argc, &argv);
+
+  // Add object that will finalize MPI on exit; Google Test owns this pointer
+  ::testing::AddGlobalTestEnvironment(new GTestMPIListener::MPIEnvironment);
+
+  // Get the event listener list.
+  ::testing::TestEventListeners& listeners =
+      ::testing::UnitTest::GetInstance()->listeners();
+
+  // Remove default listener: the default printer and the default XML printer
+  delete listeners.Release(listeners.default_result_printer());
+  delete listeners.Release(listeners.default_xml_generator());
+
+  // Adds MPI listener, which lists flaky tests after the last iteration;
+  // Google Test owns this pointer
+  GTestMPIListener::MPIListenerOptions options;
+  options.report_flaky_tests = true;
+  listeners.Append(
+      new GTestMPIListener::MPIMinimalistPrinter(MPI_COMM_WORLD, options));
+
+  // Run tests, then clean up and exit. RUN_ALL_TESTS() returns 0 if all tests
+  // pass and 1 if some test fails.
+  int result = RUN_ALL_TESTS();
+
+  return 0;
+}
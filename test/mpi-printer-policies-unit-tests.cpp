@@ -0,0 +1,124 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+ ******************************************************************************/
+
+#include "gtest/gtest.h"
+#include "gtest-mpi-listener.hpp"
+#include "mpi.h"
+#include <cstdio>
+#include <vector>
+
+// Tests reported by an MPIPrinter built from a custom formatting
+// policy, which prints one line per failing test, and a custom features
+// policy, which compiles out timing, memory sampling and deduplication
+
+namespace
+{
+int getMpiRank(MPI_Comm comm) {
+  int out;
+  MPI_Comm_rank(comm, &out);
+  return out;
+}
+
+int getMpiSize(MPI_Comm comm) {
+  int out;
+  MPI_Comm_size(comm, &out);
+  return out;
+}
+
+// Only the features this test program uses
+struct FailureFeatures
+{
+  static const bool kTiming = false;
+  static const bool kMemory = false;
+  static const bool kDeduplication = false;
+  static const bool kFailFast = true;
+  static const bool kFlakyTests = false;
+};
+
+// Prints, on rank 0, one line for each test that failed on any rank
+class FailureLineFormat : public GTestMPIListener::MPIPrinterFormat
+{
+ public:
+  static bool Collects(const ::testing::TestPartResult& test_part_result)
+  {
+    return test_part_result.failed();
+  }
+
+  void ReportResults(
+      const GTestMPIListener::internal::ResultBatch& gathered,
+      const std::vector<GTestMPIListener::internal::RankResult>& results,
+      const GTestMPIListener::MPIListenerOptions& /* options */,
+      int /* size */)
+  {
+    size_t i = 0;
+    for (int t = 0; t < gathered.test_count; t++) {
+      GTestMPIListener::internal::RankSet ranks;
+      for (; i < results.size() && results[i].test_index == t; i++) {
+        ranks.Merge(results[i].ranks);
+      }
+      if (!ranks.ranges.empty()) {
+        printf("FAILED %s on rank%s %s\n", gathered.test_names[t].c_str(),
+               ranks.HasSingleRank() ? "" : "s", ranks.ToString().c_str());
+      }
+    }
+  }
+};
+
+typedef GTestMPIListener::MPIPrinter<FailureLineFormat, FailureFeatures>
+    FailureLinePrinter;
+
+} // end anonymous namespace
+
+TEST(PolicyMPI, PassOnAllRanks) {
+  EXPECT_EQ(getMpiRank(MPI_COMM_WORLD), getMpiRank(MPI_COMM_WORLD));
+}
+
+// Should print one line, naming the largest rank
+TEST(PolicyMPI, FailOnLargestRank) {
+  MPI_Comm comm = MPI_COMM_WORLD;
+  EXPECT_LT(getMpiRank(comm), getMpiSize(comm) - 1);
+}
+
+// Should print one line, naming every rank once, even though each rank
+// fails twice
+TEST(PolicyMPI, FailTwiceOnAllRanks) {
+  ADD_FAILURE() << "First failure";
+  ADD_FAILURE() << "Second failure";
+}
+
+int main(int argc, char** argv) {
+  // Filter out Google Test arguments
+  ::testing::InitGoogleTest(&argc, argv);
+
+  // Initialize MPI
+  MPI_Init(&argc, &argv);
+
+  // Add object that will finalize MPI on exit; Google Test owns this pointer
+  ::testing::AddGlobalTestEnvironment(new GTestMPIListener::MPIEnvironment);
+
+  // Get the event listener list.
+  ::testing::TestEventListeners& listeners =
+      ::testing::UnitTest::GetInstance()->listeners();
+
+  // Remove default listener: the default printer and the default XML printer
+  delete listeners.Release(listeners.default_result_printer());
+  delete listeners.Release(listeners.default_xml_generator());
+
+  // Adds MPI listener; report_timing is ignored, because FailureFeatures
+  // compiles timing out. Google Test owns this pointer
+  GTestMPIListener::MPIListenerOptions options;
+  options.report_timing = true;
+  listeners.Append(new FailureLinePrinter(MPI_COMM_WORLD, options));
+
+  // Run tests, then clean up and exit. RUN_ALL_TESTS() returns 0 if all tests
+  // pass and 1 if some test fails.
+  int result = RUN_ALL_TESTS();
+
+  return 0;
+}
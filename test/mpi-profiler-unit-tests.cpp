@@ -0,0 +1,115 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+ ******************************************************************************/
+
+#include "gtest/gtest.h"
+#define GTEST_MPI_PROFILER_DEFINE_WRAPPERS
+#include "gtest-mpi-profiler.hpp"
+#include "mpi.h"
+#include <vector>
+
+// Simple-minded functions for some testing
+
+namespace
+{
+// Sends count ints to the next rank and receives as many from the
+// previous rank, as in a one-dimensional halo exchange
+void exchangeHalo(MPI_Comm comm, int count) {
+  int rank, size;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+  std::vector<int> send(count, rank), recv(count);
+  MPI_Sendrecv(&send[0], count, MPI_INT, (rank + 1) % size, 0,
+               &recv[0], count, MPI_INT, (rank + size - 1) % size, 0,
+               comm, MPI_STATUS_IGNORE);
+}
+
+double pointToPointBytes() {
+  return GTestMPIListener::CurrentTestMPITraffic()
+      .counts[GTestMPIListener::kPointToPointTraffic].bytes;
+}
+
+} // end anonymous namespace
+
+// These tests could be made shorter with a fixture, but a fixture
+// deliberately isn't used in order to make the test harness extremely simple
+TEST(ProfiledMPI, NoTraffic) {
+  EXPECT_EQ(0.0, pointToPointBytes());
+}
+
+TEST(ProfiledMPI, HaloExchangeWithinBudget) {
+  exchangeHalo(MPI_COMM_WORLD, 16);
+  EXPECT_LE(pointToPointBytes(), 16 * sizeof(int));
+}
+
+// Always fails: the halo is twice as large as the budget
+TEST(ProfiledMPI, HaloExchangeOverBudget) {
+  exchangeHalo(MPI_COMM_WORLD, 32);
+  EXPECT_LE(pointToPointBytes(), 16 * sizeof(int));
+}
+
+TEST(ProfiledMPI, Collectives) {
+  int rank, sum;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Allreduce(&rank, &sum, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Barrier(MPI_COMM_WORLD);
+  EXPECT_EQ(2.0, GTestMPIListener::CurrentTestMPITraffic()
+                     .counts[GTestMPIListener::kCollectiveTraffic].calls);
+}
+
+TEST(ProfiledMPI, OneSided) {
+  int rank, size, value = 0;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  MPI_Win win;
+  MPI_Win_create(&value, sizeof(int), sizeof(int), MPI_INFO_NULL,
+                 MPI_COMM_WORLD, &win);
+  MPI_Win_fence(0, win);
+  MPI_Put(&rank, 1, MPI_INT, (rank + 1) % size, 0, 1, MPI_INT, win);
+  MPI_Win_fence(0, win);
+  MPI_Win_free(&win);
+  EXPECT_EQ((rank + size - 1) % size, value);
+  EXPECT_EQ(static_cast<double>(sizeof(int)),
+            GTestMPIListener::CurrentTestMPITraffic()
+                .counts[GTestMPIListener::kOneSidedTraffic].bytes);
+}
+
+int main(int argc, char** argv) {
+  // Filter out Google Test arguments
+  ::testing::InitGoogleTest(&argc, argv);
+
+  // Initialize MPI
+  MPI_Init(&argc, &argv);
+
+  // Add object that will finalize MPI on exit; Google Test owns this pointer
+  ::testing::AddGlobalTestEnvironment(new GTestMPIListener::MPIEnvironment);
+
+  // Get the event listener list.
+  ::testing::TestEventListeners& listeners =
+      ::testing::UnitTest::GetInstance()->listeners();
+
+  // Remove default listener: the default printer and the default XML printer
+  ::testing::TestEventListener *l =
+        listeners.Release(listeners.default_result_printer());
+
+  // Adds MPI listener; Google Test owns this pointer
+  listeners.Append(
+      new GTestMPIListener::MPIWrapperPrinter(l,
+                                              MPI_COMM_WORLD)
+      );
+
+  // Adds the profiler after the printer, so that it sees the end of each
+  // test first; Google Test owns this pointer
+  listeners.Append(new GTestMPIListener::MPITrafficProfiler(MPI_COMM_WORLD));
+
+  // Run tests, then clean up and exit. RUN_ALL_TESTS() returns 0 if all tests
+  // pass and 1 if some test fails.
+  int result = RUN_ALL_TESTS();
+
+  return 0;
+}
@@ -0,0 +1,107 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+ ******************************************************************************/
+
+#include "gtest/gtest.h"
+#include "gtest-mpi-scheduler.hpp"
+#include "mpi.h"
+
+// Simple-minded functions for some testing
+
+namespace
+{
+int getMpiSize(MPI_Comm comm) {
+  int out;
+  MPI_Comm_size(comm, &out);
+  return out;
+}
+
+// Sums the ranks of comm, which takes every rank of comm to pass
+int sumOfRanks(MPI_Comm comm) {
+  int rank, sum;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Allreduce(&rank, &sum, 1, MPI_INT, MPI_SUM, comm);
+  return sum;
+}
+
+} // end anonymous namespace
+
+// These tests could be made shorter with a fixture, but a fixture
+// deliberately isn't used in order to make the test harness extremely simple
+
+// The tests in PairMPI declare that they need two ranks, so they run
+// concurrently on pairs of ranks.
+TEST(PairMPI, PassOnPair) {
+  MPI_Comm comm = GTestMPIListener::TestComm();
+  EXPECT_EQ(2, getMpiSize(comm));
+  EXPECT_EQ(1, sumOfRanks(comm));
+}
+
+TEST(PairMPI, PassOnAnotherPair) {
+  MPI_Comm comm = GTestMPIListener::TestComm();
+  EXPECT_EQ(1, sumOfRanks(comm));
+}
+
+// Always fails on the second rank of its pair
+TEST(PairMPI, FailOnSecondRankOfPair) {
+  MPI_Comm comm = GTestMPIListener::TestComm();
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  EXPECT_EQ(0, rank);
+}
+
+TEST(SingleMPI, PassOnOneRank) {
+  EXPECT_EQ(1, getMpiSize(GTestMPIListener::TestComm()));
+}
+
+// Declares no size, so it runs on all ranks
+TEST(WorldMPI, PassOnAllRanks) {
+  MPI_Comm comm = GTestMPIListener::TestComm();
+  EXPECT_EQ(getMpiSize(MPI_COMM_WORLD), getMpiSize(comm));
+}
+
+int main(int argc, char** argv) {
+  // Filter out Google Test arguments
+  ::testing::InitGoogleTest(&argc, argv);
+
+  // Initialize MPI
+  MPI_Init(&argc, &argv);
+
+  // Add object that will finalize MPI on exit; Google Test owns this pointer
+  ::testing::AddGlobalTestEnvironment(new GTestMPIListener::MPIEnvironment);
+
+  // Get the event listener list.
+  ::testing::TestEventListeners& listeners =
+      ::testing::UnitTest::GetInstance()->listeners();
+
+  // Declare how many ranks each test needs, then place the tests on
+  // groups of ranks before creating the printer; Google Test owns this
+  // pointer
+  GTestMPIListener::MPITestScheduler *scheduler =
+      new GTestMPIListener::MPITestScheduler(MPI_COMM_WORLD);
+  scheduler->SetTestRanks("PairMPI.*", 2);
+  scheduler->SetTestRanks("SingleMPI.*", 1);
+  scheduler->Schedule();
+  listeners.Append(scheduler);
+
+  // Remove default listener: the default printer and the default XML printer
+  ::testing::TestEventListener *l =
+        listeners.Release(listeners.default_result_printer());
+
+  // Adds MPI listener; Google Test owns this pointer
+  listeners.Append(
+      new GTestMPIListener::MPIWrapperPrinter(l,
+                                              MPI_COMM_WORLD)
+      );
+
+  // Run tests, then clean up and exit. RUN_ALL_TESTS() returns 0 if all tests
+  // pass and 1 if some test fails.
+  int result = RUN_ALL_TESTS();
+
+  return 0;
+}
@@ -0,0 +1,106 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+ ******************************************************************************/
+
+#include "gtest/gtest.h"
+#include "gtest-mpi-serial-tests.hpp"
+#include "mpi.h"
+#include <string>
+
+// Simple-minded functions for some testing
+
+namespace
+{
+// Number of serial tests this rank has run
+int serialTestsRun = 0;
+
+const int kSerialTestCount = 6;
+
+// Stands in for a purely serial unit under test
+std::string reversed(const std::string& in) {
+  return std::string(in.rbegin(), in.rend());
+}
+
+} // end anonymous namespace
+
+// Each serial test runs on exactly one rank, whichever is free first
+MPI_SERIAL_TEST(SerialStrings, ReverseEmpty) {
+  serialTestsRun++;
+  EXPECT_EQ("", reversed(""));
+}
+
+MPI_SERIAL_TEST(SerialStrings, ReverseOne) {
+  serialTestsRun++;
+  EXPECT_EQ("a", reversed("a"));
+}
+
+MPI_SERIAL_TEST(SerialStrings, ReverseMany) {
+  serialTestsRun++;
+  EXPECT_EQ("cba", reversed("abc"));
+}
+
+// Always fails, on whichever rank runs it
+MPI_SERIAL_TEST(SerialStrings, FailOnce) {
+  serialTestsRun++;
+  EXPECT_EQ("abc", reversed("abc"));
+}
+
+MPI_SERIAL_TEST(SerialStrings, ReverseTwice) {
+  serialTestsRun++;
+  EXPECT_EQ("abc", reversed(reversed("abc")));
+}
+
+MPI_SERIAL_TEST(SerialStrings, ReversePalindrome) {
+  serialTestsRun++;
+  EXPECT_EQ("abba", reversed("abba"));
+}
+
+// An ordinary test runs on all ranks, and checks that the serial tests
+// before it ran exactly once in all
+TEST(BasicMPI, SerialTestsRanOnce) {
+  MPI_Comm comm = MPI_COMM_WORLD;
+  int total;
+  MPI_Allreduce(&serialTestsRun, &total, 1, MPI_INT, MPI_SUM, comm);
+  EXPECT_EQ(kSerialTestCount, total);
+}
+
+int main(int argc, char** argv) {
+  // Filter out Google Test arguments
+  ::testing::InitGoogleTest(&argc, argv);
+
+  // Initialize MPI
+  MPI_Init(&argc, &argv);
+
+  // Add object that will finalize MPI on exit; Google Test owns this pointer
+  ::testing::AddGlobalTestEnvironment(new GTestMPIListener::MPIEnvironment);
+
+  // Get the event listener list.
+  ::testing::TestEventListeners& listeners =
+      ::testing::UnitTest::GetInstance()->listeners();
+
+  // Adds the counter from which ranks take serial tests; Google Test
+  // owns this pointer
+  listeners.Append(new GTestMPIListener::MPISerialTestDealer(MPI_COMM_WORLD));
+
+  // Remove default listener: the default printer and the default XML printer
+  delete listeners.Release(listeners.default_result_printer());
+
+  // Adds MPI listener, reporting once per test suite so that ranks need
+  // not wait for each other after each serial test; Google Test owns
+  // this pointer
+  GTestMPIListener::MPIListenerOptions options;
+  options.reporting = GTestMPIListener::kReportPerTestSuite;
+  listeners.Append(
+      new GTestMPIListener::MPIMinimalistPrinter(MPI_COMM_WORLD, options));
+
+  // Run tests, then clean up and exit. RUN_ALL_TESTS() returns 0 if all tests
+  // pass and 1 if some test fails.
+  int result = RUN_ALL_TESTS();
+
+  return 0;
+}
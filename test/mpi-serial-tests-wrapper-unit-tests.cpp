@@ -0,0 +1,100 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+ ******************************************************************************/
+
+#include "gtest/gtest.h"
+#include "gtest-mpi-serial-tests.hpp"
+#include "mpi.h"
+#include <chrono>
+#include <thread>
+
+// Simple-minded functions for some testing
+
+namespace
+{
+int getMpiRank(MPI_Comm comm) {
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  return rank;
+}
+
+// Keeps a rank busy, so that the other ranks take the next serial tests
+void work() {
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+}
+
+} // end anonymous namespace
+
+// Each serial test fails unless rank 0 takes it. Whichever rank runs
+// it, rank 0 should show it as failed, not as skipped, even though
+// results are only collected at the end of the test suite.
+MPI_SERIAL_TEST(SerialWrapped, FailUnlessOnRankZero1) {
+  work();
+  const int rank = getMpiRank(MPI_COMM_WORLD);
+  EXPECT_EQ(0, rank);
+}
+
+MPI_SERIAL_TEST(SerialWrapped, FailUnlessOnRankZero2) {
+  work();
+  const int rank = getMpiRank(MPI_COMM_WORLD);
+  EXPECT_EQ(0, rank);
+}
+
+MPI_SERIAL_TEST(SerialWrapped, FailUnlessOnRankZero3) {
+  work();
+  const int rank = getMpiRank(MPI_COMM_WORLD);
+  EXPECT_EQ(0, rank);
+}
+
+MPI_SERIAL_TEST(SerialWrapped, FailUnlessOnRankZero4) {
+  work();
+  const int rank = getMpiRank(MPI_COMM_WORLD);
+  EXPECT_EQ(0, rank);
+}
+
+// Always passes, on whichever rank runs it; rank 0 shows it as skipped
+// unless it runs it
+MPI_SERIAL_TEST(SerialWrapped, Pass) {
+  EXPECT_TRUE(true);
+}
+
+int main(int argc, char** argv) {
+  // Filter out Google Test arguments
+  ::testing::InitGoogleTest(&argc, argv);
+
+  // Initialize MPI
+  MPI_Init(&argc, &argv);
+
+  // Add object that will finalize MPI on exit; Google Test owns this pointer
+  ::testing::AddGlobalTestEnvironment(new GTestMPIListener::MPIEnvironment);
+
+  // Get the event listener list.
+  ::testing::TestEventListeners& listeners =
+      ::testing::UnitTest::GetInstance()->listeners();
+
+  // Adds the counter from which ranks take serial tests; Google Test
+  // owns this pointer
+  listeners.Append(new GTestMPIListener::MPISerialTestDealer(MPI_COMM_WORLD));
+
+  // Remove default listener: the default printer and the default XML printer
+  ::testing::TestEventListener *l =
+        listeners.Release(listeners.default_result_printer());
+
+  // Adds MPI listener wrapping the default printer, reporting once per
+  // test suite; Google Test owns this pointer
+  GTestMPIListener::MPIListenerOptions options;
+  options.reporting = GTestMPIListener::kReportPerTestSuite;
+  listeners.Append(
+      new GTestMPIListener::MPIWrapperPrinter(l, MPI_COMM_WORLD, options));
+
+  // Run tests, then clean up and exit. RUN_ALL_TESTS() returns 0 if all tests
+  // pass and 1 if some test fails.
+  int result = RUN_ALL_TESTS();
+
+  return 0;
+}
@@ -0,0 +1,87 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+ ******************************************************************************/
+
+#include "gtest/gtest.h"
+#include "gtest-mpi-listener.hpp"
+#include "mpi.h"
+#include <string>
+
+// Tests whose failures overflow the limits set in main, so that rank 0
+// reports a summary in place of the results it did not collect
+
+namespace
+{
+int getMpiRank(MPI_Comm comm) {
+  int out;
+  MPI_Comm_rank(comm, &out);
+  return out;
+}
+
+} // end anonymous namespace
+
+TEST(StreamingMPI, PassOnAllRanks) {
+  EXPECT_EQ(getMpiRank(MPI_COMM_WORLD), getMpiRank(MPI_COMM_WORLD));
+}
+
+// Should report one failure per rank
+TEST(StreamingMPI, FailOncePerRank) {
+  int rank = getMpiRank(MPI_COMM_WORLD);
+  EXPECT_EQ(rank, rank + 1);
+}
+
+// Should report three failures per rank, then say that the rest of each
+// rank's failures were not collected
+TEST(StreamingMPI, FailManyTimesPerRank) {
+  int rank = getMpiRank(MPI_COMM_WORLD);
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ(rank, i + 1000) << "Failure " << i;
+  }
+}
+
+// Long failure messages fill rank 0's budget after a few ranks; the
+// failures of the remaining ranks are summarized instead
+TEST(StreamingMPI, FailOverBudget) {
+  int rank = getMpiRank(MPI_COMM_WORLD);
+  EXPECT_EQ(rank, rank + 1) << std::string(1500, 'x');
+}
+
+int main(int argc, char** argv) {
+  // Filter out Google Test arguments
+  ::testing::InitGoogleTest(&argc, argv);
+
+  // Initialize MPI
+  MPI_Init(&argc, &argv);
+
+  // Add object that will finalize MPI on exit; Google Test owns this pointer
+  ::testing::AddGlobalTestEnvironment(new GTestMPIListener::MPIEnvironment);
+
+  // Get the event listener list.
+  ::testing::TestEventListeners& listeners =
+      ::testing::UnitTest::GetInstance()->listeners();
+
+  // Remove default listener: the default printer and the default XML printer
+  delete listeners.Release(listeners.default_result_printer());
+  delete listeners.Release(listeners.default_xml_generator());
+
+  // Adds MPI listener, which takes results from one rank at a time and
+  // holds at most 4 kB of them; Google Test owns this pointer
+  GTestMPIListener::MPIListenerOptions options;
+  options.aggregation = GTestMPIListener::kStreamingAggregation;
+  options.max_results_per_rank = 3;
+  options.stream_budget_bytes = 4096;
+  options.stream_chunk_bytes = 1024;
+  listeners.Append(new GTestMPIListener::MPIMinimalistPrinter(MPI_COMM_WORLD,
+                                                              options));
+
+  // Run tests, then clean up and exit. RUN_ALL_TESTS() returns 0 if all tests
+  // pass and 1 if some test fails.
+  int result = RUN_ALL_TESTS();
+
+  return 0;
+}
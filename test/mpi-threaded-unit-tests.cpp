@@ -0,0 +1,94 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+ ******************************************************************************/
+
+#include "gtest/gtest.h"
+#include "gtest-mpi-listener.hpp"
+#include "mpi.h"
+#include <thread>
+#include <vector>
+
+// Tests whose assertions run on several threads at once; only the main
+// thread calls MPI, so MPI_THREAD_FUNNELED is enough.
+
+namespace
+{
+const int kThreadCount = 4;
+
+int getMpiRank(MPI_Comm comm) {
+  int out;
+  MPI_Comm_rank(comm, &out);
+  return out;
+}
+
+// Runs check(thread) on kThreadCount threads and waits for them
+template <typename Check>
+void onThreads(Check check) {
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreadCount; t++) {
+    threads.push_back(std::thread(check, t));
+  }
+  for (int t = 0; t < kThreadCount; t++) { threads[t].join(); }
+}
+
+} // end anonymous namespace
+
+TEST(ThreadedMPI, PassOnAllThreads) {
+  const int rank = getMpiRank(MPI_COMM_WORLD);
+  onThreads([rank](int thread) {
+    for (int i = 0; i < 10000; i++) { EXPECT_EQ(rank + thread, thread + rank); }
+  });
+}
+
+// Should report two failures per thread on every rank
+TEST(ThreadedMPI, FailOnAllThreads) {
+  const int rank = getMpiRank(MPI_COMM_WORLD);
+  onThreads([rank](int thread) {
+    EXPECT_EQ(rank, rank + thread + 1) << "First failure on thread " << thread;
+    EXPECT_EQ(rank, rank + thread + 1) << "Second failure on thread " << thread;
+  });
+}
+
+// Should report one failure, from the last thread, on rank zero only
+TEST(ThreadedMPI, FailOnOneThreadOfRankZero) {
+  const int rank = getMpiRank(MPI_COMM_WORLD);
+  onThreads([rank](int thread) {
+    EXPECT_FALSE(rank == 0 && thread == kThreadCount - 1);
+  });
+}
+
+int main(int argc, char** argv) {
+  // Filter out Google Test arguments
+  ::testing::InitGoogleTest(&argc, argv);
+
+  // Initialize MPI for threads that do not call MPI themselves
+  int provided;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+
+  // Add object that will finalize MPI on exit, after checking the thread
+  // level; Google Test owns this pointer
+  ::testing::AddGlobalTestEnvironment(
+      new GTestMPIListener::MPIEnvironment(MPI_THREAD_FUNNELED));
+
+  // Get the event listener list.
+  ::testing::TestEventListeners& listeners =
+      ::testing::UnitTest::GetInstance()->listeners();
+
+  // Remove default listener: the default printer and the default XML printer
+  delete listeners.Release(listeners.default_result_printer());
+  delete listeners.Release(listeners.default_xml_generator());
+
+  // Adds MPI listener; Google Test owns this pointer
+  listeners.Append(new GTestMPIListener::MPIMinimalistPrinter);
+
+  // Run tests, then clean up and exit. RUN_ALL_TESTS() returns 0 if all tests
+  // pass and 1 if some test fails.
+  int result = RUN_ALL_TESTS();
+
+  return 0;
+}
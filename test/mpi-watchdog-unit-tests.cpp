@@ -0,0 +1,132 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+ ******************************************************************************/
+
+#include "gtest/gtest.h"
+#include "gtest-mpi-watchdog.hpp"
+#include "mpi.h"
+#include <chrono>
+#include <thread>
+
+// Simple-minded functions for some testing
+
+namespace
+{
+int getMpiRank(MPI_Comm comm) {
+  int out;
+  MPI_Comm_rank(comm, &out);
+  return out;
+}
+
+int getMpiSize(MPI_Comm comm) {
+  int out;
+  MPI_Comm_size(comm, &out);
+  return out;
+}
+
+} // end anonymous namespace
+
+// Pass: setting up and tearing down test suites is not timed, so
+// doing either for longer than the 5 second timeout, after a test has
+// armed the watchdog, does not abort the run. Google Test runs these
+// suites first, in the order they are defined.
+class WatchdogSlowTearDownMPI : public ::testing::Test {
+ protected:
+#ifndef GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+  static void TearDownTestCase() {
+#else
+  static void TearDownTestSuite() {
+#endif // GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+    std::this_thread::sleep_for(std::chrono::seconds(6));
+    MPI_Barrier(MPI_COMM_WORLD);
+  }
+};
+
+TEST_F(WatchdogSlowTearDownMPI, PassBeforeSlowTearDown) {
+  MPI_Comm comm = MPI_COMM_WORLD;
+  EXPECT_EQ(getMpiRank(comm), getMpiRank(comm));
+}
+
+class WatchdogSlowSetUpMPI : public ::testing::Test {
+ protected:
+#ifndef GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+  static void SetUpTestCase() {
+#else
+  static void SetUpTestSuite() {
+#endif // GTEST_REMOVE_LEGACY_TEST_CASEAPI_
+    std::this_thread::sleep_for(std::chrono::seconds(6));
+    MPI_Barrier(MPI_COMM_WORLD);
+  }
+};
+
+TEST_F(WatchdogSlowSetUpMPI, PassAfterSlowSetUp) {
+  MPI_Comm comm = MPI_COMM_WORLD;
+  EXPECT_EQ(getMpiRank(comm), getMpiRank(comm));
+}
+
+// These tests could be made shorter with a fixture, but a fixture
+// deliberately isn't used in order to make the test harness extremely simple
+TEST(WatchdogMPI, PassOnAllRanks) {
+  MPI_Comm comm = MPI_COMM_WORLD;
+  EXPECT_EQ(getMpiRank(comm), getMpiRank(comm));
+}
+
+TEST(WatchdogMPI, FinishWithinTimeout) {
+  MPI_Comm comm = MPI_COMM_WORLD;
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  MPI_Barrier(comm);
+}
+
+// Always times out: the last rank never finishes, so the other ranks
+// wait for it while the printer collects results. The watchdog reports
+// the last rank as still running the test and the other ranks as
+// waiting, then aborts the run.
+TEST(WatchdogMPI, HangOnLastRank) {
+  MPI_Comm comm = MPI_COMM_WORLD;
+  if (getMpiRank(comm) == getMpiSize(comm) - 1) {
+    while (true) { std::this_thread::sleep_for(std::chrono::seconds(1)); }
+  }
+}
+
+int main(int argc, char** argv) {
+  // Filter out Google Test arguments
+  ::testing::InitGoogleTest(&argc, argv);
+
+  // Initialize MPI so that the watchdog thread may call MPI while the
+  // tests block in MPI
+  int provided;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+
+  // Add object that will finalize MPI on exit; Google Test owns this pointer
+  ::testing::AddGlobalTestEnvironment(new GTestMPIListener::MPIEnvironment);
+
+  // Get the event listener list.
+  ::testing::TestEventListeners& listeners =
+      ::testing::UnitTest::GetInstance()->listeners();
+
+  // Remove default listener: the default printer and the default XML printer
+  ::testing::TestEventListener *l =
+        listeners.Release(listeners.default_result_printer());
+
+  // Adds MPI listener; Google Test owns this pointer
+  listeners.Append(
+      new GTestMPIListener::MPIWrapperPrinter(l,
+                                              MPI_COMM_WORLD)
+      );
+
+  // Adds the watchdog after the printer, with a 5 second timeout per
+  // test; Google Test owns this pointer
+  listeners.Append(
+      new GTestMPIListener::MPIHangWatchdog(5.0, MPI_COMM_WORLD));
+
+  // Run tests, then clean up and exit. RUN_ALL_TESTS() returns 0 if all tests
+  // pass and 1 if some test fails.
+  int result = RUN_ALL_TESTS();
+
+  return 0;
+}
@@ -0,0 +1,251 @@
+/******************************************************************************
+ *
+ * Copyright (c) 2016-2018, Lawrence Livermore National Security, LLC
+ * and other gtest-mpi-listener developers. See the COPYRIGHT file for details.
+ *
+ * SPDX-License-Identifier: (Apache-2.0 OR MIT)
+ *
+ ******************************************************************************/
+
+// Merges the rank logs written by MPIRankLogPrinter into one report,
+// test by test in the order of the test program, and rank by rank
+// within each test. Usage:
+//
+//   gtest-mpi-log-merge [--format=console|xml|json] [--output=FILE]
+//                       [--deduplicate] LOG...
+//
+// The console format resembles the output of MPIMinimalistPrinter; the
+// xml format is JUnit XML, and the json format follows Google Test's
+// JSON report, both as written by MPIStreamingReportWriter, which needs
+// --output. Exits with 1 if some test failed on some rank, and with 2
+// if the logs could not be read.
+
+#include "gtest-mpi-log-listener.hpp"
+#include "gtest-mpi-report-writer.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+using GTestMPIListener::internal::RankLog;
+using GTestMPIListener::internal::RankResult;
+using GTestMPIListener::internal::RankSet;
+
+// One test of one iteration, merged over the ranks that logged it
+struct MergedTest
+{
+  MergedTest() : name(), iteration(0), ranks(), failed(false),
+                 ran(false), max_seconds(0.0), max_rank(0), results() {}
+
+  std::string name;
+  int iteration;
+  RankSet ranks;
+  bool failed;
+  bool ran;
+  double max_seconds;
+  int max_rank;
+  std::vector<char> results;
+
+  bool Skipped() const { return !ran; }
+
+  std::string SuiteName() const { return name.substr(0, name.find('.')); }
+
+  std::string TestName() const { return name.substr(name.find('.') + 1); }
+};
+
+typedef std::map<std::pair<int, int>, MergedTest> MergedTests;
+
+// Adds every test in log to tests; logs must be added in rank order
+void mergeLog(const RankLog& log, MergedTests& tests)
+{
+  for (size_t i = 0; i < log.tests.size(); i++) {
+    const GTestMPIListener::internal::LoggedTest& logged = log.tests[i];
+    MergedTest& test =
+        tests[std::make_pair(logged.iteration, logged.position)];
+    if (test.ranks.ranges.empty()) {
+      test.name = logged.name;
+      test.iteration = logged.iteration;
+    }
+    test.ranks.Merge(RankSet(log.rank));
+    test.failed = test.failed
+                  || logged.status == GTestMPIListener::kLoggedTestFailed;
+    if (logged.status != GTestMPIListener::kLoggedTestSkipped) {
+      test.ran = true;
+    }
+    if (logged.seconds > test.max_seconds) {
+      test.max_seconds = logged.seconds;
+      test.max_rank = log.rank;
+    }
+    test.results.insert(test.results.end(),
+                        logged.results.begin(), logged.results.end());
+  }
+}
+
+// The failures of test, in rank order
+std::vector<RankResult> failuresOf(const MergedTest& test, bool deduplicate)
+{
+  std::vector<char> buffer(test.results);
+  if (deduplicate) { GTestMPIListener::internal::DeduplicateResults(buffer); }
+  std::vector<RankResult> all, failures;
+  GTestMPIListener::internal::UnpackResults(buffer, all);
+  for (size_t i = 0; i < all.size(); i++) {
+    if (all[i].result.failed()) { failures.push_back(all[i]); }
+  }
+  return failures;
+}
+
+void writeConsole(FILE *out, const std::vector<const MergedTest*>& tests,
+                  int size, bool deduplicate)
+{
+  const bool repeated = !tests.empty() && tests.back()->iteration > 0;
+  std::vector<std::string> failedTests;
+  for (size_t t = 0; t < tests.size(); t++) {
+    const MergedTest& test = *tests[t];
+    if (repeated && (t == 0 || test.iteration != tests[t - 1]->iteration)) {
+      fprintf(out, "\nRepeating all tests (iteration %d) . . .\n\n",
+              test.iteration + 1);
+    }
+    if (test.ranks.ranges.size() == 1 && test.ranks.ranges[0].first == 0
+        && test.ranks.ranges[0].second == size - 1) {
+      fprintf(out, "*** Test %s starting.\n", test.name.c_str());
+    } else {
+      fprintf(out, "*** Test %s starting on rank%s %s.\n", test.name.c_str(),
+              test.ranks.HasSingleRank() ? "" : "s",
+              test.ranks.ToString().c_str());
+    }
+    const std::vector<RankResult> failures = failuresOf(test, deduplicate);
+    for (size_t i = 0; i < failures.size(); i++) {
+      const ::testing::TestPartResult& result = failures[i].result;
+      fprintf(out, "      *** Failure on rank%s %s, %s:%d\n%s\n",
+              failures[i].ranks.HasSingleRank() ? "" : "s",
+              failures[i].ranks.ToString().c_str(),
+              result.file_name() ? result.file_name() : "unknown file",
+              result.line_number(), result.summary());
+    }
+    if (test.Skipped()) {
+      fprintf(out, "*** Test %s skipped.\n", test.name.c_str());
+    } else {
+      fprintf(out, "*** Test %s ending (%.3f s on slowest rank %d).\n",
+              test.name.c_str(), test.max_seconds, test.max_rank);
+    }
+    if (test.failed) { failedTests.push_back(test.name); }
+  }
+
+  fprintf(out, "\n%d tests ran on %d ranks; %d failed",
+          static_cast<int>(tests.size()), size,
+          static_cast<int>(failedTests.size()));
+  fprintf(out, failedTests.empty() ? ".\n" : ":\n");
+  for (size_t i = 0; i < failedTests.size(); i++) {
+    fprintf(out, "  %s\n", failedTests[i].c_str());
+  }
+}
+
+// Writes a JUnit XML or JSON report through the streaming writer that
+// printers use
+void writeReport(const std::string& file_name,
+                 GTestMPIListener::ReportFormat format,
+                 const std::vector<const MergedTest*>& tests, int size,
+                 bool deduplicate)
+{
+  GTestMPIListener::MPIStreamingReportWriter writer(file_name, format);
+  for (size_t t = 0; t < tests.size(); t++) {
+    const MergedTest& test = *tests[t];
+    writer.WriteTest(test.name, test.max_seconds, test.Skipped(),
+                     failuresOf(test, deduplicate), size);
+  }
+  writer.Close();
+}
+
+bool hasRankBefore(const RankLog& a, const RankLog& b)
+{
+  return a.rank < b.rank;
+}
+
+void printUsage()
+{
+  printf("Usage: gtest-mpi-log-merge [--format=console|xml|json] "
+         "[--output=FILE]\n"
+         "                           [--deduplicate] LOG...\n"
+         "--output is required with --format=xml or --format=json.\n");
+}
+
+} // end anonymous namespace
+
+int main(int argc, char** argv) {
+  std::string format("console");
+  std::string outputName;
+  bool deduplicate = false;
+  std::vector<std::string> logNames;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg(argv[i]);
+    if (arg.find("--format=") == 0) {
+      format = arg.substr(std::strlen("--format="));
+    } else if (arg.find("--output=") == 0) {
+      outputName = arg.substr(std::strlen("--output="));
+    } else if (arg == "--deduplicate") {
+      deduplicate = true;
+    } else if (arg.find("--") == 0) {
+      printUsage();
+      return 2;
+    } else {
+      logNames.push_back(arg);
+    }
+  }
+  // The report writer needs to seek in its file, so it cannot write
+  // to standard output
+  if (logNames.empty()
+      || (format != "console" && format != "xml" && format != "json")
+      || (format != "console" && outputName.empty())) {
+    printUsage();
+    return 2;
+  }
+
+  std::vector<RankLog> logs(logNames.size());
+  for (size_t i = 0; i < logNames.size(); i++) {
+    if (!GTestMPIListener::internal::ReadRankLog(logNames[i], logs[i])) {
+      return 2;
+    }
+  }
+  std::sort(logs.begin(), logs.end(), hasRankBefore);
+  const int size = logs[0].size;
+  if (static_cast<int>(logs.size()) != size) {
+    fprintf(stderr, "Warning: merging %d rank logs from a run on %d ranks.\n",
+            static_cast<int>(logs.size()), size);
+  }
+
+  MergedTests merged;
+  for (size_t i = 0; i < logs.size(); i++) { mergeLog(logs[i], merged); }
+  std::vector<const MergedTest*> tests;
+  bool anyFailed = false;
+  for (MergedTests::const_iterator test = merged.begin();
+       test != merged.end(); ++test) {
+    tests.push_back(&test->second);
+    anyFailed = anyFailed || test->second.failed;
+  }
+
+  if (format != "console") {
+    writeReport(outputName,
+                (format == "json") ? GTestMPIListener::kJsonReport
+                                   : GTestMPIListener::kJUnitXmlReport,
+                tests, size, deduplicate);
+    return anyFailed ? 1 : 0;
+  }
+
+  FILE *out = stdout;
+  if (!outputName.empty()) {
+    out = std::fopen(outputName.c_str(), "w");
+    if (!out) {
+      printf("Could not open '%s' for output!\n", outputName.c_str());
+      return 2;
+    }
+  }
+  writeConsole(out, tests, size, deduplicate);
+  if (out != stdout) { std::fclose(out); }
+
+  return anyFailed ? 1 : 0;
+}